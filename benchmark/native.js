@@ -0,0 +1,146 @@
+// Native benchmarks for the device list, the V8 conversion of `find`
+// results, the native allocations per operation, the event pipeline and the per-bus parallel enumeration, run against the `detection_benchmark`
+// addon which is only built with `USB_DETECTION_BENCHMARK=1 npm run rebuild`.
+//
+// Usage: node benchmark/native.js [events]
+// Prints the results as JSON.
+
+var os = require('os');
+var fs = require('fs');
+var path = require('path');
+
+var detection;
+try {
+	detection = require('bindings')('detection_benchmark.node');
+} catch(err) {
+	process.stderr.write('Build the benchmark addon first: USB_DETECTION_BENCHMARK=1 npm run rebuild\n');
+	process.exit(1);
+}
+
+var DEVICE_COUNTS = [10, 100, 1000, 10000];
+var EVENTS = parseInt(process.argv[2], 10) || 10000;
+// Has to match `BENCHMARK_VENDOR_ID` in src/benchmark.h
+var BENCHMARK_VENDOR_ID = 0xbeef;
+
+var SYNTHETIC_BUSES = 16;
+var SYNTHETIC_DEVICES_PER_BUS = 64;
+// Roughly what a real USB device has in sysfs
+var SYNTHETIC_ATTRIBUTES = ['idVendor', 'idProduct', 'serial', 'product', 'manufacturer', 'speed', 'bMaxPower',
+	'bDeviceClass', 'bDeviceSubClass', 'bDeviceProtocol', 'bNumConfigurations', 'bNumInterfaces', 'busnum',
+	'devnum', 'devpath', 'version', 'removable', 'authorized', 'maxchild', 'quirks'];
+
+function percentile(sorted, fraction) {
+	return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * fraction))];
+}
+
+function benchEvents(count, callback) {
+	var latencies = [];
+	detection.registerAdded(function(device) {
+		if(device.vendorId !== BENCHMARK_VENDOR_ID) {
+			return;
+		}
+
+		// The native side puts the injection time (`uv_hrtime`) in the serial number
+		latencies.push(Number(process.hrtime.bigint() - BigInt(device.serialNumber)));
+	});
+
+	detection.benchmarkEvents(count, function(err, result) {
+		latencies.sort(function(a, b) {
+			return a - b;
+		});
+
+		callback({
+			events: result.events,
+			eventsPerSecond: result.events / (result.totalNs / 1e9),
+			latencyNs: {
+				min: latencies[0],
+				median: percentile(latencies, 0.5),
+				p99: percentile(latencies, 0.99),
+				max: latencies[latencies.length - 1]
+			}
+		});
+	});
+}
+
+// `<root>/<bus>/<device>/<attribute>`, see `ReadSyntheticBus` in src/benchmark.cpp
+function createSyntheticTree() {
+	var root = fs.mkdtempSync(path.join(os.tmpdir(), 'usb-detection-sysfs-'));
+	for(var bus = 1; bus <= SYNTHETIC_BUSES; bus++) {
+		fs.mkdirSync(path.join(root, 'usb' + bus));
+		for(var device = 1; device <= SYNTHETIC_DEVICES_PER_BUS; device++) {
+			var devicePath = path.join(root, 'usb' + bus, bus + '-' + device);
+			fs.mkdirSync(devicePath);
+			SYNTHETIC_ATTRIBUTES.forEach(function(attribute, index) {
+				fs.writeFileSync(path.join(devicePath, attribute), attribute === 'idVendor' ? 'beef\n' : String(index) + '\n');
+			});
+		}
+	}
+
+	return root;
+}
+
+function benchEnumeration() {
+	var root = createSyntheticTree();
+	var maxThreads = Math.min(os.cpus().length, 8);
+
+	var runs = [];
+	for(var threads = 1; threads <= maxThreads; threads++) {
+		// Best of a few, the first one also warms the page cache
+		var best;
+		for(var i = 0; i < 3; i++) {
+			var run = detection.benchmarkEnumeration(root, threads);
+			if(!best || run.totalNs < best.totalNs) {
+				best = run;
+			}
+		}
+		best.speedup = runs.length > 0 ? runs[0].totalNs / best.totalNs : 1;
+		runs.push(best);
+	}
+
+	fs.rmdirSync(root, { recursive: true });
+
+	return runs;
+}
+
+function noop() {}
+
+// With a global callback and three monitors, two of which want the same
+// fields, so the notify path converts the device twice and shares it once
+function benchAllocations() {
+	detection.registerAdded(noop);
+	var monitors = [
+		detection.createMonitor({ vendorId: BENCHMARK_VENDOR_ID }, noop),
+		detection.createMonitor({ vendorId: BENCHMARK_VENDOR_ID }, noop),
+		detection.createMonitor({ vendorId: BENCHMARK_VENDOR_ID, fields: ['vendorId', 'productId'] }, noop)
+	];
+
+	var allocations = DEVICE_COUNTS.map(function(count) {
+		return detection.benchmarkAllocations(count);
+	});
+
+	monitors.forEach(function(id) {
+		detection.closeMonitor(id);
+	});
+
+	return allocations;
+}
+
+var results = {
+	benchmark: 'native',
+	version: require('../package.json').version,
+	node: process.version,
+	platform: process.platform,
+	registry: DEVICE_COUNTS.map(function(count) {
+		return detection.benchmarkRegistry(count);
+	}),
+	conversion: DEVICE_COUNTS.map(function(count) {
+		return detection.benchmarkConversion(count);
+	}),
+	allocations: benchAllocations(),
+	enumeration: benchEnumeration()
+};
+
+benchEvents(EVENTS, function(events) {
+	results.events = events;
+	process.stdout.write(JSON.stringify(results, null, 2) + '\n');
+});
@@ -0,0 +1,78 @@
+// Measures how long a fresh process takes until its first `find()` resolves,
+// with and without a warm-start snapshot (`USB_DETECTION_SNAPSHOT`).
+//
+// Usage: node benchmark/restart-latency.js [iterations]
+// Prints the results as JSON.
+
+var os = require('os');
+var fs = require('fs');
+var path = require('path');
+var execFileSync = require('child_process').execFileSync;
+
+var ITERATIONS = parseInt(process.argv[2], 10) || 20;
+
+// Runs in the child, reports the time from before `require` to the first result
+var CHILD_SCRIPT = [
+	'var start = process.hrtime();',
+	'var usbDetect = require(' + JSON.stringify(path.join(__dirname, '..')) + ');',
+	'usbDetect.find().then(function(devices) {',
+	'	var elapsed = process.hrtime(start);',
+	'	process.stdout.write(JSON.stringify({',
+	'		ms: elapsed[0] * 1e3 + elapsed[1] / 1e6,',
+	'		devices: devices.length,',
+	'		provisional: !!devices.provisional',
+	'	}));',
+	'});'
+].join('\n');
+
+function runChild(env) {
+	var output = execFileSync(process.execPath, ['-e', CHILD_SCRIPT], {
+		env: Object.assign({}, process.env, env)
+	});
+
+	return JSON.parse(output.toString());
+}
+
+function summarize(runs) {
+	var times = runs.map(function(run) {
+		return run.ms;
+	}).sort(function(a, b) {
+		return a - b;
+	});
+
+	return {
+		iterations: times.length,
+		devices: runs[0].devices,
+		provisional: runs.filter(function(run) {
+			return run.provisional;
+		}).length,
+		minMs: times[0],
+		medianMs: times[Math.floor(times.length / 2)],
+		p90Ms: times[Math.floor(times.length * 0.9)],
+		maxMs: times[times.length - 1]
+	};
+}
+
+function bench(env) {
+	var runs = [];
+	for(var i = 0; i < ITERATIONS; i++) {
+		runs.push(runChild(env));
+	}
+
+	return summarize(runs);
+}
+
+var snapshotPath = path.join(os.tmpdir(), 'usb-detection-restart-benchmark-' + process.pid + '.snapshot');
+
+var cold = bench({});
+// The first warm run writes the snapshot, every run after that starts from it
+runChild({ USB_DETECTION_SNAPSHOT: snapshotPath });
+var warm = bench({ USB_DETECTION_SNAPSHOT: snapshotPath });
+
+fs.unlinkSync(snapshotPath);
+
+process.stdout.write(JSON.stringify({
+	benchmark: 'restart-latency',
+	cold: cold,
+	warm: warm
+}, null, 2) + '\n');
@@ -1,60 +1,100 @@
 {
-  "targets": [
-    {
-      "target_name": "detection",
-      "sources": [
-        "src/detection.cpp",
-        "src/detection.h",
-        "src/deviceList.cpp"
+  "variables": {
+    # `USB_DETECTION_BENCHMARK=1 npm run rebuild` also builds `detection_benchmark`
+    "with_benchmark%": "<!(node -p \"process.env.USB_DETECTION_BENCHMARK ? 1 : 0\")"
+  },
+  "target_defaults": {
+    "sources": [
+      "src/detection.cpp",
+      "src/detection.h",
+      "src/deviceList.cpp",
+      "src/deviceStore.cpp",
+      "src/snapshot.cpp",
+      "src/partitionPool.cpp",
+      "src/serializer.cpp",
+      "src/eventJournal.cpp",
+      "src/pipelineTrace.cpp"
+    ],
+    "include_dirs" : [
+      "<!(node -e \"require('nan')\")"
+    ],
+    'conditions': [
+      ['OS=="win"',
+        {
+          'sources': [
+            "src/detection_win.cpp"
+          ],
+          'include_dirs+':
+          [
+            # Not needed now
+          ]
+        }
       ],
-      "include_dirs" : [
-        "<!(node -e \"require('nan')\")"
+      ['OS=="mac"',
+        {
+          'sources': [
+            "src/detection_mac.cpp"
+          ],
+          "libraries": [
+            "-framework",
+            "IOKit"
+          ],
+          'default_configuration': 'Debug',
+          'configurations': {
+            'Debug': {
+              'defines': [ 'DEBUG', '_DEBUG' ],
+            },
+            'Release': {
+              'defines': [ 'NDEBUG' ]
+            }
+          }
+        }
       ],
-      'conditions': [
-        ['OS=="win"',
-          {
-            'sources': [
-              "src/detection_win.cpp"
-            ],
-            'include_dirs+':
-            [
-              # Not needed now
+      ['OS=="linux"',
+        {
+          'sources': [
+            "src/detection_linux.cpp",
+            "src/sharedRegistry.cpp",
+            "src/propertyTable.cpp",
+            "src/ueventCapture.cpp"
+          ],
+          'link_settings': {
+            'libraries': [
+              '-ludev',
+              '-lrt'
             ]
           }
-        ],
-        ['OS=="mac"',
-          {
-            'sources': [
-              "src/detection_mac.cpp"
-            ],
-            "libraries": [
-              "-framework",
-              "IOKit"
-            ],
-            'default_configuration': 'Debug',
-            'configurations': {
-              'Debug': {
-                'defines': [ 'DEBUG', '_DEBUG' ],
-              },
-              'Release': {
-                'defines': [ 'NDEBUG' ]
-              }
-            }
-          }
-        ],
-        ['OS=="linux"',
+        }
+      ]
+    ]
+  },
+  "targets": [
+    {
+      "target_name": "detection"
+    }
+  ],
+  'conditions': [
+    ['with_benchmark==1',
+      {
+        "targets": [
           {
-            'sources': [
-              "src/detection_linux.cpp"
+            "target_name": "detection_benchmark",
+            "sources": [
+              "src/benchmark.cpp",
+              "src/benchmark.h"
             ],
-            'link_settings': {
-              'libraries': [
-                '-ludev'
+            'defines': [ 'USB_DETECTION_BENCHMARK' ],
+            'conditions': [
+              ['OS=="linux"',
+                {
+                  # Keeps the counting `operator new` in src/benchmark.cpp to this addon
+                  'ldflags': [ '-Wl,-Bsymbolic-functions' ]
+                }
               ]
-            }
+            ]
           }
         ]
-      ]
-    }
+      }
+    ]
   ]
 }
@@ -0,0 +1,132 @@
+// Decoder for `serialize({ format: 'binary' })` Buffers, the layout is
+// described in src/serializer.h. No dependencies so it can be copied to
+// wherever the Buffers end up.
+
+var MAGIC = 'USBL';
+var VERSION = 1;
+var FLAG_PROVISIONAL = 0x01;
+
+// `DeviceField_t` order, one bit each
+var FIELDS = [
+	['locationId', 'number'],
+	['vendorId', 'number'],
+	['productId', 'number'],
+	['deviceName', 'string'],
+	['manufacturer', 'string'],
+	['serialNumber', 'string'],
+	['deviceAddress', 'number'],
+	['portPath', 'string'],
+	['childDevNodes', 'strings'],
+	['properties', 'properties'],
+	['deviceClass', 'number'],
+	['deviceSubClass', 'number'],
+	['deviceProtocol', 'number'],
+	['interfaces', 'interfaces']
+];
+
+function decode(buffer) {
+	var offset = 0;
+
+	function ensure(length) {
+		if(offset + length > buffer.length) {
+			throw new Error('Truncated device list at byte ' + offset);
+		}
+	}
+
+	function readByte() {
+		ensure(1);
+		return buffer[offset++];
+	}
+
+	function readVarint() {
+		var value = 0;
+		var factor = 1;
+		var byte;
+		do {
+			byte = readByte();
+			value += (byte & 0x7f) * factor;
+			factor *= 128;
+		} while(byte & 0x80);
+		return value;
+	}
+
+	function readString() {
+		var length = readVarint();
+		ensure(length);
+		var value = buffer.toString('utf8', offset, offset + length);
+		offset += length;
+		return value;
+	}
+
+	function readField(type) {
+		var count, i, list;
+		switch(type) {
+			case 'number':
+				// Written as the unsigned 32 bits of the native int
+				return readVarint() | 0;
+			case 'string':
+				return readString();
+			case 'strings':
+				count = readVarint();
+				list = [];
+				for(i = 0; i < count; i++) {
+					list.push(readString());
+				}
+				return list;
+			case 'properties':
+				count = readVarint();
+				list = {};
+				for(i = 0; i < count; i++) {
+					var key = readString();
+					list[key] = readString();
+				}
+				return list;
+			case 'interfaces':
+				count = readVarint();
+				list = [];
+				for(i = 0; i < count; i++) {
+					list.push({
+						interfaceClass: readByte(),
+						interfaceSubClass: readByte(),
+						interfaceProtocol: readByte()
+					});
+				}
+				return list;
+		}
+	}
+
+	ensure(MAGIC.length + 2);
+	if(buffer.toString('latin1', 0, MAGIC.length) !== MAGIC) {
+		throw new Error('Not a serialized device list');
+	}
+	offset = MAGIC.length;
+
+	var version = readByte();
+	if(version !== VERSION) {
+		throw new Error('Unsupported device list version ' + version);
+	}
+
+	var flags = readByte();
+	var fields = readVarint();
+	var count = readVarint();
+
+	var devices = [];
+	for(var i = 0; i < count; i++) {
+		var device = {};
+		for(var bit = 0; bit < FIELDS.length; bit++) {
+			if(fields & (1 << bit)) {
+				device[FIELDS[bit][0]] = readField(FIELDS[bit][1]);
+			}
+		}
+		devices.push(device);
+	}
+
+	// Same marker as on `find` results
+	if(flags & FLAG_PROVISIONAL) {
+		devices.provisional = true;
+	}
+
+	return devices;
+}
+
+module.exports = decode;
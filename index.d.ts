@@ -3,6 +3,12 @@
 // Definitions by: Rob Moran <https://github.com/thegecko>
 //                 Rico Brase <https://github.com/RicoBrase>
 
+export interface UsbInterfaceClass {
+    interfaceClass: number;
+    interfaceSubClass: number;
+    interfaceProtocol: number;
+}
+
 export interface Device {
     locationId: number;
     vendorId: number;
@@ -11,17 +17,159 @@ export interface Device {
     manufacturer: string;
     serialNumber: string;
     deviceAddress: number;
+    portPath: string;
+    childDevNodes: string[];
+    properties: { [name: string]: string };
+    deviceClass: number;
+    deviceSubClass: number;
+    deviceProtocol: number;
+    interfaces: UsbInterfaceClass[];
+}
+
+// `find` results carry `provisional: true` while they come from an unvalidated snapshot
+export type DeviceList<T> = T[] & { provisional?: boolean };
+
+export type DeviceField = keyof Device;
+
+export interface ClassFilter {
+    deviceClass?: number;
+    deviceSubClass?: number;
+    deviceProtocol?: number;
+    interfaceClass?: number;
+    interfaceSubClass?: number;
+    interfaceProtocol?: number;
+}
+
+export interface FindOptions extends ClassFilter {
+    vendorId?: number;
+    productId?: number;
+    fields?: DeviceField[];
+}
+
+export function find(options: FindOptions, callback: (error: any, devices: DeviceList<Partial<Device>>) => any): void;
+export function find(options: FindOptions): Promise<DeviceList<Partial<Device>>>;
+export function find(vid: number, pid: number, callback: (error: any, devices: DeviceList<Device>) => any): void;
+export function find(vid: number, pid: number): Promise<DeviceList<Device>>;
+export function find(vid: number, callback: (error: any, devices: DeviceList<Device>) => any): void;
+export function find(vid: number): Promise<DeviceList<Device>>;
+export function find(callback: (error: any, devices: DeviceList<Device>) => any): void;
+export function find(): Promise<DeviceList<Device>>;
+
+export interface FindManyQuery {
+    vendorId?: number;
+    productId?: number;
+}
+
+export interface FindManyOptions {
+    fields?: DeviceField[];
+}
+
+// One list per query, in query order
+export type DeviceLists<T> = T[][] & { provisional?: boolean };
+
+export function findMany(queries: FindManyQuery[], options: FindManyOptions, callback: (error: any, devices: DeviceLists<Partial<Device>>) => any): void;
+export function findMany(queries: FindManyQuery[], options?: FindManyOptions): Promise<DeviceLists<Partial<Device>>>;
+export function findMany(queries: FindManyQuery[], callback: (error: any, devices: DeviceLists<Device>) => any): void;
+
+export function findUnder(portPath: string | Device, callback: (error: any, devices: Device[]) => any): void;
+export function findUnder(portPath: string | Device): Promise<Device[]>;
+export function parentOf(device: string | Device, callback: (error: any, device: Device | undefined) => any): void;
+export function parentOf(device: string | Device): Promise<Device | undefined>;
+
+export function findBySerial(serialNumber: string, callback: (error: any, devices: DeviceList<Device>) => any): void;
+export function findBySerial(serialNumber: string): Promise<DeviceList<Device>>;
+export function findBySerialPrefix(prefix: string, callback: (error: any, devices: DeviceList<Device>) => any): void;
+export function findBySerialPrefix(prefix: string): Promise<DeviceList<Device>>;
+
+export function getAttributes(device: string | Device): { [name: string]: string } | undefined;
+
+export interface TopologyHashFilter {
+    vendorId?: number;
+    productId?: number;
+}
+
+export function topologyHash(filter?: TopologyHashFilter): string;
+
+export interface SerializeFilter extends ClassFilter {
+    vendorId?: number;
+    productId?: number;
 }
 
-export function find(vid: number, pid: number, callback: (error: any, devices: Device[]) => any): void;
-export function find(vid: number, pid: number): Promise<Device[]>;
-export function find(vid: number, callback: (error: any, devices: Device[]) => any): void;
-export function find(vid: number): Promise<Device[]>;
-export function find(callback: (error: any, devices: Device[]) => any): void;
-export function find(): Promise<Device[]>;
+export interface SerializeOptions {
+    format?: 'ndjson' | 'binary';
+    filter?: SerializeFilter;
+    fields?: DeviceField[];
+}
+
+export function serialize(options: SerializeOptions, callback: (error: any, data: Buffer) => any): void;
+export function serialize(options?: SerializeOptions): Promise<Buffer>;
+export function decode(buffer: Buffer): DeviceList<Partial<Device>>;
+
+export interface WaitForFilter {
+    vendorId?: number;
+    productId?: number;
+    serialNumber?: string;
+}
+
+export function waitFor(filter: WaitForFilter, timeoutMs: number | undefined, callback: (error: any, device: Device) => any): void;
+export function waitFor(filter: WaitForFilter, timeoutMs?: number): Promise<Device>;
+
+export interface MonitorOptions extends ClassFilter {
+    vendorId?: number;
+    productId?: number;
+    serialNumber?: string;
+    serialPrefix?: string;
+    actions?: Array<'add' | 'insert' | 'remove' | 'ready'>;
+    fields?: DeviceField[];
+}
+
+export interface Monitor {
+    on(event: 'add' | 'insert' | 'remove' | 'change' | 'ready', callback: (device: Device) => void): void;
+    close(): void;
+}
+
+export function createMonitor(options?: MonitorOptions): Monitor;
+
+export interface ReadyOptions {
+    settleTimeout?: number;
+}
+
+export function enableReadyEvents(options?: ReadyOptions): void;
+
+export interface HistoryFilter extends ClassFilter {
+    vendorId?: number;
+    productId?: number;
+    serialNumber?: string;
+    serialPrefix?: string;
+    actions?: Array<'add' | 'insert' | 'remove'>;
+}
+
+export interface HistoryOptions {
+    sinceSeq?: number;
+    filter?: HistoryFilter;
+    fields?: DeviceField[];
+}
+
+export interface HistoryEvent {
+    seq: number;
+    timestamp: number;
+    action: 'add' | 'remove';
+    device: Partial<Device>;
+}
+
+// `truncated: true` when events after `sinceSeq` were already dropped from the journal
+export type History = HistoryEvent[] & { lastSeq: number; truncated?: boolean };
+
+export function getHistory(options?: HistoryOptions): History;
+
+// Chrome trace-event JSON, loadable in Perfetto or chrome://tracing
+export function startTracing(): void;
+export function stopTracing(): string;
 
 export function startMonitoring(): void;
 export function stopMonitoring(): void;
+export function pauseMonitoring(): void;
+export function resumeMonitoring(): void;
 export function on(event: string, callback: (device: Device) => void): void;
 
 export const version: number;
@@ -19,9 +19,36 @@ if(global[index.name] && global[index.name].version === index.version) {
 		maxListeners: 1000 // default would be 10!
 	});
 
+	// Call a native `(..., callback(err, result))` function and hand the result
+	// to both the optional node-style callback and the returned promise
+	function callNative(name, args, callback, mapResult) {
+		return new Promise(function(resolve, reject) {
+			detection[name].apply(detection, args.concat(function(err, result) {
+				if(!err && mapResult) {
+					result = mapResult(result);
+				}
+
+				if(callback) {
+					callback.call(callback, err, result);
+				}
+
+				if(err) {
+					reject(err);
+					return;
+				}
+				resolve(result);
+			}));
+		});
+	}
+
+	function getPortPath(device) {
+		return typeof device === 'string' ? device : device && device.portPath;
+	}
+
 	//detector.find = detection.find;
 	detector.find = function(vid, pid, callback) {
 		// Suss out the optional parameters
+		// (`vid` can also be an options object, `find({ vendorId, productId, fields, deviceClass, interfaceClass, ... }, callback)`)
 		if(isFunction(vid) && !pid && !callback) {
 			callback = vid;
 			vid = undefined;
@@ -61,6 +88,63 @@ if(global[index.name] && global[index.name].version === index.version) {
 		});
 	};
 
+	// `findMany([{ vendorId, productId }, ...], { fields }, callback)`, one result array per query
+	detector.findMany = function(queries, options, callback) {
+		if(isFunction(options) && !callback) {
+			callback = options;
+			options = undefined;
+		}
+
+		return callNative('findMany', [queries, options || {}], callback);
+	};
+
+	detector.findUnder = function(portPath, callback) {
+		return callNative('findUnder', [getPortPath(portPath)], callback);
+	};
+
+	detector.parentOf = function(device, callback) {
+		return callNative('parentOf', [getPortPath(device)], callback, function(devices) {
+			return devices[0];
+		});
+	};
+
+	detector.findBySerial = function(serialNumber, callback) {
+		return callNative('findBySerial', [serialNumber], callback);
+	};
+
+	detector.findBySerialPrefix = function(prefix, callback) {
+		return callNative('findBySerialPrefix', [prefix], callback);
+	};
+
+	detector.getAttributes = function(device) {
+		return detection.getAttributes(getPortPath(device));
+	};
+
+	detector.topologyHash = function(filter) {
+		return detection.topologyHash(filter);
+	};
+
+	// `serialize({ format: 'ndjson' | 'binary', filter, fields }, callback)`
+	detector.serialize = function(options, callback) {
+		if(isFunction(options) && !callback) {
+			callback = options;
+			options = undefined;
+		}
+
+		return callNative('serialize', [options || {}], callback);
+	};
+
+	detector.decode = require('./decode');
+
+	detector.waitFor = function(filter, timeoutMs, callback) {
+		if(isFunction(timeoutMs) && !callback) {
+			callback = timeoutMs;
+			timeoutMs = undefined;
+		}
+
+		return callNative('waitFor', [filter || {}, timeoutMs], callback);
+	};
+
 	detection.registerAdded(function(device) {
 		detector.emit('add:' + device.vendorId + ':' + device.productId, device);
 		detector.emit('insert:' + device.vendorId + ':' + device.productId, device);
@@ -84,7 +168,65 @@ if(global[index.name] && global[index.name].version === index.version) {
 		detector.emit('change', device);
 	});
 
+	// `ready` events are opt-in, tracking them costs a little per uevent
+	detector.enableReadyEvents = function(options) {
+		options = options || {};
+
+		detection.registerReady(function(device) {
+			detector.emit('ready:' + device.vendorId + ':' + device.productId, device);
+			detector.emit('ready:' + device.vendorId, device);
+			detector.emit('ready', device);
+		}, options.settleTimeout);
+	};
+
+	detector.createMonitor = function(options) {
+		options = options || {};
+
+		var monitor = new EventEmitter2({
+			wildcard: true,
+			delimiter: ':',
+			maxListeners: 1000
+		});
+
+		var id = detection.createMonitor(options, function(action, device) {
+			monitor.emit(action, device);
+			if(action === 'add') {
+				monitor.emit('insert', device);
+			}
+			// The device did not come or go again
+			if(action !== 'ready') {
+				monitor.emit('change', device);
+			}
+		});
+
+		monitor.close = function() {
+			if(id === undefined) {
+				return;
+			}
+
+			detection.closeMonitor(id);
+			id = undefined;
+		};
+
+		return monitor;
+	};
+
+	// `getHistory({ sinceSeq, filter, fields })`, synchronous, see src/eventJournal.h
+	detector.getHistory = function(options) {
+		return detection.getHistory(options);
+	};
+
+	// Spans of the native pipeline as Chrome trace-event JSON, see src/pipelineTrace.h
+	detector.startTracing = function() {
+		detection.startTracing();
+	};
+
+	detector.stopTracing = function() {
+		return detection.stopTracing(process.pid);
+	};
+
 	var started = false;
+	var paused = false;
 
 	detector.startMonitoring = function() {
 		if(started) {
@@ -101,9 +243,39 @@ if(global[index.name] && global[index.name].version === index.version) {
 		}
 
 		started = false;
+		paused = false;
 		detection.stopMonitoring();
 	};
 
+	// Keeps the native monitor, the device list and the queued events around,
+	// so resuming is cheap compared to stop/start
+	detector.pauseMonitoring = function() {
+		if(!started || paused) {
+			return;
+		}
+
+		paused = true;
+		detection.pauseMonitoring();
+	};
+
+	detector.resumeMonitoring = function() {
+		if(!paused) {
+			return;
+		}
+
+		paused = false;
+		detection.resumeMonitoring();
+	};
+
+	// Like `node --trace-events-enabled`, written once the process exits
+	if(process.env.USB_DETECTION_TRACE) {
+		var tracePath = process.env.USB_DETECTION_TRACE;
+		detector.startTracing();
+		process.on('exit', function() {
+			require('fs').writeFileSync(tracePath, detector.stopTracing());
+		});
+	}
+
 	detector.version = index.version;
 	global[index.name] = detector;
 
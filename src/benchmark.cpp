@@ -0,0 +1,523 @@
+#include <stdlib.h>
+#include <fstream>
+#include <new>
+#include <sstream>
+
+#include "benchmark.h"
+#include "partitionPool.h"
+
+using namespace std;
+
+// Roughly this many devices are touched per measurement, so small lists get repeated
+#define BENCHMARK_TARGET_OPERATIONS 200000
+// Every one of them calls into JS
+#define BENCHMARK_NOTIFY_OPERATIONS 20000
+
+/**********************************
+ * Local Variables
+ **********************************/
+// Event injection, same one-event-at-a-time hand-over as the platform monitors
+static uv_thread_t injectThread;
+static uv_async_t injectAsync;
+static uv_mutex_t injectMutex;
+static uv_cond_t injectHandled;
+static bool isInjectHandled = true;
+static ListResultItem_t* injectedItem;
+static int injectCount;
+static int injectDelivered;
+static uint64_t injectStart;
+static Nan::Callback* injectDoneCallback;
+static bool isInjecting = false;
+
+// Every `operator new` of this addon, see the replacements below
+static uv_mutex_t allocationMutex;
+static bool isAllocationMutexReady = false;
+static uint64_t allocationCount = 0;
+
+
+/**********************************
+ * Allocation Counting
+ **********************************/
+/*
+ * Replaces the global `operator new`/`operator delete` of the benchmark
+ * addon. It is linked with `-Bsymbolic-functions`, so these only see the
+ * allocations of its own code, not those of node or V8.
+ */
+void* operator new(size_t size) {
+	if (isAllocationMutexReady) {
+		uv_mutex_lock(&allocationMutex);
+		allocationCount++;
+		uv_mutex_unlock(&allocationMutex);
+	}
+
+	void* block = malloc(size > 0 ? size : 1);
+	if (block == NULL) {
+		throw std::bad_alloc();
+	}
+	return block;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* block) noexcept {
+	free(block);
+}
+
+void operator delete[](void* block) noexcept {
+	free(block);
+}
+
+void operator delete(void* block, size_t size) noexcept {
+	free(block);
+}
+
+void operator delete[](void* block, size_t size) noexcept {
+	free(block);
+}
+
+static uint64_t GetAllocationCount() {
+	uv_mutex_lock(&allocationMutex);
+	uint64_t count = allocationCount;
+	uv_mutex_unlock(&allocationMutex);
+
+	return count;
+}
+
+
+/**********************************
+ * Local Functions
+ **********************************/
+static int GetRepetitions(int count) {
+	int repetitions = BENCHMARK_TARGET_OPERATIONS / (count > 0 ? count : 1);
+	return repetitions > 0 ? repetitions : 1;
+}
+
+static void FillSyntheticDevice(ListResultItem_t* item, int index) {
+	char buffer[32];
+
+	item->locationId = 0;
+	item->vendorId = BENCHMARK_VENDOR_ID;
+	item->productId = index % 64;
+	item->deviceAddress = index;
+	snprintf(buffer, sizeof(buffer), "Benchmark device %d", index);
+	item->deviceName = buffer;
+	item->manufacturer = "usb-detection";
+	snprintf(buffer, sizeof(buffer), "%08d", index);
+	item->serialNumber = buffer;
+	snprintf(buffer, sizeof(buffer), "9-%d.%d", index / 7 + 1, index % 7 + 1);
+	item->portPath = buffer;
+}
+
+static string GetSyntheticKey(int index) {
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "/benchmark/%d", index);
+	return buffer;
+}
+
+static void SetNumber(v8::Local<v8::Object> result, const char* name, double value) {
+	Nan::Set(result, Nan::New<v8::String>(name).ToLocalChecked(), Nan::New<v8::Number>(value));
+}
+
+static int GetCountArgument(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	if (args.Length() < 1 || !args[0]->IsNumber()) {
+		Nan::ThrowTypeError("First argument must be a device count");
+		return -1;
+	}
+
+	return Nan::To<int>(args[0]).FromJust();
+}
+
+/*
+ * `AddItemToList`/`GetItemFromList`/`CreateFilteredList`/`RemoveItemFromList`
+ * with `count` synthetic devices on top of the real ones. `scan` is an
+ * unfiltered `find` of only the ids, the cost of walking the whole list.
+ */
+static void BenchmarkRegistry(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	int count = GetCountArgument(args);
+	if (count < 0) {
+		return;
+	}
+
+	vector<string> keys(count);
+	for (int i = 0; i < count; i++) {
+		keys[i] = GetSyntheticKey(i);
+	}
+
+	uint64_t start = uv_hrtime();
+	for (int i = 0; i < count; i++) {
+		DeviceItem_t* item = new DeviceItem_t();
+		FillSyntheticDevice(&item->deviceParams, i);
+		item->deviceState = DeviceState_Connect;
+		AddItemToList((char *)keys[i].c_str(), item);
+	}
+	uint64_t addNs = uv_hrtime() - start;
+
+	int repetitions = GetRepetitions(count);
+	start = uv_hrtime();
+	for (int r = 0; r < repetitions; r++) {
+		for (int i = 0; i < count; i++) {
+			GetItemFromList((char *)keys[i].c_str());
+		}
+	}
+	uint64_t getNs = uv_hrtime() - start;
+
+	// Reused like a `find` baton does
+	DeviceResults_t results;
+	start = uv_hrtime();
+	for (int r = 0; r < repetitions; r++) {
+		ClearResults(&results);
+		CreateFilteredList(&results, BENCHMARK_VENDOR_ID, 0);
+	}
+	uint64_t filterNs = uv_hrtime() - start;
+
+	start = uv_hrtime();
+	for (int r = 0; r < repetitions; r++) {
+		ClearResults(&results);
+		CreateFilteredList(&results, 0, 0, DeviceField_VendorId | DeviceField_ProductId);
+	}
+	uint64_t scanNs = uv_hrtime() - start;
+
+	start = uv_hrtime();
+	for (int i = 0; i < count; i++) {
+		DeviceItem_t* item = GetItemFromList((char *)keys[i].c_str());
+		if (item != NULL) {
+			RemoveItemFromList(item);
+			delete item;
+		}
+	}
+	uint64_t removeNs = uv_hrtime() - start;
+
+	v8::Local<v8::Object> result = Nan::New<v8::Object>();
+	SetNumber(result, "devices", count);
+	SetNumber(result, "addNsPerDevice", (double) addNs / count);
+	SetNumber(result, "getNsPerLookup", (double) getNs / ((double) repetitions * count));
+	SetNumber(result, "findNsPerCall", (double) filterNs / repetitions);
+	SetNumber(result, "findNsPerDevice", (double) filterNs / ((double) repetitions * count));
+	SetNumber(result, "scanNsPerDevice", (double) scanNs / ((double) repetitions * count));
+	SetNumber(result, "removeNsPerDevice", (double) removeNs / count);
+	args.GetReturnValue().Set(result);
+}
+
+/*
+ * What `find` spends on the main thread turning its results into JS
+ * objects, with all fields and with only the ids.
+ */
+static void BenchmarkConversion(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	int count = GetCountArgument(args);
+	if (count < 0) {
+		return;
+	}
+
+	DeviceResults_t items;
+	for (int i = 0; i < count; i++) {
+		FillSyntheticDevice(AppendResult(&items), i);
+	}
+
+	int repetitions = GetRepetitions(count);
+	int masks[2] = { DeviceField_All, DeviceField_VendorId | DeviceField_ProductId };
+	double nsPerDevice[2];
+	for (int m = 0; m < 2; m++) {
+		uint64_t start = uv_hrtime();
+		for (int r = 0; r < repetitions; r++) {
+			Nan::HandleScope scope;
+			CreateDeviceArray(&items, masks[m]);
+		}
+		nsPerDevice[m] = (double) (uv_hrtime() - start) / ((double) repetitions * count);
+	}
+
+	v8::Local<v8::Object> result = Nan::New<v8::Object>();
+	SetNumber(result, "devices", count);
+	SetNumber(result, "allFieldsNsPerDevice", nsPerDevice[0]);
+	SetNumber(result, "idFieldsNsPerDevice", nsPerDevice[1]);
+	args.GetReturnValue().Set(result);
+}
+
+static void ListDirectory(const string& path, vector<string>* entries) {
+	uv_fs_t req;
+	if (uv_fs_scandir(NULL, &req, path.c_str(), 0, NULL) >= 0) {
+		uv_dirent_t entry;
+		while (uv_fs_scandir_next(&req, &entry) != UV_EOF) {
+			entries->push_back(entry.name);
+		}
+	}
+	uv_fs_req_cleanup(&req);
+}
+
+static string ReadFile(const string& path) {
+	ifstream file(path.c_str());
+	stringstream contents;
+	contents << file.rdbuf();
+	return contents.str();
+}
+
+typedef struct {
+	string root;
+	vector<string> buses;
+	vector<int> deviceCounts;
+} SyntheticTree_t;
+
+/*
+ * Stands in for `EnumerateBus` in detection_linux.cpp, with plain file
+ * reads instead of libudev since libudev only reads the real /sys.
+ * `<root>/<bus>/<device>/<attribute>`, every attribute file is read.
+ */
+static void ReadSyntheticBus(size_t partition, int thread, void* arg) {
+	SyntheticTree_t* tree = static_cast<SyntheticTree_t*>(arg);
+	string busPath = tree->root + "/" + tree->buses[partition];
+
+	vector<string> devices;
+	ListDirectory(busPath, &devices);
+	for (vector<string>::iterator device = devices.begin(); device != devices.end(); ++device) {
+		string devicePath = busPath + "/" + *device;
+		vector<string> attributes;
+		ListDirectory(devicePath, &attributes);
+
+		DeviceItem_t item;
+		for (vector<string>::iterator attribute = attributes.begin(); attribute != attributes.end(); ++attribute) {
+			item.attributes[*attribute] = ReadFile(devicePath + "/" + *attribute);
+		}
+		item.deviceParams.vendorId = strtol(item.attributes["idVendor"].c_str(), NULL, 16);
+		item.deviceParams.productId = strtol(item.attributes["idProduct"].c_str(), NULL, 16);
+		item.deviceParams.serialNumber = item.attributes["serial"];
+		item.deviceParams.portPath = *device;
+	}
+	tree->deviceCounts[partition] = (int) devices.size();
+}
+
+/*
+ * Enumerates a synthetic sysfs tree with `threads` threads, partitioned by
+ * bus like the Linux enumeration.
+ */
+static void BenchmarkEnumeration(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	if (args.Length() < 2 || !args[0]->IsString() || !args[1]->IsNumber()) {
+		return Nan::ThrowTypeError("Expected a directory and a thread count");
+	}
+
+	SyntheticTree_t tree;
+	tree.root = *Nan::Utf8String(args[0]);
+	ListDirectory(tree.root, &tree.buses);
+	tree.deviceCounts.resize(tree.buses.size(), 0);
+	int threads = Nan::To<int>(args[1]).FromJust();
+
+	uint64_t start = uv_hrtime();
+	RunPartitions(tree.buses.size(), threads, ReadSyntheticBus, &tree);
+	uint64_t elapsedNs = uv_hrtime() - start;
+
+	int devices = 0;
+	for (size_t i = 0; i < tree.deviceCounts.size(); i++) {
+		devices += tree.deviceCounts[i];
+	}
+
+	v8::Local<v8::Object> result = Nan::New<v8::Object>();
+	SetNumber(result, "threads", threads);
+	SetNumber(result, "buses", tree.buses.size());
+	SetNumber(result, "devices", devices);
+	SetNumber(result, "totalNs", elapsedNs);
+	args.GetReturnValue().Set(result);
+}
+
+static void cbInjectThread(void* arg) {
+	for (int i = 0; i < injectCount; i++) {
+		uv_mutex_lock(&injectMutex);
+		while (!isInjectHandled) {
+			uv_cond_wait(&injectHandled, &injectMutex);
+		}
+		isInjectHandled = false;
+		uv_mutex_unlock(&injectMutex);
+
+		ListResultItem_t* item = AcquireListResultItem();
+		FillSyntheticDevice(item, i);
+		// Read back on the JS side to get the latency of this event
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long) uv_hrtime());
+		item->serialNumber = buffer;
+
+		injectedItem = item;
+		uv_async_send(&injectAsync);
+	}
+}
+
+static void cbInjectAsync(uv_async_t* handle) {
+	Nan::HandleScope scope;
+
+	ListResultItem_t* item = injectedItem;
+	injectedItem = NULL;
+	if (item == NULL) {
+		return;
+	}
+
+	NotifyAdded(item);
+	ReleaseListResultItem(item);
+	injectDelivered++;
+
+	uv_mutex_lock(&injectMutex);
+	isInjectHandled = true;
+	uv_cond_signal(&injectHandled);
+	uv_mutex_unlock(&injectMutex);
+
+	if (injectDelivered < injectCount) {
+		return;
+	}
+
+	uv_thread_join(&injectThread);
+	uv_close((uv_handle_t *) &injectAsync, NULL);
+	uv_cond_destroy(&injectHandled);
+	uv_mutex_destroy(&injectMutex);
+	isInjecting = false;
+
+	v8::Local<v8::Object> result = Nan::New<v8::Object>();
+	SetNumber(result, "events", injectCount);
+	SetNumber(result, "totalNs", (double) (uv_hrtime() - injectStart));
+
+	v8::Local<v8::Value> argv[2] = { Nan::Undefined(), result };
+	Nan::Callback* callback = injectDoneCallback;
+	injectDoneCallback = NULL;
+	Nan::AsyncResource resource("usb-detection:BenchmarkEvents");
+	callback->Call(2, argv, &resource);
+	delete callback;
+}
+
+static void NoOperation(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+}
+
+/*
+ * Allocations per call once the pools are warm, with `count` synthetic
+ * devices:
+ * - a whole `find`: baton, `EIO_Find`, JS conversion, release
+ * - an event copy like the monitors hand to the main thread
+ * - a whole event on the main thread: copy, journal, the global callback
+ *   and the monitors registered by the caller, release
+ * - a device added to and removed from the registry again
+ */
+static void BenchmarkAllocations(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	int count = GetCountArgument(args);
+	if (count < 0) {
+		return;
+	}
+
+	vector<string> keys(count);
+	for (int i = 0; i < count; i++) {
+		keys[i] = GetSyntheticKey(i);
+		DeviceItem_t* item = new DeviceItem_t();
+		FillSyntheticDevice(&item->deviceParams, i);
+		item->deviceState = DeviceState_Connect;
+		AddItemToList((char *)keys[i].c_str(), item);
+	}
+
+	v8::Local<v8::Function> callback = Nan::GetFunction(Nan::New<v8::FunctionTemplate>(NoOperation)).ToLocalChecked();
+	int repetitions = GetRepetitions(count);
+	uint64_t findAllocations = 0;
+	// The first round fills the pools
+	for (int round = 0; round < 2; round++) {
+		uint64_t start = GetAllocationCount();
+		for (int r = 0; r < repetitions; r++) {
+			Nan::HandleScope scope;
+			ListBaton* baton = AcquireListBaton(callback);
+			baton->vid = BENCHMARK_VENDOR_ID;
+			EIO_Find(&baton->request);
+			CreateDeviceArray(&baton->results, baton->fields);
+			ReleaseListBaton(baton);
+		}
+		findAllocations = GetAllocationCount() - start;
+	}
+
+	DeviceItem_t* source = GetItemFromList((char *)keys[0].c_str());
+	uint64_t copyAllocations = 0;
+	for (int round = 0; round < 2; round++) {
+		uint64_t start = GetAllocationCount();
+		for (int r = 0; r < BENCHMARK_TARGET_OPERATIONS; r++) {
+			ReleaseListResultItem(CopyElement(&source->deviceParams));
+		}
+		copyAllocations = GetAllocationCount() - start;
+	}
+
+	uint64_t notifyAllocations = 0;
+	for (int round = 0; round < 2; round++) {
+		uint64_t start = GetAllocationCount();
+		for (int r = 0; r < BENCHMARK_NOTIFY_OPERATIONS; r++) {
+			Nan::HandleScope scope;
+			ListResultItem_t* item = CopyElement(&source->deviceParams);
+			NotifyAdded(item);
+			ReleaseListResultItem(item);
+		}
+		notifyAllocations = GetAllocationCount() - start;
+	}
+
+	string churnKey = GetSyntheticKey(count);
+	uint64_t churnAllocations = 0;
+	for (int round = 0; round < 2; round++) {
+		uint64_t start = GetAllocationCount();
+		for (int r = 0; r < BENCHMARK_TARGET_OPERATIONS; r++) {
+			DeviceItem_t* item = new DeviceItem_t();
+			FillSyntheticDevice(&item->deviceParams, count);
+			AddItemToList((char *)churnKey.c_str(), item);
+			RemoveItemFromList(item);
+			delete item;
+		}
+		churnAllocations = GetAllocationCount() - start;
+	}
+
+	for (int i = 0; i < count; i++) {
+		DeviceItem_t* item = GetItemFromList((char *)keys[i].c_str());
+		if (item != NULL) {
+			RemoveItemFromList(item);
+			delete item;
+		}
+	}
+
+	v8::Local<v8::Object> result = Nan::New<v8::Object>();
+	SetNumber(result, "devices", count);
+	SetNumber(result, "allocationsPerFind", (double) findAllocations / repetitions);
+	SetNumber(result, "allocationsPerEventCopy", (double) copyAllocations / BENCHMARK_TARGET_OPERATIONS);
+	SetNumber(result, "allocationsPerNotify", (double) notifyAllocations / BENCHMARK_NOTIFY_OPERATIONS);
+	SetNumber(result, "allocationsPerAddRemove", (double) churnAllocations / BENCHMARK_TARGET_OPERATIONS);
+	args.GetReturnValue().Set(result);
+}
+
+/*
+ * Injects `count` added devices from a native thread, they arrive at the
+ * `registerAdded` callback like real ones. Calls back once all of them
+ * were delivered.
+ */
+static void BenchmarkEvents(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	int count = GetCountArgument(args);
+	if (count < 0) {
+		return;
+	}
+	if (args.Length() < 2 || !args[1]->IsFunction()) {
+		return Nan::ThrowTypeError("Second argument must be a function");
+	}
+	if (isInjecting || count == 0) {
+		return Nan::ThrowError("Nothing to inject or already injecting");
+	}
+
+	isInjecting = true;
+	injectCount = count;
+	injectDelivered = 0;
+	isInjectHandled = true;
+	injectDoneCallback = new Nan::Callback(args[1].As<v8::Function>());
+
+	uv_mutex_init(&injectMutex);
+	uv_cond_init(&injectHandled);
+	uv_async_init(uv_default_loop(), &injectAsync, cbInjectAsync);
+
+	injectStart = uv_hrtime();
+	uv_thread_create(&injectThread, cbInjectThread, NULL);
+}
+
+
+/**********************************
+ * Public Functions
+ **********************************/
+void InitBenchmark(v8::Local<v8::Object> target) {
+	uv_mutex_init(&allocationMutex);
+	isAllocationMutexReady = true;
+
+	Nan::SetMethod(target, "benchmarkRegistry", BenchmarkRegistry);
+	Nan::SetMethod(target, "benchmarkConversion", BenchmarkConversion);
+	Nan::SetMethod(target, "benchmarkEvents", BenchmarkEvents);
+	Nan::SetMethod(target, "benchmarkEnumeration", BenchmarkEnumeration);
+	Nan::SetMethod(target, "benchmarkAllocations", BenchmarkAllocations);
+}
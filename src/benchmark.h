@@ -0,0 +1,18 @@
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include "detection.h"
+
+/*
+ * Native side of `benchmark/native.js`. Only compiled into the
+ * `detection_benchmark` target (`USB_DETECTION_BENCHMARK=1 npm run rebuild`),
+ * never into the published addon.
+ *
+ * The synthetic devices use `BENCHMARK_VENDOR_ID` and `/benchmark/<n>` keys,
+ * they are removed again before each function returns.
+ */
+#define BENCHMARK_VENDOR_ID 0xbeef
+
+void InitBenchmark(v8::Local<v8::Object> target);
+
+#endif
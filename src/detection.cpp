@@ -1,4 +1,13 @@
+#include <tuple>
+
 #include "detection.h"
+#include "objectPool.h"
+#include "serializer.h"
+#include "eventJournal.h"
+#include "pipelineTrace.h"
+#ifdef USB_DETECTION_BENCHMARK
+	#include "benchmark.h"
+#endif
 
 
 #define OBJECT_ITEM_LOCATION_ID "locationId"
@@ -8,6 +17,25 @@
 #define OBJECT_ITEM_MANUFACTURER "manufacturer"
 #define OBJECT_ITEM_SERIAL_NUMBER "serialNumber"
 #define OBJECT_ITEM_DEVICE_ADDRESS "deviceAddress"
+#define OBJECT_ITEM_PORT_PATH "portPath"
+#define OBJECT_ITEM_CHILD_DEV_NODES "childDevNodes"
+#define OBJECT_ITEM_PROPERTIES "properties"
+#define OBJECT_ITEM_DEVICE_CLASS "deviceClass"
+#define OBJECT_ITEM_DEVICE_SUB_CLASS "deviceSubClass"
+#define OBJECT_ITEM_DEVICE_PROTOCOL "deviceProtocol"
+#define OBJECT_ITEM_INTERFACES "interfaces"
+
+#define OBJECT_INTERFACE_CLASS "interfaceClass"
+#define OBJECT_INTERFACE_SUB_CLASS "interfaceSubClass"
+#define OBJECT_INTERFACE_PROTOCOL "interfaceProtocol"
+
+#define DEVICE_FIELD_COUNT 14
+
+
+#define MONITOR_ACTION_ADDED "add"
+#define MONITOR_ACTION_INSERT "insert"
+#define MONITOR_ACTION_REMOVED "remove"
+#define MONITOR_ACTION_READY "ready"
 
 
 Nan::Callback* addedCallback;
@@ -16,200 +44,1462 @@ bool isAddedRegistered = false;
 Nan::Callback* removedCallback;
 bool isRemovedRegistered = false;
 
-void RegisterAdded(const Nan::FunctionCallbackInfo<v8::Value>& args) {
-	Nan::HandleScope scope;
+Nan::Callback* readyCallback;
+bool isReadyRegistered = false;
+// Also used when only a monitor asks for `ready`
+static int readySettleTimeout = READY_SETTLE_TIMEOUT_DEFAULT;
 
-	v8::Local<v8::Function> callback;
+/*
+ * Monitors created with `createMonitor`, all fed from the single native
+ * reader. Closing a monitor while we are dispatching to it only flags it,
+ * the sweep after the dispatch pass does the actual delete.
+ */
+static std::list<Monitor*> monitors;
+static int nextMonitorId = 1;
+static bool isDispatching = false;
 
-	if (args.Length() == 0) {
-		return Nan::ThrowTypeError("First argument must be a function");
+/*
+ * Device -> JS object conversion. A field mask is compiled once into the
+ * list of setters it needs (see `GetDeviceConverter`), so converting a
+ * device never has to check the mask field by field.
+ */
+typedef void (*DeviceFieldSetter)(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it);
+
+typedef struct {
+	const char* name;
+	int field;
+	DeviceFieldSetter set;
+} DeviceFieldInfo_t;
+
+typedef struct {
+	int count;
+	const DeviceFieldInfo_t* steps[DEVICE_FIELD_COUNT];
+} DeviceConverter_t;
+
+static void SetLocationId(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::Number>(it->locationId));
+}
+
+static void SetVendorId(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::Number>(it->vendorId));
+}
+
+static void SetProductId(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::Number>(it->productId));
+}
+
+static void SetDeviceName(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::String>(it->deviceName.c_str()).ToLocalChecked());
+}
+
+static void SetManufacturer(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::String>(it->manufacturer.c_str()).ToLocalChecked());
+}
+
+static void SetSerialNumber(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::String>(it->serialNumber.c_str()).ToLocalChecked());
+}
+
+static void SetDeviceAddress(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::Number>(it->deviceAddress));
+}
+
+static void SetPortPath(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::String>(it->portPath.c_str()).ToLocalChecked());
+}
+
+static void SetChildDevNodes(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	v8::Local<v8::Array> childDevNodes = Nan::New<v8::Array>(it->childDevNodes.size());
+	for(size_t i = 0; i < it->childDevNodes.size(); i++) {
+		Nan::Set(childDevNodes, i, Nan::New<v8::String>(it->childDevNodes[i].c_str()).ToLocalChecked());
 	}
+	Nan::Set(item, key, childDevNodes);
+}
 
-	if (args.Length() == 1) {
-		// callback
-		if(!args[0]->IsFunction()) {
-			return Nan::ThrowTypeError("First argument must be a function");
-		}
+static void SetProperties(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	v8::Local<v8::Object> properties = Nan::New<v8::Object>();
+	for (DeviceProperties_t::iterator property = it->properties.begin(); property != it->properties.end(); ++property) {
+		Nan::Set(properties, Nan::New<v8::String>(property->first.c_str()).ToLocalChecked(), Nan::New<v8::String>(property->second.c_str()).ToLocalChecked());
+	}
+	Nan::Set(item, key, properties);
+}
 
-		callback = args[0].As<v8::Function>();
+static void SetDeviceClass(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::Number>(it->deviceClass));
+}
+
+static void SetDeviceSubClass(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::Number>(it->deviceSubClass));
+}
+
+static void SetDeviceProtocol(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	Nan::Set(item, key, Nan::New<v8::Number>(it->deviceProtocol));
+}
+
+static void SetInterfaces(v8::Local<v8::Object> item, v8::Local<v8::String> key, ListResultItem_t* it) {
+	v8::Local<v8::Array> interfaces = Nan::New<v8::Array>(it->interfaces.size());
+	for(size_t i = 0; i < it->interfaces.size(); i++) {
+		v8::Local<v8::Object> descriptor = Nan::New<v8::Object>();
+		Nan::Set(descriptor, Nan::New<v8::String>(OBJECT_INTERFACE_CLASS).ToLocalChecked(), Nan::New<v8::Number>(it->interfaces[i].interfaceClass));
+		Nan::Set(descriptor, Nan::New<v8::String>(OBJECT_INTERFACE_SUB_CLASS).ToLocalChecked(), Nan::New<v8::Number>(it->interfaces[i].interfaceSubClass));
+		Nan::Set(descriptor, Nan::New<v8::String>(OBJECT_INTERFACE_PROTOCOL).ToLocalChecked(), Nan::New<v8::Number>(it->interfaces[i].interfaceProtocol));
+		Nan::Set(interfaces, i, descriptor);
 	}
+	Nan::Set(item, key, interfaces);
+}
 
-	addedCallback = new Nan::Callback(callback);
-	isAddedRegistered = true;
+static const DeviceFieldInfo_t deviceFields[DEVICE_FIELD_COUNT] = {
+	{ OBJECT_ITEM_LOCATION_ID, DeviceField_LocationId, SetLocationId },
+	{ OBJECT_ITEM_VENDOR_ID, DeviceField_VendorId, SetVendorId },
+	{ OBJECT_ITEM_PRODUCT_ID, DeviceField_ProductId, SetProductId },
+	{ OBJECT_ITEM_DEVICE_NAME, DeviceField_DeviceName, SetDeviceName },
+	{ OBJECT_ITEM_MANUFACTURER, DeviceField_Manufacturer, SetManufacturer },
+	{ OBJECT_ITEM_SERIAL_NUMBER, DeviceField_SerialNumber, SetSerialNumber },
+	{ OBJECT_ITEM_DEVICE_ADDRESS, DeviceField_DeviceAddress, SetDeviceAddress },
+	{ OBJECT_ITEM_PORT_PATH, DeviceField_PortPath, SetPortPath },
+	{ OBJECT_ITEM_CHILD_DEV_NODES, DeviceField_ChildDevNodes, SetChildDevNodes },
+	{ OBJECT_ITEM_PROPERTIES, DeviceField_Properties, SetProperties },
+	{ OBJECT_ITEM_DEVICE_CLASS, DeviceField_DeviceClass, SetDeviceClass },
+	{ OBJECT_ITEM_DEVICE_SUB_CLASS, DeviceField_DeviceSubClass, SetDeviceSubClass },
+	{ OBJECT_ITEM_DEVICE_PROTOCOL, DeviceField_DeviceProtocol, SetDeviceProtocol },
+	{ OBJECT_ITEM_INTERFACES, DeviceField_Interfaces, SetInterfaces },
+};
+
+// Only touched from the main thread
+static std::map<int, DeviceConverter_t*> deviceConverters;
+
+static const DeviceConverter_t* GetDeviceConverter(int fields) {
+	std::map<int, DeviceConverter_t*>::iterator it = deviceConverters.find(fields);
+	if (it != deviceConverters.end()) {
+		return it->second;
+	}
+
+	DeviceConverter_t* converter = new DeviceConverter_t();
+	converter->count = 0;
+	for (int i = 0; i < DEVICE_FIELD_COUNT; i++) {
+		if (fields & deviceFields[i].field) {
+			converter->steps[converter->count++] = &deviceFields[i];
+		}
+	}
+	deviceConverters[fields] = converter;
+
+	return converter;
 }
 
-void NotifyAdded(ListResultItem_t* it) {
-	Nan::HandleScope scope;
+/*
+ * Converts a batch of devices, the property names are only created once
+ * for the whole batch.
+ */
+class DeviceObjectBuilder {
+	public:
+		explicit DeviceObjectBuilder(const DeviceConverter_t* converter) : converter(converter) {
+			for (int i = 0; i < converter->count; i++) {
+				keys[i] = Nan::New<v8::String>(converter->steps[i]->name).ToLocalChecked();
+			}
+		}
 
-	if (it == NULL) {
-		return;
+		v8::Local<v8::Object> Build(ListResultItem_t* it) {
+			v8::Local<v8::Object> item = Nan::New<v8::Object>();
+			for (int i = 0; i < converter->count; i++) {
+				converter->steps[i]->set(item, keys[i], it);
+			}
+
+			return item;
+		}
+
+	private:
+		const DeviceConverter_t* converter;
+		v8::Local<v8::String> keys[DEVICE_FIELD_COUNT];
+};
+
+v8::Local<v8::Array> CreateDeviceArray(DeviceResults_t* items, int fields) {
+	DeviceObjectBuilder builder(GetDeviceConverter(fields));
+	v8::Local<v8::Array> results = Nan::New<v8::Array>(items->count);
+	for(size_t i = 0; i < items->count; i++) {
+		Nan::Set(results, i, builder.Build(&items->items[i]));
 	}
 
-	if (isAddedRegistered){
-		v8::Local<v8::Value> argv[1];
-		v8::Local<v8::Object> item = Nan::New<v8::Object>();
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_LOCATION_ID).ToLocalChecked(), Nan::New<v8::Number>(it->locationId));
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_VENDOR_ID).ToLocalChecked(), Nan::New<v8::Number>(it->vendorId));
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_PRODUCT_ID).ToLocalChecked(), Nan::New<v8::Number>(it->productId));
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_DEVICE_NAME).ToLocalChecked(), Nan::New<v8::String>(it->deviceName.c_str()).ToLocalChecked());
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_MANUFACTURER).ToLocalChecked(), Nan::New<v8::String>(it->manufacturer.c_str()).ToLocalChecked());
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_SERIAL_NUMBER).ToLocalChecked(), Nan::New<v8::String>(it->serialNumber.c_str()).ToLocalChecked());
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_DEVICE_ADDRESS).ToLocalChecked(), Nan::New<v8::Number>(it->deviceAddress));
-		argv[0] = item;
+	return results;
+}
+
+/*
+ * Batons only ever live on the main thread between `Find` and
+ * `EIO_AfterFind`, a handful of them covers any steady polling.
+ */
+#define LIST_BATON_POOL_SIZE 16
+
+static ObjectPool<ListBaton>& GetListBatonPool() {
+	static ObjectPool<ListBaton> pool(LIST_BATON_POOL_SIZE);
+	return pool;
+}
+
+ListBaton* AcquireListBaton(v8::Local<v8::Function> callback) {
+	ListBaton* baton = GetListBatonPool().Acquire();
+	baton->callback.Reset(callback);
+	baton->request.data = baton;
+	ClearResults(&baton->results);
+	baton->errorString[0] = '\0';
+	baton->vid = 0;
+	baton->pid = 0;
+	baton->fields = DeviceField_All;
+	baton->classMatch = UsbClassMatch_t();
+	baton->provisional = IsListProvisional();
+	baton->query.clear();
+	baton->queries.clear();
+	baton->resultQueries.clear();
+	baton->joinedCallbacks.clear();
+	baton->format = SerializeFormat_Ndjson;
+	baton->output = NULL;
+	baton->outputLength = 0;
+
+	return baton;
+}
 
-		Nan::AsyncResource resource("usb-detection:NotifyAdded");
-		addedCallback->Call(1, argv, &resource);
+/*
+ * Callbacks of the `find` calls which joined an in-flight one, only as many
+ * as join a single scan at once are worth keeping.
+ */
+#define JOINED_CALLBACK_POOL_SIZE 16
+
+static ObjectPool<Nan::Callback>& GetJoinedCallbackPool() {
+	static ObjectPool<Nan::Callback> pool(JOINED_CALLBACK_POOL_SIZE);
+	return pool;
+}
+
+static void JoinListBaton(ListBaton* baton, v8::Local<v8::Function> callback) {
+	Nan::Callback* joined = GetJoinedCallbackPool().Acquire();
+	joined->Reset(callback);
+	baton->joinedCallbacks.push_back(joined);
+}
+
+void ReleaseListBaton(ListBaton* baton) {
+	baton->callback.Reset();
+	for (size_t i = 0; i < baton->joinedCallbacks.size(); i++) {
+		baton->joinedCallbacks[i]->Reset();
+		GetJoinedCallbackPool().Release(baton->joinedCallbacks[i]);
 	}
+	baton->joinedCallbacks.clear();
+	// Only set when `EIO_AfterSerialize` did not hand the bytes to a Buffer
+	free(baton->output);
+	baton->output = NULL;
+	GetListBatonPool().Release(baton);
 }
 
-void RegisterRemoved(const Nan::FunctionCallbackInfo<v8::Value>& args) {
-	Nan::HandleScope scope;
+/*
+ * Single-flight `find`: a call while an identical one (same ids, fields and
+ * class filter) is queued or scanning joins it instead of queueing its own
+ * work, and gets its own conversion of the results. Only the main thread touches
+ * this, a baton leaves it once its results are being delivered.
+ */
+typedef struct _FindKey_t {
+	int vid;
+	int pid;
+	int fields;
+	UsbClassMatch_t classMatch;
 
-	v8::Local<v8::Function> callback;
+	bool operator<(const _FindKey_t& other) const {
+		const UsbClassMatch_t& a = classMatch;
+		const UsbClassMatch_t& b = other.classMatch;
+		return (
+			std::tie(vid, pid, fields, a.deviceClass, a.deviceSubClass, a.deviceProtocol, a.interfaceClass, a.interfaceSubClass, a.interfaceProtocol) <
+			std::tie(other.vid, other.pid, other.fields, b.deviceClass, b.deviceSubClass, b.deviceProtocol, b.interfaceClass, b.interfaceSubClass, b.interfaceProtocol)
+		);
+	}
+} FindKey_t;
 
-	if (args.Length() == 0) {
-		return Nan::ThrowTypeError("First argument must be a function");
+static std::map<FindKey_t, ListBaton*> inflightFinds;
+
+static FindKey_t GetFindKey(ListBaton* baton) {
+	FindKey_t key;
+	key.vid = baton->vid;
+	key.pid = baton->pid;
+	key.fields = baton->fields;
+	key.classMatch = baton->classMatch;
+
+	return key;
+}
+
+static bool ParseFields(v8::Local<v8::Object> options, int* fields) {
+	v8::Local<v8::Value> value = Nan::Get(options, Nan::New<v8::String>("fields").ToLocalChecked()).ToLocalChecked();
+	if (value->IsUndefined()) {
+		*fields = DeviceField_All;
+		return true;
 	}
 
-	if (args.Length() == 1) {
-		// callback
-		if(!args[0]->IsFunction()) {
-			return Nan::ThrowTypeError("First argument must be a function");
+	if (!value->IsArray()) {
+		Nan::ThrowTypeError("`fields` must be an array");
+		return false;
+	}
+
+	v8::Local<v8::Array> list = value.As<v8::Array>();
+	*fields = 0;
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		Nan::Utf8String name(Nan::Get(list, i).ToLocalChecked());
+
+		int field = 0;
+		for (int j = 0; j < DEVICE_FIELD_COUNT; j++) {
+			if (strcmp(*name, deviceFields[j].name) == 0) {
+				field = deviceFields[j].field;
+				break;
+			}
+		}
+		if (field == 0) {
+			Nan::ThrowTypeError("`fields` contains an unknown device field");
+			return false;
 		}
 
-		callback = args[0].As<v8::Function>();
+		*fields |= field;
 	}
 
-	removedCallback = new Nan::Callback(callback);
-	isRemovedRegistered = true;
+	return true;
 }
 
-void NotifyRemoved(ListResultItem_t* it) {
+static bool GetCallbackArgument(const Nan::FunctionCallbackInfo<v8::Value>& args, v8::Local<v8::Function>* callback) {
+	if (args.Length() != 1 || !args[0]->IsFunction()) {
+		Nan::ThrowTypeError("First argument must be a function");
+		return false;
+	}
+
+	*callback = args[0].As<v8::Function>();
+	return true;
+}
+
+void RegisterAdded(const Nan::FunctionCallbackInfo<v8::Value>& args) {
 	Nan::HandleScope scope;
 
-	if (it == NULL) {
+	v8::Local<v8::Function> callback;
+	if (!GetCallbackArgument(args, &callback)) {
 		return;
 	}
 
-	if (isRemovedRegistered) {
-		v8::Local<v8::Value> argv[1];
-		v8::Local<v8::Object> item = Nan::New<v8::Object>();
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_LOCATION_ID).ToLocalChecked(), Nan::New<v8::Number>(it->locationId));
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_VENDOR_ID).ToLocalChecked(), Nan::New<v8::Number>(it->vendorId));
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_PRODUCT_ID).ToLocalChecked(), Nan::New<v8::Number>(it->productId));
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_DEVICE_NAME).ToLocalChecked(), Nan::New<v8::String>(it->deviceName.c_str()).ToLocalChecked());
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_MANUFACTURER).ToLocalChecked(), Nan::New<v8::String>(it->manufacturer.c_str()).ToLocalChecked());
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_SERIAL_NUMBER).ToLocalChecked(), Nan::New<v8::String>(it->serialNumber.c_str()).ToLocalChecked());
-		Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_DEVICE_ADDRESS).ToLocalChecked(), Nan::New<v8::Number>(it->deviceAddress));
-		argv[0] = item;
-		
-		Nan::AsyncResource resource("usb-detection:NotifyRemoved");
-		removedCallback->Call(1, argv, &resource);
+	// Registering again replaces the previous callback
+	if (isAddedRegistered) {
+		delete addedCallback;
 	}
+	addedCallback = new Nan::Callback(callback);
+	isAddedRegistered = true;
 }
 
-void Find(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+void RegisterRemoved(const Nan::FunctionCallbackInfo<v8::Value>& args) {
 	Nan::HandleScope scope;
 
-	int vid = 0;
-	int pid = 0;
 	v8::Local<v8::Function> callback;
+	if (!GetCallbackArgument(args, &callback)) {
+		return;
+	}
 
-	if (args.Length() == 0) {
-		return Nan::ThrowTypeError("First argument must be a function");
+	// Registering again replaces the previous callback
+	if (isRemovedRegistered) {
+		delete removedCallback;
 	}
+	removedCallback = new Nan::Callback(callback);
+	isRemovedRegistered = true;
+}
 
-	if (args.Length() == 3) {
-		if (args[0]->IsNumber() && args[1]->IsNumber()) {
-			vid = (int) Nan::To<int>(args[0]).FromJust();
-			pid = (int) Nan::To<int>(args[1]).FromJust();
+/*
+ * registerReady(callback, settleTimeoutMs)
+ *
+ * Turns on the readiness tracking, which costs a little per uevent, so
+ * only once somebody asked for it.
+ */
+void RegisterReady(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	if (args.Length() < 1 || !args[0]->IsFunction()) {
+		return Nan::ThrowTypeError("First argument must be a function");
+	}
+	if (args.Length() > 1 && !args[1]->IsUndefined()) {
+		if (!args[1]->IsNumber() || Nan::To<int>(args[1]).FromJust() < 0) {
+			return Nan::ThrowTypeError("Second argument must be a settle timeout in milliseconds");
 		}
+		readySettleTimeout = Nan::To<int>(args[1]).FromJust();
+	}
 
-		// callback
-		if(!args[2]->IsFunction()) {
-			return Nan::ThrowTypeError("Third argument must be a function");
+	// Registering again replaces the previous callback
+	if (isReadyRegistered) {
+		delete readyCallback;
+	}
+	readyCallback = new Nan::Callback(args[0].As<v8::Function>());
+	isReadyRegistered = true;
+
+	SetReadyTracking(true, readySettleTimeout);
+}
+
+static const char* GetActionName(MonitorAction_t action) {
+	switch (action) {
+		case MonitorAction_Added: return MONITOR_ACTION_ADDED;
+		case MonitorAction_Removed: return MONITOR_ACTION_REMOVED;
+		case MonitorAction_Ready: return MONITOR_ACTION_READY;
+	}
+
+	return "";
+}
+
+static bool MatchesFilter(const MonitorFilter_t& filter, ListResultItem_t* it, int action) {
+	if ((filter.actions & action) == 0) {
+		return false;
+	}
+	if (filter.vid != 0 && filter.vid != it->vendorId) {
+		return false;
+	}
+	if (filter.pid != 0 && filter.pid != it->productId) {
+		return false;
+	}
+	if (!filter.serialNumber.empty() && filter.serialNumber != it->serialNumber) {
+		return false;
+	}
+	if (!filter.serialPrefix.empty() && it->serialNumber.compare(0, filter.serialPrefix.size(), filter.serialPrefix) != 0) {
+		return false;
+	}
+
+	return MatchesClass(filter.classMatch, it);
+}
+
+static bool MatchesMonitor(Monitor* monitor, ListResultItem_t* it, MonitorAction_t action) {
+	return !monitor->closed && MatchesFilter(monitor->filter, it, action);
+}
+
+static void SweepClosedMonitors() {
+	std::list<Monitor*>::iterator it = monitors.begin();
+	while (it != monitors.end()) {
+		if ((*it)->closed) {
+			delete (*it)->callback;
+			delete *it;
+			it = monitors.erase(it);
 		}
+		else {
+			++it;
+		}
+	}
+}
 
-		callback = args[2].As<v8::Function>();
+// Events which were already on their way when monitoring got paused.
+// A vector which keeps its capacity, so pausing again doesn't allocate
+typedef std::pair<ListResultItem_t*, MonitorAction_t> PausedEvent_t;
+static bool isPaused = false;
+static std::vector<PausedEvent_t> pausedEvents;
+
+// Distinct field masks whose device object one event shares between its
+// monitors, any further ones get their own object per monitor
+#define DISPATCH_SHARED_OBJECTS 8
+
+/*
+ * Hands one event to the global callback and to every monitor whose
+ * predicate matches. The JS device object is only built if somebody
+ * actually wants it, and only once per distinct field mask.
+ */
+static void Dispatch(ListResultItem_t* it, MonitorAction_t action) {
+	Nan::HandleScope scope;
+
+	if (isPaused) {
+		pausedEvents.push_back(std::make_pair(CopyElement(it), action));
+		return;
 	}
 
-	if (args.Length() == 2) {
-		if (args[0]->IsNumber()) {
-			vid = (int) Nan::To<int>(args[0]).FromJust();
+	Nan::Callback* globalCallback = NULL;
+	const char* resourceName = NULL;
+	if (action == MonitorAction_Added && isAddedRegistered) {
+		globalCallback = addedCallback;
+		resourceName = "usb-detection:NotifyAdded";
+	}
+	else if (action == MonitorAction_Removed && isRemovedRegistered) {
+		globalCallback = removedCallback;
+		resourceName = "usb-detection:NotifyRemoved";
+	}
+	else if (action == MonitorAction_Ready && isReadyRegistered) {
+		globalCallback = readyCallback;
+		resourceName = "usb-detection:NotifyReady";
+	}
+
+	if (globalCallback != NULL) {
+		v8::Local<v8::Value> argv[1];
+		argv[0] = DeviceObjectBuilder(GetDeviceConverter(DeviceField_All)).Build(it);
+
+		Nan::AsyncResource resource(resourceName);
+		globalCallback->Call(1, argv, &resource);
+	}
+
+	if (monitors.empty()) {
+		return;
+	}
+
+	v8::Local<v8::Value> actionName = Nan::New<v8::String>(GetActionName(action)).ToLocalChecked();
+	// Monitors asking for the same fields share the object, on the stack
+	// so delivering an event doesn't allocate
+	int sharedFields[DISPATCH_SHARED_OBJECTS];
+	v8::Local<v8::Object> sharedItems[DISPATCH_SHARED_OBJECTS];
+	int sharedCount = 0;
+
+	isDispatching = true;
+	for (std::list<Monitor*>::iterator monitor = monitors.begin(); monitor != monitors.end(); ++monitor) {
+		if (!MatchesMonitor(*monitor, it, action)) {
+			continue;
 		}
 
-		// callback
-		if(!args[1]->IsFunction()) {
-			return Nan::ThrowTypeError("Second argument must be a function");
+		int fields = (*monitor)->fields;
+		int shared = 0;
+		while (shared < sharedCount && sharedFields[shared] != fields) {
+			shared++;
 		}
 
-		callback = args[1].As<v8::Function>();
+		v8::Local<v8::Object> item;
+		if (shared < sharedCount) {
+			item = sharedItems[shared];
+		}
+		else {
+			item = DeviceObjectBuilder(GetDeviceConverter(fields)).Build(it);
+			if (sharedCount < DISPATCH_SHARED_OBJECTS) {
+				sharedFields[sharedCount] = fields;
+				sharedItems[sharedCount++] = item;
+			}
+		}
+
+		v8::Local<v8::Value> argv[2];
+		argv[0] = actionName;
+		argv[1] = item;
+
+		Nan::AsyncResource resource("usb-detection:NotifyMonitor");
+		(*monitor)->callback->Call(2, argv, &resource);
 	}
+	isDispatching = false;
 
-	if (args.Length() == 1) {
-		// callback
-		if(!args[0]->IsFunction()) {
-			return Nan::ThrowTypeError("First argument must be a function");
-		}
+	SweepClosedMonitors();
+}
 
-		callback = args[0].As<v8::Function>();
+// Journaled right away, also while paused, the journal is about when it happened
+static void Notify(ListResultItem_t* it, MonitorAction_t action) {
+	if (it == NULL) {
+		return;
 	}
 
-	ListBaton* baton = new ListBaton();
-	strcpy(baton->errorString, "");
-	baton->callback = new Nan::Callback(callback);
-	baton->vid = vid;
-	baton->pid = pid;
+	// A `find` from here on has to see this event, don't let it join a scan
+	// which may have started before it
+	inflightFinds.clear();
 
-	uv_work_t* req = new uv_work_t();
-	req->data = baton;
-	uv_queue_work(uv_default_loop(), req, EIO_Find, (uv_after_work_cb)EIO_AfterFind);
+	uint64_t traceStart = TraceBegin();
+	// Only what came and went, `ready` is a follow-up of an add
+	if (action != MonitorAction_Ready) {
+		RecordJournalEvent(it, action);
+	}
+	Dispatch(it, action);
+	TraceEnd("handlers", traceStart, GetActionName(action));
 }
 
-void EIO_AfterFind(uv_work_t* req) {
-	Nan::HandleScope scope;
+void NotifyAdded(ListResultItem_t* it) {
+	Notify(it, MonitorAction_Added);
+}
 
-	ListBaton* data = static_cast<ListBaton*>(req->data);
+void NotifyRemoved(ListResultItem_t* it) {
+	Notify(it, MonitorAction_Removed);
+}
 
-	v8::Local<v8::Value> argv[2];
-	if(data->errorString[0]) {
-		argv[0] = v8::Exception::Error(Nan::New<v8::String>(data->errorString).ToLocalChecked());
-		argv[1] = Nan::Undefined();
+void NotifyReady(ListResultItem_t* it) {
+	Notify(it, MonitorAction_Ready);
+}
+
+static int GetIntegerOption(v8::Local<v8::Object> options, const char* name) {
+	v8::Local<v8::Value> value = Nan::Get(options, Nan::New<v8::String>(name).ToLocalChecked()).ToLocalChecked();
+	if (value->IsNumber()) {
+		return (int) Nan::To<int>(value).FromJust();
 	}
-	else {
-		v8::Local<v8::Array> results = Nan::New<v8::Array>();
-		int i = 0;
-		for(std::list<ListResultItem_t*>::iterator it = data->results.begin(); it != data->results.end(); it++, i++) {
-			v8::Local<v8::Object> item = Nan::New<v8::Object>();
-			Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_LOCATION_ID).ToLocalChecked(), Nan::New<v8::Number>((*it)->locationId));
-			Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_VENDOR_ID).ToLocalChecked(), Nan::New<v8::Number>((*it)->vendorId));
-			Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_PRODUCT_ID).ToLocalChecked(), Nan::New<v8::Number>((*it)->productId));
-			Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_DEVICE_NAME).ToLocalChecked(), Nan::New<v8::String>((*it)->deviceName.c_str()).ToLocalChecked());
-			Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_MANUFACTURER).ToLocalChecked(), Nan::New<v8::String>((*it)->manufacturer.c_str()).ToLocalChecked());
-			Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_SERIAL_NUMBER).ToLocalChecked(), Nan::New<v8::String>((*it)->serialNumber.c_str()).ToLocalChecked());
-			Nan::Set(item, Nan::New<v8::String>(OBJECT_ITEM_DEVICE_ADDRESS).ToLocalChecked(), Nan::New<v8::Number>((*it)->deviceAddress));
-			Nan::Set(results, i, item);
+
+	return 0;
+}
+
+// `find`/`createMonitor` class options, all of them optional
+static bool ParseClassMatch(v8::Local<v8::Object> options, UsbClassMatch_t* match) {
+	struct {
+		const char* name;
+		int* value;
+	} classOptions[] = {
+		{ OBJECT_ITEM_DEVICE_CLASS, &match->deviceClass },
+		{ OBJECT_ITEM_DEVICE_SUB_CLASS, &match->deviceSubClass },
+		{ OBJECT_ITEM_DEVICE_PROTOCOL, &match->deviceProtocol },
+		{ OBJECT_INTERFACE_CLASS, &match->interfaceClass },
+		{ OBJECT_INTERFACE_SUB_CLASS, &match->interfaceSubClass },
+		{ OBJECT_INTERFACE_PROTOCOL, &match->interfaceProtocol },
+	};
+
+	for (size_t i = 0; i < sizeof(classOptions) / sizeof(classOptions[0]); i++) {
+		v8::Local<v8::Value> value = Nan::Get(options, Nan::New<v8::String>(classOptions[i].name).ToLocalChecked()).ToLocalChecked();
+		if (value->IsUndefined()) {
+			continue;
 		}
-		argv[0] = Nan::Undefined();
-		argv[1] = results;
+
+		int classCode = value->IsNumber() ? (int) Nan::To<int>(value).FromJust() : -1;
+		if (classCode < 0 || classCode > 0xff) {
+			Nan::ThrowTypeError("USB class options must be numbers from 0 to 255");
+			return false;
+		}
+		*classOptions[i].value = classCode;
 	}
 
-	Nan::AsyncResource resource("usb-detection:EIO_AfterFind");
-	data->callback->Call(2, argv, &resource);
+	return true;
+}
 
-	for(std::list<ListResultItem_t*>::iterator it = data->results.begin(); it != data->results.end(); it++) {
-		delete *it;
+static bool GetStringOption(v8::Local<v8::Object> options, const char* name, std::string* out) {
+	v8::Local<v8::Value> value = Nan::Get(options, Nan::New<v8::String>(name).ToLocalChecked()).ToLocalChecked();
+	if (value->IsUndefined()) {
+		return true;
+	}
+	if (!value->IsString()) {
+		Nan::ThrowTypeError("Serial number options must be strings");
+		return false;
 	}
-	delete data;
-	delete req;
+
+	*out = *Nan::Utf8String(value);
+	return true;
 }
 
-void StartMonitoring(const Nan::FunctionCallbackInfo<v8::Value>& args) {
-	Start();
+static bool ParseMonitorActions(v8::Local<v8::Object> options, int* actions) {
+	v8::Local<v8::Value> value = Nan::Get(options, Nan::New<v8::String>("actions").ToLocalChecked()).ToLocalChecked();
+	if (value->IsUndefined()) {
+		*actions = MonitorAction_Added | MonitorAction_Removed;
+		return true;
+	}
+
+	if (!value->IsArray()) {
+		Nan::ThrowTypeError("`actions` must be an array");
+		return false;
+	}
+
+	v8::Local<v8::Array> list = value.As<v8::Array>();
+	*actions = 0;
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		Nan::Utf8String name(Nan::Get(list, i).ToLocalChecked());
+		if (strcmp(*name, MONITOR_ACTION_ADDED) == 0 || strcmp(*name, MONITOR_ACTION_INSERT) == 0) {
+			*actions |= MonitorAction_Added;
+		}
+		else if (strcmp(*name, MONITOR_ACTION_REMOVED) == 0) {
+			*actions |= MonitorAction_Removed;
+		}
+		else if (strcmp(*name, MONITOR_ACTION_READY) == 0) {
+			*actions |= MonitorAction_Ready;
+		}
+		else {
+			Nan::ThrowTypeError("`actions` may only contain \"add\", \"insert\", \"remove\" or \"ready\"");
+			return false;
+		}
+	}
+
+	return true;
 }
 
-void StopMonitoring(const Nan::FunctionCallbackInfo<v8::Value>& args) {
-	Stop();
+// `createMonitor` and `getHistory` filters
+static bool ParseMonitorFilter(v8::Local<v8::Object> options, MonitorFilter_t* filter) {
+	filter->vid = GetIntegerOption(options, "vendorId");
+	filter->pid = GetIntegerOption(options, "productId");
+
+	return (
+		ParseMonitorActions(options, &filter->actions) &&
+		ParseClassMatch(options, &filter->classMatch) &&
+		GetStringOption(options, "serialNumber", &filter->serialNumber) &&
+		GetStringOption(options, "serialPrefix", &filter->serialPrefix)
+	);
+}
+
+void CreateMonitor(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	if (args.Length() != 2 || !args[0]->IsObject()) {
+		return Nan::ThrowTypeError("First argument must be an object");
+	}
+	if (!args[1]->IsFunction()) {
+		return Nan::ThrowTypeError("Second argument must be a function");
+	}
+
+	v8::Local<v8::Object> options = args[0].As<v8::Object>();
+
+	MonitorFilter_t filter;
+	int fields;
+	if (!ParseMonitorFilter(options, &filter) || !ParseFields(options, &fields)) {
+		return;
+	}
+
+	Monitor* monitor = new Monitor();
+	monitor->id = nextMonitorId++;
+	monitor->filter = filter;
+	monitor->fields = fields;
+	monitor->callback = new Nan::Callback(args[1].As<v8::Function>());
+	monitor->closed = false;
+	monitors.push_back(monitor);
+
+	if (filter.actions & MonitorAction_Ready) {
+		SetReadyTracking(true, readySettleTimeout);
+	}
+
+	args.GetReturnValue().Set(monitor->id);
+}
+
+void CloseMonitor(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	if (args.Length() != 1 || !args[0]->IsNumber()) {
+		return Nan::ThrowTypeError("First argument must be a monitor id");
+	}
+
+	int id = (int) Nan::To<int>(args[0]).FromJust();
+	for (std::list<Monitor*>::iterator it = monitors.begin(); it != monitors.end(); ++it) {
+		if ((*it)->id == id) {
+			(*it)->closed = true;
+		}
+	}
+
+	if (!isDispatching) {
+		SweepClosedMonitors();
+	}
+}
+
+/*
+ * getHistory({ sinceSeq, filter, fields })
+ *
+ * The journaled events after `sinceSeq`, oldest first, as
+ * `{ seq, timestamp, action, device }`. The array carries `lastSeq` to
+ * continue from, and `truncated: true` when events after `sinceSeq` were
+ * already overwritten.
+ */
+void GetHistory(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	uint64_t sinceSeq = 0;
+	MonitorFilter_t filter;
+	filter.vid = 0;
+	filter.pid = 0;
+	filter.actions = MonitorAction_Added | MonitorAction_Removed;
+	int fields = DeviceField_All;
+
+	if (args.Length() > 0 && args[0]->IsObject()) {
+		v8::Local<v8::Object> options = args[0].As<v8::Object>();
+		v8::Local<v8::Value> sinceValue = Nan::Get(options, Nan::New<v8::String>("sinceSeq").ToLocalChecked()).ToLocalChecked();
+		if (sinceValue->IsNumber() && Nan::To<double>(sinceValue).FromJust() >= 0) {
+			sinceSeq = (uint64_t) Nan::To<double>(sinceValue).FromJust();
+		}
+		else if (!sinceValue->IsUndefined()) {
+			return Nan::ThrowTypeError("`sinceSeq` must be a sequence number");
+		}
+
+		v8::Local<v8::Value> filterValue = Nan::Get(options, Nan::New<v8::String>("filter").ToLocalChecked()).ToLocalChecked();
+		if (filterValue->IsObject()) {
+			if (!ParseMonitorFilter(filterValue.As<v8::Object>(), &filter)) {
+				return;
+			}
+		}
+		else if (!filterValue->IsUndefined()) {
+			return Nan::ThrowTypeError("`filter` must be an object");
+		}
+
+		if (!ParseFields(options, &fields)) {
+			return;
+		}
+	}
+	else if (args.Length() > 0 && !args[0]->IsUndefined()) {
+		return Nan::ThrowTypeError("First argument must be an object");
+	}
+
+	uint64_t lastSeq = GetJournalLastSeq();
+	uint64_t firstSeq = sinceSeq + 1;
+	bool isTruncated = firstSeq < GetJournalOldestSeq();
+	if (isTruncated) {
+		firstSeq = GetJournalOldestSeq();
+	}
+
+	DeviceObjectBuilder builder(GetDeviceConverter(fields));
+	v8::Local<v8::String> seqKey = Nan::New<v8::String>("seq").ToLocalChecked();
+	v8::Local<v8::String> timestampKey = Nan::New<v8::String>("timestamp").ToLocalChecked();
+	v8::Local<v8::String> actionKey = Nan::New<v8::String>("action").ToLocalChecked();
+	v8::Local<v8::String> deviceKey = Nan::New<v8::String>("device").ToLocalChecked();
+	v8::Local<v8::String> addedName = Nan::New<v8::String>(MONITOR_ACTION_ADDED).ToLocalChecked();
+	v8::Local<v8::String> removedName = Nan::New<v8::String>(MONITOR_ACTION_REMOVED).ToLocalChecked();
+
+	v8::Local<v8::Array> history = Nan::New<v8::Array>();
+	uint32_t count = 0;
+	for (uint64_t seq = firstSeq; seq <= lastSeq; seq++) {
+		JournalEntry_t* entry = GetJournalEntry(seq);
+		if (entry == NULL || !MatchesFilter(filter, &entry->item, entry->action)) {
+			continue;
+		}
+
+		v8::Local<v8::Object> event = Nan::New<v8::Object>();
+		Nan::Set(event, seqKey, Nan::New<v8::Number>((double) entry->seq));
+		Nan::Set(event, timestampKey, Nan::New<v8::Number>(entry->timestamp));
+		Nan::Set(event, actionKey, entry->action == MonitorAction_Added ? addedName : removedName);
+		Nan::Set(event, deviceKey, builder.Build(&entry->item));
+		Nan::Set(history, count++, event);
+	}
+
+	Nan::Set(history, Nan::New<v8::String>("lastSeq").ToLocalChecked(), Nan::New<v8::Number>((double) lastSeq));
+	if (isTruncated) {
+		Nan::Set(history, Nan::New<v8::String>("truncated").ToLocalChecked(), Nan::New<v8::Boolean>(true));
+	}
+
+	args.GetReturnValue().Set(history);
+}
+
+/*
+ * startTracing()
+ *
+ * Starts a new tracing session, whatever the previous one recorded and
+ * was not collected is dropped.
+ */
+void StartTracing(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	NameTraceThread(PIPELINE_TRACE_CATEGORY " main");
+	StartPipelineTrace();
+}
+
+/*
+ * stopTracing(pid)
+ *
+ * The Chrome trace-event JSON of the session, `pid` is only written into
+ * the events so they land next to the process in Node's own trace.
+ */
+void StopTracing(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	if (args.Length() < 1 || !args[0]->IsNumber()) {
+		return Nan::ThrowTypeError("First argument must be a process id");
+	}
+
+	std::string trace = StopPipelineTrace(Nan::To<int>(args[0]).FromJust());
+	args.GetReturnValue().Set(Nan::New<v8::String>(trace).ToLocalChecked());
+}
+
+void Find(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	int vid = 0;
+	int pid = 0;
+	int fields = DeviceField_All;
+	UsbClassMatch_t classMatch;
+	v8::Local<v8::Function> callback;
+
+	if (args.Length() == 0) {
+		return Nan::ThrowTypeError("First argument must be a function");
+	}
+
+	// find({ vendorId, productId, fields, deviceClass, interfaceClass, ... }, callback)
+	if (args.Length() == 2 && args[0]->IsObject()) {
+		v8::Local<v8::Object> options = args[0].As<v8::Object>();
+		vid = GetIntegerOption(options, "vendorId");
+		pid = GetIntegerOption(options, "productId");
+		if (!ParseFields(options, &fields) || !ParseClassMatch(options, &classMatch)) {
+			return;
+		}
+	}
+	else if (args.Length() == 2) {
+		if (args[0]->IsNumber()) {
+			vid = (int) Nan::To<int>(args[0]).FromJust();
+		}
+	}
+
+	if (args.Length() == 3) {
+		if (args[0]->IsNumber() && args[1]->IsNumber()) {
+			vid = (int) Nan::To<int>(args[0]).FromJust();
+			pid = (int) Nan::To<int>(args[1]).FromJust();
+		}
+
+		// callback
+		if(!args[2]->IsFunction()) {
+			return Nan::ThrowTypeError("Third argument must be a function");
+		}
+
+		callback = args[2].As<v8::Function>();
+	}
+
+	if (args.Length() == 2) {
+		// callback
+		if(!args[1]->IsFunction()) {
+			return Nan::ThrowTypeError("Second argument must be a function");
+		}
+
+		callback = args[1].As<v8::Function>();
+	}
+
+	if (args.Length() == 1) {
+		// callback
+		if(!args[0]->IsFunction()) {
+			return Nan::ThrowTypeError("First argument must be a function");
+		}
+
+		callback = args[0].As<v8::Function>();
+	}
+
+	FindKey_t key;
+	key.vid = vid;
+	key.pid = pid;
+	key.fields = fields;
+	key.classMatch = classMatch;
+	std::map<FindKey_t, ListBaton*>::iterator inflight = inflightFinds.find(key);
+	if (inflight != inflightFinds.end()) {
+		JoinListBaton(inflight->second, callback);
+		return;
+	}
+
+	ListBaton* baton = AcquireListBaton(callback);
+	baton->vid = vid;
+	baton->pid = pid;
+	baton->fields = fields;
+	baton->classMatch = classMatch;
+	inflightFinds[key] = baton;
+
+	uv_queue_work(uv_default_loop(), &baton->request, EIO_Find, (uv_after_work_cb)EIO_AfterFind);
+}
+
+static void EIO_FindUnder(uv_work_t* req) {
+	ListBaton* data = static_cast<ListBaton*>(req->data);
+
+	CreateSubtreeList(&data->results, data->query.c_str());
+}
+
+static void EIO_ParentOf(uv_work_t* req) {
+	ListBaton* data = static_cast<ListBaton*>(req->data);
+
+	CreateParentList(&data->results, data->query.c_str());
+}
+
+static void EIO_FindBySerial(uv_work_t* req) {
+	ListBaton* data = static_cast<ListBaton*>(req->data);
+
+	CreateSerialList(&data->results, data->query.c_str(), false);
+}
+
+static void EIO_FindBySerialPrefix(uv_work_t* req) {
+	ListBaton* data = static_cast<ListBaton*>(req->data);
+
+	CreateSerialList(&data->results, data->query.c_str(), true);
+}
+
+/*
+ * Shared argument handling for the `(string, callback)` queries (port path
+ * or serial number), the results go through `EIO_AfterFind` like any
+ * other `find`.
+ */
+static void QueueStringQuery(const Nan::FunctionCallbackInfo<v8::Value>& args, uv_work_cb work, const char* argumentError) {
+	if (args.Length() != 2 || !args[0]->IsString()) {
+		return Nan::ThrowTypeError(argumentError);
+	}
+	if (!args[1]->IsFunction()) {
+		return Nan::ThrowTypeError("Second argument must be a function");
+	}
+
+	ListBaton* baton = AcquireListBaton(args[1].As<v8::Function>());
+	baton->query = *Nan::Utf8String(args[0]);
+
+	uv_queue_work(uv_default_loop(), &baton->request, work, (uv_after_work_cb)EIO_AfterFind);
+}
+
+void FindUnder(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	QueueStringQuery(args, EIO_FindUnder, "First argument must be a port path");
+}
+
+void ParentOf(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	QueueStringQuery(args, EIO_ParentOf, "First argument must be a port path");
+}
+
+void FindBySerial(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	QueueStringQuery(args, EIO_FindBySerial, "First argument must be a serial number");
+}
+
+void FindBySerialPrefix(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	QueueStringQuery(args, EIO_FindBySerialPrefix, "First argument must be a serial number prefix");
+}
+
+static void EIO_FindMany(uv_work_t* req) {
+	ListBaton* data = static_cast<ListBaton*>(req->data);
+
+	uint64_t traceStart = TraceBegin();
+	CreateMultiFilteredList(&data->results, &data->resultQueries, data->queries, data->fields);
+	TraceEnd("findMany", traceStart);
+}
+
+static void EIO_AfterFindMany(uv_work_t* req) {
+	Nan::HandleScope scope;
+
+	ListBaton* data = static_cast<ListBaton*>(req->data);
+
+	// One array per query, in query order, filled in one pass over the results
+	v8::Local<v8::Array> groups = Nan::New<v8::Array>(data->queries.size());
+	std::vector<uint32_t> groupSizes(data->queries.size(), 0);
+	for (size_t i = 0; i < data->queries.size(); i++) {
+		Nan::Set(groups, i, Nan::New<v8::Array>());
+	}
+
+	DeviceObjectBuilder builder(GetDeviceConverter(data->fields));
+	for (size_t i = 0; i < data->results.count; i++) {
+		uint32_t query = data->resultQueries[i];
+		v8::Local<v8::Array> group = Nan::Get(groups, query).ToLocalChecked().As<v8::Array>();
+		Nan::Set(group, groupSizes[query]++, builder.Build(&data->results.items[i]));
+	}
+
+	// Served from a snapshot which has not been validated yet
+	if (data->provisional) {
+		Nan::Set(groups, Nan::New<v8::String>("provisional").ToLocalChecked(), Nan::New<v8::Boolean>(true));
+	}
+
+	v8::Local<v8::Value> argv[2];
+	argv[0] = Nan::Undefined();
+	argv[1] = groups;
+
+	Nan::AsyncResource resource("usb-detection:EIO_AfterFindMany");
+	data->callback.Call(2, argv, &resource);
+
+	ReleaseListBaton(data);
+}
+
+/*
+ * findMany([{ vendorId, productId }, ...], { fields }, callback)
+ *
+ * Like a `find` per query, with one baton, one pass over the device list
+ * and one callback with the results grouped by query.
+ */
+void FindMany(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	if (args.Length() != 3 || !args[0]->IsArray()) {
+		return Nan::ThrowTypeError("First argument must be an array of queries");
+	}
+	if (!args[1]->IsObject()) {
+		return Nan::ThrowTypeError("Second argument must be an object");
+	}
+	if (!args[2]->IsFunction()) {
+		return Nan::ThrowTypeError("Third argument must be a function");
+	}
+
+	int fields = DeviceField_All;
+	if (!ParseFields(args[1].As<v8::Object>(), &fields)) {
+		return;
+	}
+
+	v8::Local<v8::Array> list = args[0].As<v8::Array>();
+	std::vector<DeviceIdQuery_t> queries(list->Length());
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		v8::Local<v8::Value> value = Nan::Get(list, i).ToLocalChecked();
+		if (!value->IsObject()) {
+			return Nan::ThrowTypeError("Queries must be { vendorId, productId } objects");
+		}
+
+		queries[i].vid = GetIntegerOption(value.As<v8::Object>(), "vendorId");
+		queries[i].pid = GetIntegerOption(value.As<v8::Object>(), "productId");
+	}
+
+	ListBaton* baton = AcquireListBaton(args[2].As<v8::Function>());
+	baton->queries.swap(queries);
+	baton->fields = fields;
+
+	uv_queue_work(uv_default_loop(), &baton->request, EIO_FindMany, (uv_after_work_cb)EIO_AfterFindMany);
+}
+
+static void EIO_Serialize(uv_work_t* req) {
+	ListBaton* data = static_cast<ListBaton*>(req->data);
+
+	CreateFilteredList(&data->results, data->vid, data->pid, data->fields, data->classMatch);
+	data->output = SerializeDevices(&data->results, data->fields, (SerializeFormat_t) data->format, data->provisional, &data->outputLength);
+	if (data->output == NULL) {
+		snprintf(data->errorString, sizeof(data->errorString), "Out of memory serializing %u devices", (unsigned int) data->results.count);
+	}
+}
+
+static void EIO_AfterSerialize(uv_work_t* req) {
+	Nan::HandleScope scope;
+
+	ListBaton* data = static_cast<ListBaton*>(req->data);
+
+	v8::Local<v8::Value> argv[2];
+	if(data->errorString[0]) {
+		argv[0] = v8::Exception::Error(Nan::New<v8::String>(data->errorString).ToLocalChecked());
+		argv[1] = Nan::Undefined();
+	}
+	else {
+		// The Buffer takes over the malloc'ed bytes, no copy
+		argv[0] = Nan::Undefined();
+		argv[1] = Nan::NewBuffer(data->output, data->outputLength).ToLocalChecked();
+		data->output = NULL;
+	}
+
+	Nan::AsyncResource resource("usb-detection:EIO_AfterSerialize");
+	data->callback.Call(2, argv, &resource);
+
+	ReleaseListBaton(data);
+}
+
+/*
+ * serialize({ format, filter, fields }, callback)
+ *
+ * Filters and encodes on the worker thread, JS only ever sees one Buffer.
+ */
+void Serialize(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	if (args.Length() != 2 || !args[0]->IsObject()) {
+		return Nan::ThrowTypeError("First argument must be an object");
+	}
+	if (!args[1]->IsFunction()) {
+		return Nan::ThrowTypeError("Second argument must be a function");
+	}
+
+	v8::Local<v8::Object> options = args[0].As<v8::Object>();
+	int format = SerializeFormat_Ndjson;
+	v8::Local<v8::Value> formatValue = Nan::Get(options, Nan::New<v8::String>("format").ToLocalChecked()).ToLocalChecked();
+	if (!formatValue->IsUndefined()) {
+		std::string formatName = formatValue->IsString() ? *Nan::Utf8String(formatValue) : "";
+		if (formatName == "binary") {
+			format = SerializeFormat_Binary;
+		}
+		else if (formatName != "ndjson") {
+			return Nan::ThrowTypeError("`format` must be 'ndjson' or 'binary'");
+		}
+	}
+
+	int fields = DeviceField_All;
+	if (!ParseFields(options, &fields)) {
+		return;
+	}
+
+	int vid = 0;
+	int pid = 0;
+	UsbClassMatch_t classMatch;
+	v8::Local<v8::Value> filterValue = Nan::Get(options, Nan::New<v8::String>("filter").ToLocalChecked()).ToLocalChecked();
+	if (filterValue->IsObject()) {
+		v8::Local<v8::Object> filter = filterValue.As<v8::Object>();
+		vid = GetIntegerOption(filter, "vendorId");
+		pid = GetIntegerOption(filter, "productId");
+		if (!ParseClassMatch(filter, &classMatch)) {
+			return;
+		}
+	}
+	else if (!filterValue->IsUndefined()) {
+		return Nan::ThrowTypeError("`filter` must be an object");
+	}
+
+	ListBaton* baton = AcquireListBaton(args[1].As<v8::Function>());
+	baton->vid = vid;
+	baton->pid = pid;
+	baton->fields = fields;
+	baton->classMatch = classMatch;
+	baton->format = format;
+
+	uv_queue_work(uv_default_loop(), &baton->request, EIO_Serialize, (uv_after_work_cb)EIO_AfterSerialize);
+}
+
+static void CallFindCallback(ListBaton* data, Nan::Callback* callback, Nan::AsyncResource* resource) {
+	v8::Local<v8::Value> argv[2];
+	if(data->errorString[0]) {
+		argv[0] = v8::Exception::Error(Nan::New<v8::String>(data->errorString).ToLocalChecked());
+		argv[1] = Nan::Undefined();
+	}
+	else {
+		v8::Local<v8::Array> results = CreateDeviceArray(&data->results, data->fields);
+		// Served from a snapshot which has not been validated yet
+		if(data->provisional) {
+			Nan::Set(results, Nan::New<v8::String>("provisional").ToLocalChecked(), Nan::New<v8::Boolean>(true));
+		}
+		argv[0] = Nan::Undefined();
+		argv[1] = results;
+	}
+
+	callback->Call(2, argv, resource);
+}
+
+void EIO_AfterFind(uv_work_t* req) {
+	Nan::HandleScope scope;
+
+	ListBaton* data = static_cast<ListBaton*>(req->data);
+
+	// Also the queries sharing this callback (`findUnder`, ...), they never join
+	std::map<FindKey_t, ListBaton*>::iterator inflight = inflightFinds.find(GetFindKey(data));
+	if (inflight != inflightFinds.end() && inflight->second == data) {
+		inflightFinds.erase(inflight);
+	}
+
+	Nan::AsyncResource resource("usb-detection:EIO_AfterFind");
+	CallFindCallback(data, &data->callback, &resource);
+	// One scan, but every caller owns its devices like without joining
+	for (size_t i = 0; i < data->joinedCallbacks.size(); i++) {
+		CallFindCallback(data, data->joinedCallbacks[i], &resource);
+	}
+
+	ReleaseListBaton(data);
+}
+
+/*
+ * `waitFor` waiters. The matching happens in the device list (see
+ * `FindOrAddWaiter`), here we only keep the JS side: the callbacks, one
+ * timer for all deadlines and the queue of resolved waiters which the
+ * monitor thread fills.
+ */
+typedef struct {
+	Nan::Callback* callback;
+	bool hasDeadline;
+	std::multimap<uint64_t, int>::iterator deadline;
+} Waiter_t;
+
+static std::map<int, Waiter_t> waiters;
+static std::multimap<uint64_t, int> waiterDeadlines;
+static int nextWaiterId = 1;
+
+static bool isWaiterInitialized = false;
+static uv_timer_t waiterTimer;
+static uv_async_t waiterAsync;
+// Referenced while a waiter resolved right away is queued, see `WaitFor`
+static bool isWaiterAsyncRef = false;
+static uv_mutex_t resolvedWaitersMutex;
+static std::list<std::pair<int, ListResultItem_t*> > resolvedWaiters;
+
+static void CompleteWaiter(int id, ListResultItem_t* item) {
+	std::map<int, Waiter_t>::iterator it = waiters.find(id);
+	if (it == waiters.end()) {
+		ReleaseListResultItem(item);
+		return;
+	}
+
+	Nan::Callback* callback = it->second.callback;
+	if (it->second.hasDeadline) {
+		waiterDeadlines.erase(it->second.deadline);
+	}
+	waiters.erase(it);
+
+	v8::Local<v8::Value> argv[2];
+	if (item != NULL) {
+		argv[0] = Nan::Undefined();
+		argv[1] = DeviceObjectBuilder(GetDeviceConverter(DeviceField_All)).Build(item);
+	}
+	else {
+		argv[0] = Nan::Error("Timed out waiting for the device");
+		argv[1] = Nan::Undefined();
+	}
+	ReleaseListResultItem(item);
+
+	Nan::AsyncResource resource("usb-detection:WaitFor");
+	callback->Call(2, argv, &resource);
+	delete callback;
+}
+
+// Called with the device list locked, possibly on the monitor thread
+static void QueueResolvedWaiter(int id, ListResultItem_t* item) {
+	uv_mutex_lock(&resolvedWaitersMutex);
+	resolvedWaiters.push_back(std::make_pair(id, item));
+	uv_mutex_unlock(&resolvedWaitersMutex);
+
+	uv_async_send(&waiterAsync);
+}
+
+static void cbWaiterAsync(uv_async_t* handle) {
+	Nan::HandleScope scope;
+
+	std::list<std::pair<int, ListResultItem_t*> > resolved;
+	uv_mutex_lock(&resolvedWaitersMutex);
+	resolved.swap(resolvedWaiters);
+	uv_mutex_unlock(&resolvedWaitersMutex);
+
+	if (isWaiterAsyncRef) {
+		isWaiterAsyncRef = false;
+		uv_unref((uv_handle_t *) &waiterAsync);
+	}
+
+	for (std::list<std::pair<int, ListResultItem_t*> >::iterator it = resolved.begin(); it != resolved.end(); ++it) {
+		CompleteWaiter(it->first, it->second);
+	}
+}
+
+static void cbWaiterTimer(uv_timer_t* handle);
+
+static void ArmWaiterTimer() {
+	if (waiterDeadlines.empty()) {
+		uv_timer_stop(&waiterTimer);
+		return;
+	}
+
+	uint64_t now = uv_now(uv_default_loop());
+	uint64_t next = waiterDeadlines.begin()->first;
+	uv_timer_start(&waiterTimer, cbWaiterTimer, next > now ? next - now : 0, 0);
+}
+
+static void cbWaiterTimer(uv_timer_t* handle) {
+	Nan::HandleScope scope;
+
+	uint64_t now = uv_now(uv_default_loop());
+	std::list<int> expired;
+	for (std::multimap<uint64_t, int>::iterator it = waiterDeadlines.begin(); it != waiterDeadlines.end() && it->first <= now; ++it) {
+		expired.push_back(it->second);
+	}
+
+	for (std::list<int>::iterator id = expired.begin(); id != expired.end(); ++id) {
+		// Otherwise it was resolved and is already queued for `cbWaiterAsync`
+		if (RemoveWaiter(*id)) {
+			CompleteWaiter(*id, NULL);
+		}
+	}
+
+	ArmWaiterTimer();
+}
+
+static void InitWaiters() {
+	if (isWaiterInitialized) {
+		return;
+	}
+
+	isWaiterInitialized = true;
+	uv_mutex_init(&resolvedWaitersMutex);
+	uv_timer_init(uv_default_loop(), &waiterTimer);
+	uv_async_init(uv_default_loop(), &waiterAsync, cbWaiterAsync);
+	// Pending waiters without a deadline should not keep the process alive
+	uv_unref((uv_handle_t *) &waiterAsync);
+	SetWaiterResolvedCallback(QueueResolvedWaiter);
+}
+
+void WaitFor(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	if (args.Length() != 3 || !args[0]->IsObject()) {
+		return Nan::ThrowTypeError("First argument must be an object");
+	}
+	if (!args[1]->IsNumber() && !args[1]->IsUndefined()) {
+		return Nan::ThrowTypeError("Second argument must be a timeout in milliseconds");
+	}
+	if (!args[2]->IsFunction()) {
+		return Nan::ThrowTypeError("Third argument must be a function");
+	}
+
+	InitWaiters();
+
+	v8::Local<v8::Object> options = args[0].As<v8::Object>();
+	DeviceMatch_t match;
+	match.vid = GetIntegerOption(options, "vendorId");
+	match.pid = GetIntegerOption(options, "productId");
+	v8::Local<v8::Value> serialNumber = Nan::Get(options, Nan::New<v8::String>("serialNumber").ToLocalChecked()).ToLocalChecked();
+	if (serialNumber->IsString()) {
+		match.serialNumber = *Nan::Utf8String(serialNumber);
+	}
+
+	int id = nextWaiterId++;
+	Waiter_t waiter;
+	waiter.callback = new Nan::Callback(args[2].As<v8::Function>());
+	waiter.hasDeadline = false;
+
+	double timeout = args[1]->IsNumber() ? Nan::To<double>(args[1]).FromJust() : 0;
+	if (timeout > 0) {
+		waiter.hasDeadline = true;
+		waiter.deadline = waiterDeadlines.insert(std::make_pair(uv_now(uv_default_loop()) + (uint64_t) timeout, id));
+	}
+	waiters[id] = waiter;
+
+	// Already there, still answer asynchronously like every other case.
+	// Nothing else may keep the loop alive until then (no monitoring, no
+	// timeout), so the async does until `cbWaiterAsync` ran
+	ListResultItem_t* found = FindOrAddWaiter(id, match);
+	if (found != NULL) {
+		if (!isWaiterAsyncRef) {
+			isWaiterAsyncRef = true;
+			uv_ref((uv_handle_t *) &waiterAsync);
+		}
+		QueueResolvedWaiter(id, found);
+	}
+
+	ArmWaiterTimer();
+}
+
+void GetAttributes(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	if (args.Length() != 1 || !args[0]->IsString()) {
+		return Nan::ThrowTypeError("First argument must be a port path");
+	}
+
+	DeviceAttributes_t attributes;
+	if (!GetItemAttributes(*Nan::Utf8String(args[0]), &attributes)) {
+		return;
+	}
+
+	v8::Local<v8::Object> result = Nan::New<v8::Object>();
+	for (DeviceAttributes_t::iterator it = attributes.begin(); it != attributes.end(); ++it) {
+		Nan::Set(result, Nan::New<v8::String>(it->first.c_str()).ToLocalChecked(), Nan::New<v8::String>(it->second.c_str()).ToLocalChecked());
+	}
+
+	args.GetReturnValue().Set(result);
+}
+
+/*
+ * Digest of the devices matching `{ vendorId, productId }` as 32 hex
+ * digits. Kept up to date on every add and remove, so this is just a read.
+ */
+void TopologyHash(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Nan::HandleScope scope;
+
+	int vid = 0;
+	int pid = 0;
+	if (args.Length() > 0 && args[0]->IsObject()) {
+		v8::Local<v8::Object> filter = args[0].As<v8::Object>();
+		vid = GetIntegerOption(filter, "vendorId");
+		pid = GetIntegerOption(filter, "productId");
+	}
+	else if (args.Length() > 0 && !args[0]->IsUndefined()) {
+		return Nan::ThrowTypeError("First argument must be an object");
+	}
+
+	TopologyDigest_t digest;
+	GetTopologyDigest(vid, pid, &digest);
+
+	char hex[33];
+	snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long) digest.hash[1], (unsigned long long) digest.hash[0]);
+	args.GetReturnValue().Set(Nan::New<v8::String>(hex).ToLocalChecked());
+}
+
+void StartMonitoring(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	Start();
+}
+
+static void ClearPausedEvents() {
+	for (std::vector<PausedEvent_t>::iterator it = pausedEvents.begin(); it != pausedEvents.end(); ++it) {
+		ReleaseListResultItem(it->first);
+	}
+	pausedEvents.clear();
+	isPaused = false;
+}
+
+void StopMonitoring(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	ClearPausedEvents();
+	Stop();
+}
+
+void PauseMonitoring(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	isPaused = true;
+	Pause();
+}
+
+void ResumeMonitoring(const Nan::FunctionCallbackInfo<v8::Value>& args) {
+	if (!isPaused) {
+		return;
+	}
+
+	// Held back events first, they happened before anything queued in the platform.
+	// A handler may pause again, which queues into `pausedEvents` meanwhile
+	std::vector<PausedEvent_t> events;
+	events.swap(pausedEvents);
+	isPaused = false;
+	for (std::vector<PausedEvent_t>::iterator it = events.begin(); it != events.end(); ++it) {
+		Dispatch(it->first, it->second);
+		ReleaseListResultItem(it->first);
+	}
+
+	// Hand the buffer back for the next pause
+	events.clear();
+	if (pausedEvents.empty()) {
+		pausedEvents.swap(events);
+	}
+
+	// Paused again by a handler, the platform has to keep its events queued
+	if (!isPaused) {
+		Resume();
+	}
 }
 
 extern "C" {
@@ -217,8 +1507,28 @@ extern "C" {
 		Nan::SetMethod(target, "find", Find);
 		Nan::SetMethod(target, "registerAdded", RegisterAdded);
 		Nan::SetMethod(target, "registerRemoved", RegisterRemoved);
+		Nan::SetMethod(target, "registerReady", RegisterReady);
+		Nan::SetMethod(target, "findMany", FindMany);
+		Nan::SetMethod(target, "findUnder", FindUnder);
+		Nan::SetMethod(target, "parentOf", ParentOf);
+		Nan::SetMethod(target, "findBySerial", FindBySerial);
+		Nan::SetMethod(target, "findBySerialPrefix", FindBySerialPrefix);
+		Nan::SetMethod(target, "getAttributes", GetAttributes);
+		Nan::SetMethod(target, "topologyHash", TopologyHash);
+		Nan::SetMethod(target, "serialize", Serialize);
+		Nan::SetMethod(target, "waitFor", WaitFor);
+		Nan::SetMethod(target, "createMonitor", CreateMonitor);
+		Nan::SetMethod(target, "closeMonitor", CloseMonitor);
+		Nan::SetMethod(target, "getHistory", GetHistory);
+		Nan::SetMethod(target, "startTracing", StartTracing);
+		Nan::SetMethod(target, "stopTracing", StopTracing);
 		Nan::SetMethod(target, "startMonitoring", StartMonitoring);
 		Nan::SetMethod(target, "stopMonitoring", StopMonitoring);
+		Nan::SetMethod(target, "pauseMonitoring", PauseMonitoring);
+		Nan::SetMethod(target, "resumeMonitoring", ResumeMonitoring);
+#ifdef USB_DETECTION_BENCHMARK
+		InitBenchmark(target);
+#endif
 		InitDetection();
 	}
 }
@@ -6,6 +6,7 @@
 #include <v8.h>
 #include <uv.h>
 #include <list>
+#include <map>
 #include <string>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,27 +18,97 @@
 void Find(const Nan::FunctionCallbackInfo<v8::Value>& args);
 void EIO_Find(uv_work_t* req);
 void EIO_AfterFind(uv_work_t* req);
+v8::Local<v8::Array> CreateDeviceArray(DeviceResults_t* results, int fields);
+void FindMany(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void FindUnder(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void ParentOf(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void FindBySerial(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void FindBySerialPrefix(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void GetAttributes(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void TopologyHash(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void Serialize(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void WaitFor(const Nan::FunctionCallbackInfo<v8::Value>& args);
 void InitDetection();
 void StartMonitoring(const Nan::FunctionCallbackInfo<v8::Value>& args);
 void Start();
 void StopMonitoring(const Nan::FunctionCallbackInfo<v8::Value>& args);
 void Stop();
+void PauseMonitoring(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void Pause();
+void ResumeMonitoring(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void Resume();
+// Opt-in, see `RegisterReady`
+void SetReadyTracking(bool enabled, int settleTimeoutMs);
 
 
+// Recycled between calls together with its result buffer, see `AcquireListBaton`
 struct ListBaton {
 	public:
 		//v8::Persistent<v8::Function> callback;
-		Nan::Callback* callback;
-		std::list<ListResultItem_t*> results;
+		Nan::Callback callback;
+		uv_work_t request;
+		DeviceResults_t results;
 		char errorString[1024];
 		int vid;
 		int pid;
+		int fields;
+		UsbClassMatch_t classMatch;
+		bool provisional;
+		// Port path or serial number, depending on the query
+		std::string query;
+		// `findMany` only, the queries and which one each result matched
+		std::vector<DeviceIdQuery_t> queries;
+		std::vector<uint32_t> resultQueries;
+		// Identical `find` calls made while this one was in flight
+		std::vector<Nan::Callback*> joinedCallbacks;
+		// `serialize` only, a `SerializeFormat_t` and the malloc'ed bytes
+		int format;
+		char* output;
+		size_t outputLength;
+};
+
+ListBaton* AcquireListBaton(v8::Local<v8::Function> callback);
+void ReleaseListBaton(ListBaton* baton);
+
+typedef enum _MonitorAction_t {
+	MonitorAction_Added = 1 << 0,
+	MonitorAction_Removed = 1 << 1,
+	// Once the interface drivers are bound (or the settle timeout passed)
+	MonitorAction_Ready = 1 << 2,
+} MonitorAction_t;
+
+#define READY_SETTLE_TIMEOUT_DEFAULT 2000
+
+typedef struct {
+	int vid;
+	int pid;
+	UsbClassMatch_t classMatch;
+	// Empty matches anything
+	std::string serialNumber;
+	std::string serialPrefix;
+	int actions;
+} MonitorFilter_t;
+
+struct Monitor {
+	public:
+		int id;
+		MonitorFilter_t filter;
+		int fields;
+		Nan::Callback* callback;
+		bool closed;
 };
 
 void RegisterAdded(const Nan::FunctionCallbackInfo<v8::Value>& args);
 void NotifyAdded(ListResultItem_t* it);
 void RegisterRemoved(const Nan::FunctionCallbackInfo<v8::Value>& args);
 void NotifyRemoved(ListResultItem_t* it);
+void RegisterReady(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void NotifyReady(ListResultItem_t* it);
+void CreateMonitor(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void CloseMonitor(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void GetHistory(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void StartTracing(const Nan::FunctionCallbackInfo<v8::Value>& args);
+void StopTracing(const Nan::FunctionCallbackInfo<v8::Value>& args);
 
 #endif
 
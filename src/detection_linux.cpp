@@ -1,8 +1,19 @@
 #include <libudev.h>
 #include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 
 #include "detection.h"
 #include "deviceList.h"
+#include "snapshot.h"
+#include "sharedRegistry.h"
+#include "propertyTable.h"
+#include "partitionPool.h"
+#include "ueventCapture.h"
+#include "pipelineTrace.h"
 
 using namespace std;
 
@@ -13,17 +24,89 @@ using namespace std;
  **********************************/
 #define DEVICE_ACTION_ADDED "add"
 #define DEVICE_ACTION_REMOVED "remove"
+#define DEVICE_ACTION_CHANGED "change"
+#define DEVICE_ACTION_BIND "bind"
+#define DEVICE_ACTION_UNBIND "unbind"
 
+#define DEVICE_SUBSYSTEM_USB "usb"
 #define DEVICE_TYPE_DEVICE "usb_device"
+#define DEVICE_TYPE_INTERFACE "usb_interface"
 
 #define DEVICE_PROPERTY_NAME "ID_MODEL"
 #define DEVICE_PROPERTY_SERIAL "ID_SERIAL_SHORT"
 #define DEVICE_PROPERTY_VENDOR "ID_VENDOR"
 
+// Device descriptor class triplet, hex
+#define DEVICE_SYSATTR_CLASS "bDeviceClass"
+#define DEVICE_SYSATTR_SUB_CLASS "bDeviceSubClass"
+#define DEVICE_SYSATTR_PROTOCOL "bDeviceProtocol"
+// Set by udev's usb_id from the configuration descriptor before the
+// interfaces are even bound, e.g. `:020201:0a0000:`
+#define DEVICE_PROPERTY_INTERFACES "ID_USB_INTERFACES"
+#define INTERFACE_CLASS_LENGTH 6
+
+// Of the active configuration, the interfaces to wait for before `ready`
+#define DEVICE_SYSATTR_INTERFACE_COUNT "bNumInterfaces"
+
+// Binary sysattr, not worth caching as a string
+#define DEVICE_SYSATTR_DESCRIPTORS "descriptors"
+
+// Room for the events which arrive while we are paused
+#define MONITOR_RECEIVE_BUFFER_SIZE (4 * 1024 * 1024)
+
+// `USB_DETECTION_MONITOR=inotify` skips the netlink monitor, e.g. in
+// sandboxes where it opens but never receives anything
+#define MONITOR_ENV "USB_DETECTION_MONITOR"
+#define MONITOR_INOTIFY "inotify"
+// One directory per bus with one node per device, created by devtmpfs
+#define USB_DEVICE_NODE_ROOT "/dev/bus/usb"
+#define INOTIFY_BUFFER_SIZE (64 * 1024)
+// Until the netlink monitor delivers its first uevent, device nodes coming
+// and going without one for this long switch to the inotify monitor
+#define NETLINK_SILENCE_TIMEOUT_NS ((uint64_t) 5 * 1000 * 1000 * 1000)
+
+// Consumers wait in 100ms slices, check for a dead producer every second
+#define SHARED_WAIT_TIMEOUT 100
+#define SHARED_FAILOVER_INTERVAL 10
+
+// Replays wait for the next record in slices too, to notice `Stop`/`Pause`
+#define REPLAY_WAIT_SLICE_NS ((uint64_t) 100 * 1000 * 1000)
+
+// The snapshot file and the shared list get the changes of a plug storm in
+// batches. Fewer changes than the shared event ring holds, so consumers
+// loading the list can always catch up from the ring
+#define LIST_FLUSH_DELAY_NS ((uint64_t) 200 * 1000 * 1000)
+#define LIST_FLUSH_MAX_CHANGES 64
+
 
 /**********************************
  * Local typedefs
  **********************************/
+typedef pair<string, string> ChildDevNode_t;
+
+// A device whose `ready` is still due
+typedef struct {
+	int expectedInterfaces;
+	set<string> boundInterfaces;
+	uint64_t deadline;
+} PendingReady_t;
+
+// Slots in the property table, the configured extras follow the built-ins
+typedef enum {
+	PropertySlot_DeviceName,
+	PropertySlot_SerialNumber,
+	PropertySlot_Manufacturer,
+	PropertySlot_Extra,
+} PropertySlot_t;
+
+// Subsystems of the interface devices whose nodes we report as `childDevNodes`
+static const char* childSubsystems[] = {
+	"tty",
+	"hidraw",
+	"block",
+	"scsi_generic",
+	NULL
+};
 
 
 
@@ -31,15 +114,25 @@ using namespace std;
  * Local Variables
  **********************************/
 static ListResultItem_t* currentItem;
-static bool isAdded;
+// A `MonitorAction_t`
+static int currentAction;
+// When the monitor thread woke up the main thread, for the `wakeup` span
+static uint64_t currentSentAt;
 
 static udev *udev;
-static udev_enumerate *enumerate;
-static udev_list_entry *devices, *dev_list_entry;
 static udev_device *dev;
 
 static udev_monitor *mon;
-static int fd;
+// Of `mon`, or of the inotify instance if we fell back to that
+static int fd = -1;
+
+// Fallback without netlink, watches `USB_DEVICE_NODE_ROOT` and its bus directories
+static bool isInotifyMonitor = false;
+static map<int, string> busWatches;
+// Watches the same nodes next to a netlink monitor which did not prove itself yet
+static int canaryFd = -1;
+// When the netlink monitor counts as silent, 0 while no node changed
+static uint64_t canaryDeadline = 0;
 
 static uv_work_t work_req;
 static uv_signal_t term_signal;
@@ -52,14 +145,100 @@ static uv_cond_t notifyDeviceHandled;
 static bool deviceHandled = true;
 
 static bool isRunning = false;
+// The monitor socket stays open while paused and the kernel keeps
+// queueing uevents for us, which are replayed on resume
+static bool isPaused = false;
+// Whether `work_req` is queued or running
+static bool isWorking = false;
+// The worker gave up on the socket, don't bring it back
+static bool isWorkerFailed = false;
+// The socket was closed by `Stop`, so uevents may have been missed
+static bool needsReconcile = false;
+static bool isHandleInitialized = false;
+
+// Warm start, see `snapshot.h`
+static const char* snapshotPath = NULL;
+// Not written out yet, only touched by the monitor thread
+static int listChanges = 0;
+static uint64_t listChangedAt = 0;
+static uv_work_t validate_req;
+// What `ValidateList` corrected, for `cbValidateAfter` to tell JS
+static list<ListResultItem_t*> validatedAdded;
+static list<ListResultItem_t*> validatedRemoved;
+
+// Shared mode, see `sharedRegistry.h`
+static bool isShared = false;
+static bool isSharedConsumer = false;
+static uint64_t sharedSeq = 0;
+
+// Indexed by `PropertySlot_t`, then the names from `PROPERTIES_ENV`
+static vector<string> propertyNames;
+
+// Capture and replay, see `ueventCapture.h`
+static bool isCapturing = false;
+static bool isReplaying = false;
+static bool isReplayPaced = true;
+// Readiness, only looked at by the monitor thread once `SetReadyTracking` turned it on
+static bool isReadyTracking = false;
+static uint64_t readySettleTimeoutNs = (uint64_t) READY_SETTLE_TIMEOUT_DEFAULT * 1000 * 1000;
+// By devnode, like the device list
+static map<string, PendingReady_t> pendingReady;
+
+// Read but not handled yet when we were paused
+static CapturedUevent_t replayEvent;
+static bool hasReplayEvent = false;
+static bool isReplayDone = false;
 
 /**********************************
  * Local Helper Functions protoypes
  **********************************/
+static bool OpenMonitor();
+static void CloseMonitor();
+static void DrainMonitor();
+static void ReconcileWithSystem();
+static void ReconcileWithShared();
+static void LeaveSharedMode();
+static void QueueWork();
+static bool EnumerateDevices(struct udev* context, list<KeyedDeviceItem_t>* items);
+static void NotifyFromWorker(ListResultItem_t* item, int action);
+static void NotifyReconciled(list<ListResultItem_t*>* added, list<ListResultItem_t*>* removed);
+static void PublishReconciled(list<ListResultItem_t*>* added, list<ListResultItem_t*>* removed, list<string>* addedKeys, list<string>* removedKeys);
+static void ConsumeSharedEvents();
+static void PublishAsProducer();
 static void BuildInitialDeviceList();
+static void MarkListChanged();
+static void CheckListFlush();
+static void FlushListChanges();
+static void cbValidateWork(uv_work_t *req);
+static void cbValidateAfter(uv_work_t *req, int status);
+static bool IsChildSubsystem(const char* subsystem);
+static void ReadAttributes(struct udev_device* dev, DeviceAttributes_t* attributes);
+static const char* GetParentDevNode(struct udev_device* dev);
+static void InitPropertyTable();
+static void ReadProperties(struct udev_device* dev, ListResultItem_t* item, bool withBuiltins);
+static void ReadClasses(struct udev_device* dev, ListResultItem_t* item);
+static void ReadStrings(struct udev_device* dev, ListResultItem_t* item);
+static void ApplyProperty(ListResultItem_t* item, const char* name, const char* value, bool withBuiltins);
+static void ParseInterfaces(const char* interfaces, ListResultItem_t* item);
+static int GetUeventAction(const char* action);
+static void HandleUdevDevice(struct udev_device* dev, int action);
+static bool OpenInotifyMonitor();
+static void HandleInotifyEvents();
+static void OpenCanary();
+static void CloseCanary();
+static void HandleCanaryEvents();
+static bool CheckNetlinkSilence();
+static void CaptureDevice(struct udev_device* dev, int action, int flags);
+static int GetInterfaceCount(DeviceItem_t* item);
+static void EmitReady(const char* devNode);
+static void TrackReadiness(const char* devNode, int expectedInterfaces);
+static void HandleInterfaceBinding(const char* parentDevNode, const string& interfaceName, int action);
+static void CheckReadyDeadlines();
+static void ReplayUevents();
 
 static void WaitForDeviceHandled();
 static void SignalDeviceHandled();
+static void WakeMainThread();
 static void cbTerminate(uv_signal_t *handle, int signum);
 static void cbWork(uv_work_t *req);
 static void cbAfter(uv_work_t *req, int status);
@@ -74,14 +253,29 @@ void Start() {
 	}
 
 	isRunning = true;
+	isPaused = false;
+	isWorkerFailed = false;
+
+	// The handles live as long as the process, a previous worker may still
+	// be on its way out and touch them
+	if(!isHandleInitialized) {
+		isHandleInitialized = true;
+		uv_mutex_init(&notify_mutex);
+		uv_async_init(uv_default_loop(), &async_handler, cbAsync);
+		uv_signal_init(uv_default_loop(), &term_signal);
+		uv_signal_init(uv_default_loop(), &int_signal);
+		uv_cond_init(&notifyDeviceHandled);
+	}
+	uv_ref((uv_handle_t *) &async_handler);
 
-	uv_mutex_init(&notify_mutex);
-	uv_async_init(uv_default_loop(), &async_handler, cbAsync);
-	uv_signal_init(uv_default_loop(), &term_signal);
-	uv_signal_init(uv_default_loop(), &int_signal);
-	uv_cond_init(&notifyDeviceHandled);
+	if(fd < 0 && !isSharedConsumer && !isReplaying) {
+		needsReconcile = true;
+		OpenMonitor();
+	}
 
-	uv_queue_work(uv_default_loop(), &work_req, cbWork, cbAfter);
+	if(!isWorking) {
+		QueueWork();
+	}
 }
 
 void Stop() {
@@ -90,15 +284,49 @@ void Stop() {
 	}
 
 	isRunning = false;
+	isPaused = false;
 
-	uv_mutex_destroy(&notify_mutex);
 	uv_signal_stop(&int_signal);
 	uv_signal_stop(&term_signal);
-	uv_close((uv_handle_t *) &async_handler, NULL);
-	uv_cond_destroy(&notifyDeviceHandled);
+	uv_unref((uv_handle_t *) &async_handler);
+
+	// Otherwise `cbAfter` closes it once the worker is done polling it
+	if(!isWorking) {
+		CloseMonitor();
+	}
+}
+
+/*
+ * Pausing only stops reading the monitor socket, the udev context, the
+ * socket and the device list stay as they are.
+ */
+void Pause() {
+	if(!isRunning || isPaused) {
+		return;
+	}
+
+	isPaused = true;
+	// A paused monitor should not keep the process alive
+	uv_unref((uv_handle_t *) &async_handler);
+}
+
+void Resume() {
+	if(!isRunning || !isPaused) {
+		return;
+	}
+
+	isPaused = false;
+	uv_ref((uv_handle_t *) &async_handler);
+
+	// Otherwise `cbAfter` queues it again once the paused worker is out
+	if(!isWorking) {
+		QueueWork();
+	}
+}
 
-	udev_monitor_unref(mon);
-	udev_unref(udev);
+void SetReadyTracking(bool enabled, int settleTimeoutMs) {
+	readySettleTimeoutNs = (uint64_t) settleTimeoutMs * 1000 * 1000;
+	isReadyTracking = enabled;
 }
 
 void InitDetection() {
@@ -110,34 +338,82 @@ void InitDetection() {
 		return;
 	}
 
-	/* Set up a monitor to monitor devices */
-	mon = udev_monitor_new_from_netlink(udev, "udev");
-	udev_monitor_enable_receiving(mon);
+	snapshotPath = getenv(SNAPSHOT_ENV);
+	InitPropertyTable();
 
-	/* Get the file descriptor (fd) for the monitor.
-	   This fd will get passed to select() */
-	fd = udev_monitor_get_fd(mon);
+	const char* capturePath = getenv(CAPTURE_ENV);
+	isCapturing = capturePath != NULL && OpenCapture(capturePath);
+
+	// Hardware-free, the capture is the only source of devices
+	const char* replayPath = getenv(REPLAY_ENV);
+	if(replayPath != NULL && OpenReplay(replayPath)) {
+		const char* pace = getenv(REPLAY_PACE_ENV);
+		isReplayPaced = pace == NULL || strcmp(pace, "fast") != 0;
+		isReplaying = true;
+		return;
+	}
+
+	const char* sharedName = getenv(SHARED_REGISTRY_ENV);
+	isShared = sharedName != NULL && SharedRegistryOpen(sharedName);
+
+	list<KeyedDeviceItem_t> items;
+	// Another process keeps the list for us, no socket and no enumeration needed
+	if(isShared && SharedRegistryHasProducer()) {
+		if(SharedRegistryLoadList(&items, &sharedSeq)) {
+			AddItemsToList(&items);
+			isSharedConsumer = true;
+			return;
+		}
+
+		// More devices than the segment holds (or no readable list), we keep our own
+		SharedRegistryClose();
+		isShared = false;
+	}
+
+	OpenMonitor();
+
+	if(snapshotPath != NULL && LoadSnapshot(snapshotPath, &items)) {
+		// Answer from the snapshot until the real enumeration is done
+		AddItemsToList(&items);
+		SetListProvisional(true);
+
+		uv_queue_work(uv_default_loop(), &validate_req, cbValidateWork, cbValidateAfter);
+		return;
+	}
 
 	BuildInitialDeviceList();
+	if(snapshotPath != NULL) {
+		WriteSnapshot(snapshotPath);
+	}
 }
 
 
 void EIO_Find(uv_work_t* req) {
 	ListBaton* data = static_cast<ListBaton*>(req->data);
 
-	CreateFilteredList(&data->results, data->vid, data->pid);
+	uint64_t traceStart = TraceBegin();
+	CreateFilteredList(&data->results, data->vid, data->pid, data->fields, data->classMatch);
+	TraceEnd("find", traceStart);
 }
 
 /**********************************
  * Local Functions
  **********************************/
 static void WaitForDeviceHandled() {
+	uint64_t traceStart = TraceBegin();
 	uv_mutex_lock(&notify_mutex);
 	if(deviceHandled == false) {
 		uv_cond_wait(&notifyDeviceHandled, &notify_mutex);
 	}
 	deviceHandled = false;
 	uv_mutex_unlock(&notify_mutex);
+	TraceEnd("waitHandled", traceStart);
+}
+
+// Once `currentItem` and `currentAction` are set
+static void WakeMainThread() {
+	currentSentAt = TraceBegin();
+	uv_async_send(&async_handler);
 }
 
 static void SignalDeviceHandled() {
@@ -148,65 +424,271 @@ static void SignalDeviceHandled() {
 }
 
 static ListResultItem_t* GetProperties(struct udev_device* dev, ListResultItem_t* item) {
-	struct udev_list_entry* sysattrs;
-	struct udev_list_entry* entry;
-	sysattrs = udev_device_get_properties_list_entry(dev);
-	udev_list_entry_foreach(entry, sysattrs) {
-		const char *name, *value;
-		name = udev_list_entry_get_name(entry);
-		value = udev_list_entry_get_value(entry);
-
-		if(strcmp(name, DEVICE_PROPERTY_NAME) == 0) {
-			item->deviceName = value;
-		}
-		else if(strcmp(name, DEVICE_PROPERTY_SERIAL) == 0) {
-			item->serialNumber = value;
-		}
-		else if(strcmp(name, DEVICE_PROPERTY_VENDOR) == 0) {
-			item->manufacturer = value;
-		}
+	// Without udevd, which is why we watch the nodes, there are no
+	// `ID_MODEL`/... in the database. Read them like the enumeration does
+	if(isInotifyMonitor) {
+		ReadStrings(dev, item);
 	}
+	ReadProperties(dev, item, !isInotifyMonitor);
+	ReadClasses(dev, item);
 	item->vendorId = strtol(udev_device_get_sysattr_value(dev,"idVendor"), NULL, 16);
 	item->productId = strtol(udev_device_get_sysattr_value(dev,"idProduct"), NULL, 16);
 	item->deviceAddress = 0;
 	item->locationId = 0;
+	item->portPath = udev_device_get_sysname(dev);
+
+	return item;
+}
+
+/*
+ * The handling below the udev specific reading, shared by the live
+ * uevents and the replayed ones. Takes ownership of `item`.
+ */
+static void HandleDeviceAdded(const char* devNode, DeviceItem_t* item) {
+	int expectedInterfaces = isReadyTracking ? GetInterfaceCount(item) : 0;
+
+	// A reconcile (after a pause or dropped uevents) may have seen it already.
+	// Child nodes show up in later uevents, while the JS side is still
+	// reading this one, so hand over a copy
+	ListResultItem_t* copy = AddItemToListAndCopy((char *)devNode, item);
+	MarkListChanged();
+	SharedRegistryPublishEvent(devNode, copy, true);
+
+	currentItem = copy;
+	currentAction = MonitorAction_Added;
+
+	WakeMainThread();
+
+	if(isReadyTracking) {
+		TrackReadiness(devNode, expectedInterfaces);
+	}
+}
+
+// A copy of the stored device, which is removed from the list. NULL if unknown
+static ListResultItem_t* TakeStoredItem(const char* devNode) {
+	ListResultItem_t* item = TakeItemFromList((char *)devNode);
+	MarkListChanged();
 
 	return item;
 }
 
+// Takes ownership of `item`
+static void HandleDeviceRemoved(const char* devNode, ListResultItem_t* item) {
+	SharedRegistryPublishEvent(devNode, item, false);
+	// Gone before it got ready
+	pendingReady.erase(devNode);
+
+	currentItem = item;
+	currentAction = MonitorAction_Removed;
+
+	WakeMainThread();
+}
+
+static void HandleDeviceChanged(const char* devNode, const DeviceAttributes_t& attributes) {
+	UpdateItemAttributes((char *)devNode, attributes);
+	MarkListChanged();
+}
+
+static void HandleChildDevice(const char* devNode, const char* parentDevNode, int action) {
+	if(action == UeventAction_Add) {
+		if(parentDevNode != NULL) {
+			AddChildDevNode((char *)parentDevNode, devNode);
+			MarkListChanged();
+		}
+	}
+	else if(action == UeventAction_Remove) {
+		RemoveChildDevNode(devNode);
+		MarkListChanged();
+	}
+}
+
+/*
+ * `ready` once as many interfaces got a driver as the active configuration
+ * has, or at the settle timeout for interfaces no driver wants.
+ */
+static int GetInterfaceCount(DeviceItem_t* item) {
+	DeviceAttributes_t::iterator it = item->attributes.find(DEVICE_SYSATTR_INTERFACE_COUNT);
+	if(it == item->attributes.end()) {
+		return 0;
+	}
+
+	// Right aligned, " 2"
+	return (int) strtol(it->second.c_str(), NULL, 10);
+}
+
+static void EmitReady(const char* devNode) {
+	ListResultItem_t* item = CopyItemFromList((char *)devNode);
+	if(item == NULL) {
+		return;
+	}
+
+	NotifyFromWorker(item, MonitorAction_Ready);
+}
+
+static void TrackReadiness(const char* devNode, int expectedInterfaces) {
+	if(expectedInterfaces <= 0) {
+		EmitReady(devNode);
+		return;
+	}
+
+	PendingReady_t& pending = pendingReady[devNode];
+	pending.expectedInterfaces = expectedInterfaces;
+	pending.boundInterfaces.clear();
+	pending.deadline = uv_hrtime() + readySettleTimeoutNs;
+}
+
+static void HandleInterfaceBinding(const char* parentDevNode, const string& interfaceName, int action) {
+	if(parentDevNode == NULL) {
+		return;
+	}
+
+	map<string, PendingReady_t>::iterator it = pendingReady.find(parentDevNode);
+	if(it == pendingReady.end()) {
+		// Already ready, or a driver (re)bound on request later on
+		return;
+	}
+
+	if(action == UeventAction_Bind) {
+		it->second.boundInterfaces.insert(interfaceName);
+	}
+	else {
+		it->second.boundInterfaces.erase(interfaceName);
+	}
+
+	if((int) it->second.boundInterfaces.size() >= it->second.expectedInterfaces) {
+		pendingReady.erase(it);
+		EmitReady(parentDevNode);
+	}
+}
+
+static void CheckReadyDeadlines() {
+	if(pendingReady.empty()) {
+		return;
+	}
+
+	uint64_t now = uv_hrtime();
+	list<string> expired;
+	for(map<string, PendingReady_t>::iterator it = pendingReady.begin(); it != pendingReady.end(); ++it) {
+		if(it->second.deadline <= now) {
+			expired.push_back(it->first);
+		}
+	}
+
+	for(list<string>::iterator it = expired.begin(); it != expired.end(); ++it) {
+		pendingReady.erase(*it);
+		EmitReady(it->c_str());
+	}
+}
+
 static void DeviceAdded(struct udev_device* dev) {
+	uint64_t traceStart = TraceBegin();
 	DeviceItem_t* item = new DeviceItem_t();
 	GetProperties(dev, &item->deviceParams);
+	ReadAttributes(dev, &item->attributes);
+	TraceEnd("properties", traceStart);
+
+	HandleDeviceAdded(udev_device_get_devnode(dev), item);
+}
 
-	AddItemToList((char *)udev_device_get_devnode(dev), item);
+static void DeviceRemoved(struct udev_device* dev) {
+	ListResultItem_t* item = TakeStoredItem(udev_device_get_devnode(dev));
+	if(item == NULL) {
+		item = AcquireListResultItem();
+		GetProperties(dev, item);
+	}
 
-	currentItem = &item->deviceParams;
-	isAdded = true;
+	HandleDeviceRemoved(udev_device_get_devnode(dev), item);
+}
 
-	uv_async_send(&async_handler);
+static void DeviceChanged(struct udev_device* dev) {
+	const char* devNode = udev_device_get_devnode(dev);
+	if(devNode == NULL) {
+		return;
+	}
+
+	DeviceAttributes_t attributes;
+	ReadAttributes(dev, &attributes);
+	HandleDeviceChanged(devNode, attributes);
 }
 
-static void DeviceRemoved(struct udev_device* dev) {
-	ListResultItem_t* item = NULL;
+static void ChildDeviceChanged(struct udev_device* dev, int action) {
+	const char* devNode = udev_device_get_devnode(dev);
+	if(devNode == NULL) {
+		return;
+	}
+
+	HandleChildDevice(devNode, action == UeventAction_Add ? GetParentDevNode(dev) : NULL, action);
+}
+
+static int GetUeventAction(const char* action) {
+	if(action == NULL) {
+		return -1;
+	}
+	if(strcmp(action, DEVICE_ACTION_ADDED) == 0) {
+		return UeventAction_Add;
+	}
+	if(strcmp(action, DEVICE_ACTION_REMOVED) == 0) {
+		return UeventAction_Remove;
+	}
+	if(strcmp(action, DEVICE_ACTION_CHANGED) == 0) {
+		return UeventAction_Change;
+	}
+	if(strcmp(action, DEVICE_ACTION_BIND) == 0) {
+		return UeventAction_Bind;
+	}
+	if(strcmp(action, DEVICE_ACTION_UNBIND) == 0) {
+		return UeventAction_Unbind;
+	}
+
+	return -1;
+}
 
-	if(IsItemAlreadyStored((char *)udev_device_get_devnode(dev))) {
-		DeviceItem_t* deviceItem = GetItemFromList((char *)udev_device_get_devnode(dev));
-		if(deviceItem) {
-			item = CopyElement(&deviceItem->deviceParams);
+static void HandleUdevDevice(struct udev_device* dev, int action) {
+	if(action < 0) {
+		return;
+	}
+
+	const char* devType = udev_device_get_devtype(dev);
+	bool isBinding = action == UeventAction_Bind || action == UeventAction_Unbind;
+
+	// Interface drivers coming and going, only for `ready`
+	if(devType && strcmp(devType, DEVICE_TYPE_INTERFACE) == 0) {
+		if(!isBinding || !isReadyTracking) {
+			return;
 		}
-		RemoveItemFromList(deviceItem);
-		delete deviceItem;
+
+		if(isCapturing) {
+			CaptureDevice(dev, action, UEVENT_FLAG_INTERFACE);
+		}
+		HandleInterfaceBinding(GetParentDevNode(dev), udev_device_get_sysname(dev), action);
+		return;
 	}
 
-	if(item == NULL) {
-		item = new ListResultItem_t();
-		GetProperties(dev, item);
+	bool isDevice = devType && strcmp(devType, DEVICE_TYPE_DEVICE) == 0;
+	bool isChild = !isDevice && IsChildSubsystem(udev_device_get_subsystem(dev));
+	if(isBinding || (!isDevice && !isChild)) {
+		return;
 	}
 
-	currentItem = item;
-	isAdded = false;
+	if(isCapturing) {
+		CaptureDevice(dev, action, isChild ? UEVENT_FLAG_CHILD : 0);
+	}
 
-	uv_async_send(&async_handler);
+	if(isChild) {
+		ChildDeviceChanged(dev, action);
+	}
+	else if(action == UeventAction_Add) {
+		WaitForDeviceHandled();
+		DeviceAdded(dev);
+	}
+	else if(action == UeventAction_Remove) {
+		WaitForDeviceHandled();
+		DeviceRemoved(dev);
+	}
+	else {
+		// Nothing to tell JS about, just keep the attribute cache fresh
+		DeviceChanged(dev);
+	}
 }
 
 
@@ -219,51 +701,131 @@ static void cbWork(uv_work_t *req) {
 
 	uv_signal_start(&int_signal, cbTerminate, SIGINT);
 	uv_signal_start(&term_signal, cbTerminate, SIGTERM);
+	NameTraceThread(PIPELINE_TRACE_CATEGORY " monitor");
 
-	pollfd fds = {fd, POLLIN, 0};
-	while (isRunning) {
-		int ret = poll(&fds, 1, 100);
+	if(isReplaying) {
+		ReplayUevents();
+		FlushListChanges();
+		return;
+	}
+
+	if(isShared) {
+		// Follow the producer until it goes away, then take over
+		if(!SharedRegistryTryBecomeProducer()) {
+			// We kept the list ourselves until now (first start, or we were
+			// the producer before pausing), catch up with the producer's
+			if(!isSharedConsumer) {
+				ReconcileWithShared();
+			}
+			if(isShared) {
+				ConsumeSharedEvents();
+			}
+			if(!isRunning || isPaused) {
+				FlushListChanges();
+				return;
+			}
+		}
+		// Unless the list got too long for the segment, see `LeaveSharedMode`
+		if(isShared) {
+			PublishAsProducer();
+		}
+	}
+	else if(needsReconcile) {
+		ReconcileWithSystem();
+	}
+	needsReconcile = false;
+
+	pollfd fds[2] = {{fd, POLLIN, 0}, {canaryFd, POLLIN, 0}};
+	while (isRunning && !isPaused) {
+		// Negative ones are ignored, the canary is gone most of the time
+		fds[0].fd = fd;
+		fds[1].fd = canaryFd;
+		int ret = poll(fds, 2, 100);
+		if (isReadyTracking) {
+			CheckReadyDeadlines();
+		}
+		CheckListFlush();
+		if (ret > 0 && fds[1].revents != 0) {
+			HandleCanaryEvents();
+		}
+		if (CheckNetlinkSilence()) continue;
+		if (ret > 0 && fds[0].revents == 0) continue;
 		if (!ret) continue;
-		if (ret < 0) break;
+		if (ret < 0) {
+			isWorkerFailed = true;
+			break;
+		}
 
+		if (isInotifyMonitor) {
+			HandleInotifyEvents();
+			continue;
+		}
+
+		errno = 0;
+		uint64_t traceStart = TraceBegin();
 		dev = udev_monitor_receive_device(mon);
+		TraceEnd("receive", traceStart);
+		// The kernel dropped uevents (e.g. a long pause), what is queued
+		// from here on can't be trusted to be complete
+		if (dev == NULL && errno == ENOBUFS) {
+			ReconcileWithSystem();
+			continue;
+		}
 		if (dev) {
-			if(udev_device_get_devtype(dev) && strcmp(udev_device_get_devtype(dev), DEVICE_TYPE_DEVICE) == 0) {
-				if(strcmp(udev_device_get_action(dev), DEVICE_ACTION_ADDED) == 0) {
-					WaitForDeviceHandled();
-					DeviceAdded(dev);
-				}
-				else if(strcmp(udev_device_get_action(dev), DEVICE_ACTION_REMOVED) == 0) {
-					WaitForDeviceHandled();
-					DeviceRemoved(dev);
-				}
-			}
+			// Netlink works here, no need to keep an eye on it
+			CloseCanary();
+			HandleUdevDevice(dev, GetUeventAction(udev_device_get_action(dev)));
 			udev_device_unref(dev);
 		}
 	}
+
+	FlushListChanges();
+	// Only from here, the segment may be written until this point
+	SharedRegistryResign();
 }
 
 static void cbAfter(uv_work_t *req, int status) {
-	Stop();
+	isWorking = false;
+
+	if(isWorkerFailed) {
+		Stop();
+		return;
+	}
+
+	if(!isRunning) {
+		CloseMonitor();
+		return;
+	}
+
+	// Resumed (or restarted) while the worker was on its way out
+	if(!isPaused) {
+		QueueWork();
+	}
 }
 
 static void cbAsync(uv_async_t *handle) {
 	if(!isRunning) {
+		// Let the worker get out of `WaitForDeviceHandled`
+		ReleaseListResultItem(currentItem);
+		currentItem = NULL;
+		SignalDeviceHandled();
 		return;
 	}
 
-	if (isAdded) {
+	TraceEnd("wakeup", currentSentAt);
+	if (currentAction == MonitorAction_Added) {
 		NotifyAdded(currentItem);
 	}
-	else {
+	else if (currentAction == MonitorAction_Removed) {
 		NotifyRemoved(currentItem);
 	}
-
-	// Delete Item in case of removal
-	if(isAdded == false) {
-		delete currentItem;
+	else {
+		NotifyReady(currentItem);
 	}
 
+	ReleaseListResultItem(currentItem);
+	currentItem = NULL;
+
 	SignalDeviceHandled();
 }
 
@@ -273,59 +835,991 @@ static void cbTerminate(uv_signal_t *handle, int signum) {
 }
 
 
-static void BuildInitialDeviceList() {
-	/* Create a list of the devices */
-	enumerate = udev_enumerate_new(udev);
-	udev_enumerate_scan_devices(enumerate);
-	devices = udev_enumerate_get_list_entry(enumerate);
-	/* For each item enumerated, print out its information.
-	   udev_list_entry_foreach is a macro which expands to
-	   a loop. The loop will be executed for each member in
-	   devices, setting dev_list_entry to a list entry
-	   which contains the device's path in /sys. */
-	udev_list_entry_foreach(dev_list_entry, devices) {
-		const char *path;
+static bool IsChildSubsystem(const char* subsystem) {
+	if(subsystem == NULL) {
+		return false;
+	}
+
+	for(int i = 0; childSubsystems[i] != NULL; i++) {
+		if(strcmp(subsystem, childSubsystems[i]) == 0) {
+			return true;
+		}
+	}
 
-		/* Get the filename of the /sys entry for the device
-		   and create a udev_device object (dev) representing it */
-		path = udev_list_entry_get_name(dev_list_entry);
-		dev = udev_device_new_from_syspath(udev, path);
+	return false;
+}
 
-		/* usb_device_get_devnode() returns the path to the device node
-		   itself in /dev. */
-		if(udev_device_get_devnode(dev) == NULL || udev_device_get_sysattr_value(dev,"idVendor") == NULL) {
+static void ReadAttributes(struct udev_device* dev, DeviceAttributes_t* attributes) {
+	struct udev_list_entry* sysattrs;
+	struct udev_list_entry* entry;
+	sysattrs = udev_device_get_sysattr_list_entry(dev);
+	udev_list_entry_foreach(entry, sysattrs) {
+		const char* name = udev_list_entry_get_name(entry);
+		if(strcmp(name, DEVICE_SYSATTR_DESCRIPTORS) == 0) {
 			continue;
 		}
 
-		/* From here, we can call get_sysattr_value() for each file
-		   in the device's /sys entry. The strings passed into these
-		   functions (idProduct, idVendor, serial, etc.) correspond
-		   directly to the files in the /sys directory which
-		   represents the USB device. Note that USB strings are
-		   Unicode, UCS2 encoded, but the strings returned from
-		   udev_device_get_sysattr_value() are UTF-8 encoded. */
-
-		DeviceItem_t* item = new DeviceItem_t();
-		item->deviceParams.vendorId = strtol (udev_device_get_sysattr_value(dev,"idVendor"), NULL, 16);
-		item->deviceParams.productId = strtol (udev_device_get_sysattr_value(dev,"idProduct"), NULL, 16);
-		if(udev_device_get_sysattr_value(dev,"product") != NULL) {
-			item->deviceParams.deviceName = udev_device_get_sysattr_value(dev,"product");
+		// Write-only and unreadable attributes come back as NULL
+		const char* value = udev_device_get_sysattr_value(dev, name);
+		if(value != NULL) {
+			(*attributes)[name] = value;
 		}
-		if(udev_device_get_sysattr_value(dev,"manufacturer") != NULL) {
-			item->deviceParams.manufacturer = udev_device_get_sysattr_value(dev,"manufacturer");
+	}
+}
+
+static void InitPropertyTable() {
+	propertyNames.clear();
+	propertyNames.push_back(DEVICE_PROPERTY_NAME);
+	propertyNames.push_back(DEVICE_PROPERTY_SERIAL);
+	propertyNames.push_back(DEVICE_PROPERTY_VENDOR);
+	ParsePropertyList(getenv(PROPERTIES_ENV), &propertyNames);
+
+	if(!CompilePropertyTable(propertyNames)) {
+		printf("Can't compile the udev property table, ignoring %s\n", PROPERTIES_ENV);
+		propertyNames.resize(PropertySlot_Extra);
+		CompilePropertyTable(propertyNames);
+	}
+}
+
+/*
+ * One table lookup per property instead of comparing against every name
+ * we are interested in.
+ */
+static void ReadProperties(struct udev_device* dev, ListResultItem_t* item, bool withBuiltins) {
+	struct udev_list_entry* properties;
+	struct udev_list_entry* entry;
+	properties = udev_device_get_properties_list_entry(dev);
+	udev_list_entry_foreach(entry, properties) {
+		ApplyProperty(item, udev_list_entry_get_name(entry), udev_list_entry_get_value(entry), withBuiltins);
+	}
+}
+
+static void ApplyProperty(ListResultItem_t* item, const char* name, const char* value, bool withBuiltins) {
+	int slot = LookupProperty(name);
+	if(slot == PROPERTY_SLOT_NONE || value == NULL) {
+		return;
+	}
+
+	if(slot >= PropertySlot_Extra) {
+		item->properties[propertyNames[slot]] = value;
+	}
+	else if(!withBuiltins) {
+		return;
+	}
+	else if(slot == PropertySlot_DeviceName) {
+		item->deviceName = value;
+	}
+	else if(slot == PropertySlot_SerialNumber) {
+		item->serialNumber = value;
+	}
+	else if(slot == PropertySlot_Manufacturer) {
+		item->manufacturer = value;
+	}
+}
+
+// The descriptor strings as the kernel read them, UTF-8
+static void ReadStrings(struct udev_device* dev, ListResultItem_t* item) {
+	if(udev_device_get_sysattr_value(dev,"product") != NULL) {
+		item->deviceName = udev_device_get_sysattr_value(dev,"product");
+	}
+	if(udev_device_get_sysattr_value(dev,"manufacturer") != NULL) {
+		item->manufacturer = udev_device_get_sysattr_value(dev,"manufacturer");
+	}
+	if(udev_device_get_sysattr_value(dev,"serial") != NULL) {
+		item->serialNumber = udev_device_get_sysattr_value(dev, "serial");
+	}
+}
+
+static int ParseHex(const char* value) {
+	return value != NULL ? (int) strtol(value, NULL, 16) : 0;
+}
+
+static void ReadClasses(struct udev_device* dev, ListResultItem_t* item) {
+	item->deviceClass = ParseHex(udev_device_get_sysattr_value(dev, DEVICE_SYSATTR_CLASS));
+	item->deviceSubClass = ParseHex(udev_device_get_sysattr_value(dev, DEVICE_SYSATTR_SUB_CLASS));
+	item->deviceProtocol = ParseHex(udev_device_get_sysattr_value(dev, DEVICE_SYSATTR_PROTOCOL));
+	ParseInterfaces(udev_device_get_property_value(dev, DEVICE_PROPERTY_INTERFACES), item);
+}
+
+static void ParseInterfaces(const char* interfaces, ListResultItem_t* item) {
+	item->interfaces.clear();
+	if(interfaces == NULL) {
+		return;
+	}
+
+	// `:` separated `ccsspp` triplets
+	const char* triplet = interfaces;
+	while(*triplet != '\0') {
+		if(*triplet == ':') {
+			triplet++;
+			continue;
 		}
-		if(udev_device_get_sysattr_value(dev,"serial") != NULL) {
-			item->deviceParams.serialNumber = udev_device_get_sysattr_value(dev, "serial");
+
+		size_t length = strcspn(triplet, ":");
+		if(length == INTERFACE_CLASS_LENGTH) {
+			char hex[3] = { 0, 0, 0 };
+			UsbInterfaceClass_t descriptor;
+			memcpy(hex, triplet, 2);
+			descriptor.interfaceClass = (int) strtol(hex, NULL, 16);
+			memcpy(hex, triplet + 2, 2);
+			descriptor.interfaceSubClass = (int) strtol(hex, NULL, 16);
+			memcpy(hex, triplet + 4, 2);
+			descriptor.interfaceProtocol = (int) strtol(hex, NULL, 16);
+			item->interfaces.push_back(descriptor);
 		}
-		item->deviceParams.deviceAddress = 0;
-		item->deviceParams.locationId = 0;
+		triplet += length;
+	}
+}
 
-		item->deviceState = DeviceState_Connect;
+static const char* GetParentDevNode(struct udev_device* dev) {
+	// The parent is owned by `dev`, no need to unref it
+	struct udev_device* parent = udev_device_get_parent_with_subsystem_devtype(dev, DEVICE_SUBSYSTEM_USB, DEVICE_TYPE_DEVICE);
+	if(parent == NULL) {
+		return NULL;
+	}
 
-		AddItemToList((char *)udev_device_get_devnode(dev), item);
+	return udev_device_get_devnode(parent);
+}
 
-		udev_device_unref(dev);
+static void CaptureValues(struct udev_list_entry* entries, UeventValues_t* values) {
+	struct udev_list_entry* entry;
+	udev_list_entry_foreach(entry, entries) {
+		const char* value = udev_list_entry_get_value(entry);
+		values->push_back(make_pair(string(udev_list_entry_get_name(entry)), string(value != NULL ? value : "")));
 	}
-	/* Free the enumerator object */
-	udev_enumerate_unref(enumerate);
+}
+
+// Everything the handling below reads from `dev`, so a replay can do without it
+static void CaptureDevice(struct udev_device* dev, int action, int flags) {
+	CapturedUevent_t event;
+	event.action = action;
+	event.flags = flags;
+	event.devNode = udev_device_get_devnode(dev) ? udev_device_get_devnode(dev) : "";
+	event.sysName = udev_device_get_sysname(dev) ? udev_device_get_sysname(dev) : "";
+	bool hasParent = (flags & UEVENT_FLAG_INTERFACE) || ((flags & UEVENT_FLAG_CHILD) && action == UeventAction_Add);
+	if(hasParent && GetParentDevNode(dev) != NULL) {
+		event.parentDevNode = GetParentDevNode(dev);
+	}
+	CaptureValues(udev_device_get_properties_list_entry(dev), &event.properties);
+
+	// Same reads as the handling, libudev caches them for it
+	if(flags == 0 && action != UeventAction_Remove) {
+		DeviceAttributes_t attributes;
+		ReadAttributes(dev, &attributes);
+		event.sysattrs.assign(attributes.begin(), attributes.end());
+	}
+
+	CaptureUevent(&event);
+}
+
+// `GetProperties` for a captured uevent
+static void GetCapturedProperties(CapturedUevent_t* event, ListResultItem_t* item) {
+	for(UeventValues_t::iterator it = event->properties.begin(); it != event->properties.end(); ++it) {
+		ApplyProperty(item, it->first.c_str(), it->second.c_str(), true);
+	}
+	item->deviceClass = ParseHex(GetUeventValue(event->sysattrs, DEVICE_SYSATTR_CLASS));
+	item->deviceSubClass = ParseHex(GetUeventValue(event->sysattrs, DEVICE_SYSATTR_SUB_CLASS));
+	item->deviceProtocol = ParseHex(GetUeventValue(event->sysattrs, DEVICE_SYSATTR_PROTOCOL));
+	ParseInterfaces(GetUeventValue(event->properties, DEVICE_PROPERTY_INTERFACES), item);
+	item->vendorId = ParseHex(GetUeventValue(event->sysattrs, "idVendor"));
+	item->productId = ParseHex(GetUeventValue(event->sysattrs, "idProduct"));
+	item->deviceAddress = 0;
+	item->locationId = 0;
+	item->portPath = event->sysName;
+}
+
+static void ReplayUevent(CapturedUevent_t* event) {
+	const char* devNode = event->devNode.c_str();
+
+	if(event->flags & UEVENT_FLAG_INTERFACE) {
+		if(isReadyTracking) {
+			HandleInterfaceBinding(event->parentDevNode.empty() ? NULL : event->parentDevNode.c_str(), event->sysName, event->action);
+		}
+	}
+	else if(event->flags & UEVENT_FLAG_CHILD) {
+		HandleChildDevice(devNode, event->parentDevNode.empty() ? NULL : event->parentDevNode.c_str(), event->action);
+	}
+	else if(event->action == UeventAction_Add) {
+		WaitForDeviceHandled();
+		DeviceItem_t* item = new DeviceItem_t();
+		GetCapturedProperties(event, &item->deviceParams);
+		item->attributes.insert(event->sysattrs.begin(), event->sysattrs.end());
+		HandleDeviceAdded(devNode, item);
+	}
+	else if(event->action == UeventAction_Remove) {
+		WaitForDeviceHandled();
+		ListResultItem_t* item = TakeStoredItem(devNode);
+		if(item == NULL) {
+			item = AcquireListResultItem();
+			GetCapturedProperties(event, item);
+		}
+		HandleDeviceRemoved(devNode, item);
+	}
+	else {
+		DeviceAttributes_t attributes(event->sysattrs.begin(), event->sysattrs.end());
+		HandleDeviceChanged(devNode, attributes);
+	}
+}
+
+/*
+ * The monitor loop of a replay. The pace restarts after a pause rather
+ * than catching up in a burst, at the end of the capture we idle like a
+ * quiet monitor until stopped.
+ */
+static void ReplayUevents() {
+	uint64_t previousNs = uv_hrtime();
+	while(isRunning && !isPaused) {
+		if(isReadyTracking) {
+			CheckReadyDeadlines();
+		}
+		CheckListFlush();
+
+		if(!hasReplayEvent) {
+			if(isReplayDone || !ReadReplayUevent(&replayEvent)) {
+				isReplayDone = true;
+				usleep(REPLAY_WAIT_SLICE_NS / 1000);
+				continue;
+			}
+			hasReplayEvent = true;
+		}
+
+		uint64_t dueNs = previousNs + (isReplayPaced ? replayEvent.delayUs * 1000 : 0);
+		uint64_t now = uv_hrtime();
+		if(now < dueNs) {
+			usleep((useconds_t) (min(dueNs - now, REPLAY_WAIT_SLICE_NS) / 1000));
+			continue;
+		}
+
+		previousNs = isReplayPaced ? dueNs : now;
+		hasReplayEvent = false;
+		ReplayUevent(&replayEvent);
+	}
+}
+
+/*
+ * Keeps the snapshot file and the shared list up to date, at most every
+ * `LIST_FLUSH_DELAY_NS` or `LIST_FLUSH_MAX_CHANGES`. Both copy the whole
+ * list, doing that for every uevent of a plug storm adds up quickly.
+ */
+static void MarkListChanged() {
+	if(listChanges++ == 0) {
+		listChangedAt = uv_hrtime();
+	}
+	if(listChanges >= LIST_FLUSH_MAX_CHANGES) {
+		FlushListChanges();
+	}
+}
+
+static void CheckListFlush() {
+	if(listChanges > 0 && uv_hrtime() - listChangedAt >= LIST_FLUSH_DELAY_NS) {
+		FlushListChanges();
+	}
+}
+
+static void FlushListChanges() {
+	if(listChanges == 0) {
+		return;
+	}
+	listChanges = 0;
+
+	if(snapshotPath != NULL) {
+		WriteSnapshot(snapshotPath);
+	}
+	SharedRegistryPublishList();
+}
+
+static bool OpenMonitor() {
+	if(fd >= 0) {
+		return true;
+	}
+
+	const char* monitorName = getenv(MONITOR_ENV);
+	if(monitorName != NULL && strcmp(monitorName, MONITOR_INOTIFY) == 0) {
+		return OpenInotifyMonitor();
+	}
+
+	/* Set up a monitor to monitor devices */
+	mon = udev_monitor_new_from_netlink(udev, "udev");
+	if(mon == NULL) {
+		// No netlink in this sandbox, device nodes still come and go
+		return OpenInotifyMonitor();
+	}
+	udev_monitor_set_receive_buffer_size(mon, MONITOR_RECEIVE_BUFFER_SIZE);
+	udev_monitor_enable_receiving(mon);
+
+	/* Get the file descriptor (fd) for the monitor.
+	   This fd will get passed to select() */
+	fd = udev_monitor_get_fd(mon);
+	// Some sandboxes let it open but never deliver anything
+	OpenCanary();
+
+	return true;
+}
+
+static void CloseMonitor() {
+	if(isInotifyMonitor) {
+		close(fd);
+		busWatches.clear();
+		isInotifyMonitor = false;
+	}
+	if(mon != NULL) {
+		udev_monitor_unref(mon);
+		mon = NULL;
+	}
+	fd = -1;
+	CloseCanary();
+	pendingReady.clear();
+}
+
+// Throw away whatever uevents are queued, we are about to enumerate anyway
+static void DrainMonitor() {
+	if(fd < 0) {
+		return;
+	}
+
+	pollfd fds = {fd, POLLIN, 0};
+	while(poll(&fds, 1, 0) > 0) {
+		if(isInotifyMonitor) {
+			char buffer[INOTIFY_BUFFER_SIZE];
+			if(read(fd, buffer, sizeof(buffer)) <= 0) {
+				break;
+			}
+			continue;
+		}
+
+		struct udev_device* queued = udev_monitor_receive_device(mon);
+		if(queued != NULL) {
+			CloseCanary();
+			udev_device_unref(queued);
+		}
+	}
+
+	// Node changes from before the enumeration say nothing about the monitor
+	if(canaryFd >= 0) {
+		char buffer[INOTIFY_BUFFER_SIZE];
+		while(read(canaryFd, buffer, sizeof(buffer)) > 0) {
+		}
+		canaryDeadline = 0;
+	}
+}
+
+/*
+ * inotify fallback. Only the node which changed is looked at: an added
+ * node is resolved to its udev device through its device number (sysfs
+ * and the udev database, no netlink needed), a removed one is looked up
+ * in the device list by its path, which is the key the device is stored
+ * under anyway. Child nodes and attribute changes are not followed.
+ */
+static void WatchBus(const string& busPath) {
+	int watch = inotify_add_watch(fd, busPath.c_str(), IN_CREATE | IN_DELETE);
+	if(watch >= 0) {
+		busWatches[watch] = busPath;
+	}
+}
+
+// Watching a directory twice just returns the same watch
+static void WatchBuses() {
+	DIR* root = opendir(USB_DEVICE_NODE_ROOT);
+	if(root == NULL) {
+		return;
+	}
+
+	struct dirent* entry;
+	while((entry = readdir(root)) != NULL) {
+		if(entry->d_name[0] != '.') {
+			WatchBus(string(USB_DEVICE_NODE_ROOT "/") + entry->d_name);
+		}
+	}
+	closedir(root);
+}
+
+static bool OpenInotifyMonitor() {
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(fd < 0) {
+		return false;
+	}
+	isInotifyMonitor = true;
+
+	// New buses (a controller showing up) get a directory here
+	if(inotify_add_watch(fd, USB_DEVICE_NODE_ROOT, IN_CREATE | IN_ONLYDIR) < 0) {
+		CloseMonitor();
+		return false;
+	}
+
+	WatchBuses();
+	return true;
+}
+
+static void InotifyNodeAdded(const string& devNode) {
+	// Already known, e.g. from the scan of a new bus racing its own events
+	if(IsItemAlreadyStored((char *)devNode.c_str())) {
+		return;
+	}
+
+	struct stat info;
+	if(stat(devNode.c_str(), &info) != 0 || !S_ISCHR(info.st_mode)) {
+		return;
+	}
+
+	struct udev_device* dev = udev_device_new_from_devnum(udev, 'c', info.st_rdev);
+	if(dev == NULL) {
+		return;
+	}
+	HandleUdevDevice(dev, UeventAction_Add);
+	udev_device_unref(dev);
+}
+
+static void InotifyNodeRemoved(const string& devNode) {
+	if(!IsItemAlreadyStored((char *)devNode.c_str())) {
+		return;
+	}
+
+	WaitForDeviceHandled();
+	ListResultItem_t* item = TakeStoredItem(devNode.c_str());
+	if(item == NULL) {
+		SignalDeviceHandled();
+		return;
+	}
+
+	if(isCapturing) {
+		CapturedUevent_t event;
+		event.action = UeventAction_Remove;
+		event.flags = 0;
+		event.devNode = devNode;
+		event.sysName = item->portPath;
+		CaptureUevent(&event);
+	}
+
+	HandleDeviceRemoved(devNode.c_str(), item);
+}
+
+static void InotifyBusAdded(const string& busPath) {
+	WatchBus(busPath);
+
+	// Devices may have been created before the watch was in place
+	DIR* bus = opendir(busPath.c_str());
+	if(bus == NULL) {
+		return;
+	}
+
+	struct dirent* entry;
+	while((entry = readdir(bus)) != NULL) {
+		if(entry->d_name[0] != '.') {
+			InotifyNodeAdded(busPath + "/" + entry->d_name);
+		}
+	}
+	closedir(bus);
+}
+
+static void HandleInotifyEvents() {
+	char buffer[INOTIFY_BUFFER_SIZE] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t length = read(fd, buffer, sizeof(buffer));
+	if(length <= 0) {
+		return;
+	}
+
+	for(char* next = buffer; next < buffer + length; next += sizeof(struct inotify_event) + ((struct inotify_event*) next)->len) {
+		struct inotify_event* event = (struct inotify_event*) next;
+
+		// Like ENOBUFS on the netlink socket, buses may be new as well
+		if(event->mask & IN_Q_OVERFLOW) {
+			ReconcileWithSystem();
+			WatchBuses();
+			return;
+		}
+		if(event->mask & IN_IGNORED) {
+			busWatches.erase(event->wd);
+			continue;
+		}
+		if(event->len == 0) {
+			continue;
+		}
+
+		map<int, string>::iterator bus = busWatches.find(event->wd);
+		if(bus == busWatches.end()) {
+			if(event->mask & IN_ISDIR) {
+				InotifyBusAdded(string(USB_DEVICE_NODE_ROOT "/") + event->name);
+			}
+			continue;
+		}
+
+		string devNode = bus->second + "/" + event->name;
+		if(event->mask & IN_CREATE) {
+			InotifyNodeAdded(devNode);
+		}
+		else if(event->mask & IN_DELETE) {
+			InotifyNodeRemoved(devNode);
+		}
+	}
+}
+
+/*
+ * Canary for a netlink monitor which opens but never receives anything.
+ * Only the node directories are watched and the events are only counted,
+ * it is closed for good with the first uevent.
+ */
+static void OpenCanary() {
+	canaryFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(canaryFd < 0) {
+		return;
+	}
+	canaryDeadline = 0;
+
+	DIR* root = opendir(USB_DEVICE_NODE_ROOT);
+	if(root == NULL || inotify_add_watch(canaryFd, USB_DEVICE_NODE_ROOT, IN_CREATE | IN_ONLYDIR) < 0) {
+		if(root != NULL) {
+			closedir(root);
+		}
+		CloseCanary();
+		return;
+	}
+
+	struct dirent* entry;
+	while((entry = readdir(root)) != NULL) {
+		if(entry->d_name[0] != '.') {
+			inotify_add_watch(canaryFd, (string(USB_DEVICE_NODE_ROOT "/") + entry->d_name).c_str(), IN_CREATE | IN_DELETE);
+		}
+	}
+	closedir(root);
+}
+
+static void CloseCanary() {
+	if(canaryFd >= 0) {
+		close(canaryFd);
+		canaryFd = -1;
+	}
+	canaryDeadline = 0;
+}
+
+static void HandleCanaryEvents() {
+	char buffer[INOTIFY_BUFFER_SIZE] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	bool hasChanged = false;
+	while(read(canaryFd, buffer, sizeof(buffer)) > 0) {
+		hasChanged = true;
+	}
+
+	if(hasChanged && canaryDeadline == 0) {
+		canaryDeadline = uv_hrtime() + NETLINK_SILENCE_TIMEOUT_NS;
+	}
+}
+
+// Returns true if it switched, `fd` is a different one then
+static bool CheckNetlinkSilence() {
+	if(canaryDeadline == 0 || uv_hrtime() < canaryDeadline) {
+		return false;
+	}
+
+	// Catch up on what the silent monitor did not tell us about
+	CloseMonitor();
+	OpenInotifyMonitor();
+	ReconcileWithSystem();
+	return true;
+}
+
+/*
+ * Catch up after uevents were lost: enumerate, and tell JS about what
+ * changed in the meantime. Runs on the monitor thread.
+ */
+static void ReconcileWithSystem() {
+	list<KeyedDeviceItem_t> items;
+	list<ListResultItem_t*> added;
+	list<ListResultItem_t*> removed;
+	list<string> addedKeys;
+	list<string> removedKeys;
+
+	uint64_t traceStart = TraceBegin();
+	DrainMonitor();
+	EnumerateDevices(udev, &items);
+	ReconcileList(&items, &added, &removed, &addedKeys, &removedKeys);
+	MarkListChanged();
+	TraceEnd("reconcile", traceStart);
+
+	PublishReconciled(&added, &removed, &addedKeys, &removedKeys);
+	// Rare, and consumers which fell behind the ring reload the list right away
+	FlushListChanges();
+	NotifyReconciled(&added, &removed);
+}
+
+/*
+ * Consumers only reload the list when they fall behind the ring, so what
+ * a producer's reconcile changed has to reach them as events like any
+ * uevent does. Does nothing unless we are the producer.
+ */
+static void PublishReconciled(list<ListResultItem_t*>* added, list<ListResultItem_t*>* removed, list<string>* addedKeys, list<string>* removedKeys) {
+	list<string>::iterator key = removedKeys->begin();
+	for(list<ListResultItem_t*>::iterator it = removed->begin(); it != removed->end(); ++it, ++key) {
+		SharedRegistryPublishEvent(key->c_str(), *it, false);
+	}
+	key = addedKeys->begin();
+	for(list<ListResultItem_t*>::iterator it = added->begin(); it != added->end(); ++it, ++key) {
+		SharedRegistryPublishEvent(key->c_str(), *it, true);
+	}
+}
+
+static void ReconcileWithShared() {
+	list<KeyedDeviceItem_t> items;
+	list<ListResultItem_t*> added;
+	list<ListResultItem_t*> removed;
+
+	DrainMonitor();
+	if(!SharedRegistryLoadList(&items, &sharedSeq)) {
+		LeaveSharedMode();
+		return;
+	}
+	ReconcileList(&items, &added, &removed);
+
+	NotifyReconciled(&added, &removed);
+}
+
+/*
+ * The producer's list no longer fits into the segment (or can't be read),
+ * so a consumer's `find` would miss devices. Monitor and enumerate
+ * ourselves from now on, the events still tell JS what changed in the
+ * meantime.
+ */
+static void LeaveSharedMode() {
+	SharedRegistryClose();
+	isShared = false;
+	isSharedConsumer = false;
+
+	OpenMonitor();
+	ReconcileWithSystem();
+}
+
+static void QueueWork() {
+	isWorking = true;
+	uv_queue_work(uv_default_loop(), &work_req, cbWork, cbAfter);
+}
+
+/*
+ * Same hand-over as `DeviceAdded`/`DeviceRemoved`, for events which did
+ * not come from our own udev monitor. Takes ownership of `item`.
+ */
+static void NotifyFromWorker(ListResultItem_t* item, int action) {
+	WaitForDeviceHandled();
+	currentItem = item;
+	currentAction = action;
+	WakeMainThread();
+}
+
+static void NotifyReconciled(list<ListResultItem_t*>* added, list<ListResultItem_t*>* removed) {
+	for(list<ListResultItem_t*>::iterator it = removed->begin(); it != removed->end(); ++it) {
+		NotifyFromWorker(*it, MonitorAction_Removed);
+	}
+	for(list<ListResultItem_t*>::iterator it = added->begin(); it != added->end(); ++it) {
+		// Not seen coming, so its drivers had all the time they needed
+		ListResultItem_t* ready = isReadyTracking ? CopyElement(*it) : NULL;
+		NotifyFromWorker(*it, MonitorAction_Added);
+		if(ready != NULL) {
+			NotifyFromWorker(ready, MonitorAction_Ready);
+		}
+	}
+}
+
+static void ApplySharedEvent(SharedEvent_t* event) {
+	char* key = (char *)event->key.c_str();
+
+	// The list we loaded may already contain this event
+	if(event->isAdded && !IsItemAlreadyStored(key)) {
+		DeviceItem_t* item = new DeviceItem_t();
+		item->deviceParams = event->item;
+		item->deviceState = DeviceState_Connect;
+		ListResultItem_t* copy = AddItemToListAndCopy(key, item);
+		MarkListChanged();
+
+		// The producer sees the binds, we don't
+		ListResultItem_t* ready = isReadyTracking ? CopyElement(copy) : NULL;
+		NotifyFromWorker(copy, MonitorAction_Added);
+		if(ready != NULL) {
+			NotifyFromWorker(ready, MonitorAction_Ready);
+		}
+	}
+	else if(!event->isAdded) {
+		ListResultItem_t* copy = TakeItemFromList(key);
+		if(copy != NULL) {
+			MarkListChanged();
+			NotifyFromWorker(copy, MonitorAction_Removed);
+		}
+	}
+}
+
+static void ConsumeSharedEvents() {
+	isSharedConsumer = true;
+
+	int timeouts = 0;
+	while(isRunning && !isPaused && isShared) {
+		CheckListFlush();
+
+		list<SharedEvent_t> events;
+		SharedWaitResult_t result = SharedRegistryWaitForEvents(&sharedSeq, &events, SHARED_WAIT_TIMEOUT);
+
+		if(result == SharedWait_Timeout) {
+			// The kernel drops the producer's lock when it dies
+			if(++timeouts % SHARED_FAILOVER_INTERVAL == 0 && SharedRegistryTryBecomeProducer()) {
+				return;
+			}
+			continue;
+		}
+
+		if(result == SharedWait_Overrun) {
+			ReconcileWithShared();
+			continue;
+		}
+
+		for(list<SharedEvent_t>::iterator it = events.begin(); it != events.end(); ++it) {
+			ApplySharedEvent(&*it);
+		}
+	}
+}
+
+/*
+ * Called on the monitor thread once we hold the producer lock. A former
+ * consumer may have missed events during the hand-over, so it enumerates
+ * for real before publishing.
+ */
+static void PublishAsProducer() {
+	OpenMonitor();
+
+	if(isSharedConsumer || needsReconcile) {
+		isSharedConsumer = false;
+		ReconcileWithSystem();
+	}
+
+	// Right away rather than batched, processes starting now load it
+	SharedRegistryPublishList();
+}
+
+/*
+ * Runs on a pool thread while the monitor thread keeps changing the list,
+ * `ValidateList` sorts out who knows better under the list lock.
+ */
+static void cbValidateWork(uv_work_t *req) {
+	list<KeyedDeviceItem_t> items;
+	// libudev contexts must not be shared across threads
+	struct udev* context = udev_new();
+	bool isEnumerated = context != NULL && EnumerateDevices(context, &items);
+	if(context != NULL) {
+		udev_unref(context);
+	}
+
+	// Could not enumerate, keep what the snapshot says
+	if(!isEnumerated) {
+		for(list<KeyedDeviceItem_t>::iterator it = items.begin(); it != items.end(); ++it) {
+			delete it->second;
+		}
+		SetListProvisional(false);
+		return;
+	}
+
+	// No devices at all is an answer too, everything in the snapshot is gone
+	ValidateList(&items, &validatedAdded, &validatedRemoved);
+	WriteSnapshot(snapshotPath);
+}
+
+// Corrections for anything the snapshot got wrong
+static void cbValidateAfter(uv_work_t *req, int status) {
+	for(list<ListResultItem_t*>::iterator it = validatedRemoved.begin(); it != validatedRemoved.end(); ++it) {
+		NotifyRemoved(*it);
+		ReleaseListResultItem(*it);
+	}
+	for(list<ListResultItem_t*>::iterator it = validatedAdded.begin(); it != validatedAdded.end(); ++it) {
+		NotifyAdded(*it);
+		ReleaseListResultItem(*it);
+	}
+	validatedRemoved.clear();
+	validatedAdded.clear();
+}
+
+static void BuildInitialDeviceList() {
+	list<KeyedDeviceItem_t> items;
+	EnumerateDevices(udev, &items);
+
+	// One publish step, `find` never sees a half-built list
+	AddItemsToList(&items);
+}
+
+/*
+ * The bus a sysfs path belongs to, from its `/usbN/` component. Children
+ * (tty, block, ...) sit below their USB device, so they land on the same
+ * bus. Returns 0 if there is none.
+ */
+static int GetBusNumber(const char* path) {
+	const char* component = strstr(path, "/usb");
+	while(component != NULL) {
+		char* end;
+		long bus = strtol(component + 4, &end, 10);
+		if(end != component + 4 && (*end == '/' || *end == '\0')) {
+			return (int) bus;
+		}
+		component = strstr(component + 1, "/usb");
+	}
+
+	return 0;
+}
+
+/*
+ * Reads one enumerated device. Returns NULL for anything which is not a
+ * USB device, children are collected into `childDevNodes` instead.
+ */
+static DeviceItem_t* ReadEnumeratedDevice(struct udev_device* dev, list<ChildDevNode_t>* childDevNodes) {
+	/* usb_device_get_devnode() returns the path to the device node
+	   itself in /dev. */
+	if(udev_device_get_devnode(dev) == NULL) {
+		return NULL;
+	}
+
+	if(IsChildSubsystem(udev_device_get_subsystem(dev))) {
+		const char* parentDevNode = GetParentDevNode(dev);
+		if(parentDevNode != NULL) {
+			childDevNodes->push_back(ChildDevNode_t(parentDevNode, udev_device_get_devnode(dev)));
+		}
+		return NULL;
+	}
+
+	if(udev_device_get_sysattr_value(dev,"idVendor") == NULL) {
+		return NULL;
+	}
+
+	/* From here, we can call get_sysattr_value() for each file
+	   in the device's /sys entry. The strings passed into these
+	   functions (idProduct, idVendor, serial, etc.) correspond
+	   directly to the files in the /sys directory which
+	   represents the USB device. Note that USB strings are
+	   Unicode, UCS2 encoded, but the strings returned from
+	   udev_device_get_sysattr_value() are UTF-8 encoded. */
+
+	DeviceItem_t* item = new DeviceItem_t();
+	item->deviceParams.vendorId = strtol (udev_device_get_sysattr_value(dev,"idVendor"), NULL, 16);
+	item->deviceParams.productId = strtol (udev_device_get_sysattr_value(dev,"idProduct"), NULL, 16);
+	ReadStrings(dev, &item->deviceParams);
+	item->deviceParams.deviceAddress = 0;
+	item->deviceParams.locationId = 0;
+	// The sysname is the port chain, e.g. `1-4.2`
+	item->deviceParams.portPath = udev_device_get_sysname(dev);
+
+	item->deviceState = DeviceState_Connect;
+	ReadAttributes(dev, &item->attributes);
+	// The built-in fields come from the sysattrs above
+	ReadProperties(dev, &item->deviceParams, false);
+	ReadClasses(dev, &item->deviceParams);
+
+	return item;
+}
+
+typedef struct {
+	list<KeyedDeviceItem_t> items;
+	list<ChildDevNode_t> childDevNodes;
+} EnumeratedBus_t;
+
+typedef struct {
+	vector<vector<string> > paths;
+	vector<EnumeratedBus_t> results;
+	// libudev contexts must not be shared across threads, one per pool thread
+	vector<struct udev*> contexts;
+} Enumeration_t;
+
+static void EnumerateBus(size_t partition, int thread, void* arg) {
+	Enumeration_t* enumeration = static_cast<Enumeration_t*>(arg);
+	struct udev* context = enumeration->contexts[thread];
+	EnumeratedBus_t* result = &enumeration->results[partition];
+	if(context == NULL) {
+		return;
+	}
+
+	vector<string>& paths = enumeration->paths[partition];
+	for(vector<string>::iterator path = paths.begin(); path != paths.end(); ++path) {
+		struct udev_device* dev = udev_device_new_from_syspath(context, path->c_str());
+		if(dev == NULL) {
+			continue;
+		}
+
+		DeviceItem_t* item = ReadEnumeratedDevice(dev, &result->childDevNodes);
+		if(item != NULL) {
+			result->items.push_back(KeyedDeviceItem_t(udev_device_get_devnode(dev), item));
+		}
+		udev_device_unref(dev);
+	}
+}
+
+/*
+ * Listing the sysfs paths is cheap, reading the devices is not. So we list
+ * them with `context`, split them up by bus and read the buses on a small
+ * pool of threads.
+ *
+ * False if the devices could not be listed or a bus could not be read,
+ * `items` may be incomplete then. True with no items is a host without
+ * USB devices.
+ */
+static bool EnumerateDevices(struct udev* context, list<KeyedDeviceItem_t>* items) {
+	struct udev_enumerate* enumerate;
+	struct udev_list_entry* devices;
+	struct udev_list_entry* dev_list_entry;
+
+	/* Create a list of the devices */
+	enumerate = udev_enumerate_new(context);
+	if(enumerate == NULL) {
+		return false;
+	}
+	udev_enumerate_add_match_subsystem(enumerate, DEVICE_SUBSYSTEM_USB);
+	for(int i = 0; childSubsystems[i] != NULL; i++) {
+		udev_enumerate_add_match_subsystem(enumerate, childSubsystems[i]);
+	}
+	if(udev_enumerate_scan_devices(enumerate) < 0) {
+		udev_enumerate_unref(enumerate);
+		return false;
+	}
+	devices = udev_enumerate_get_list_entry(enumerate);
+
+	map<int, vector<string> > pathsByBus;
+	udev_list_entry_foreach(dev_list_entry, devices) {
+		const char* path = udev_list_entry_get_name(dev_list_entry);
+		pathsByBus[GetBusNumber(path)].push_back(path);
+	}
+	/* Free the enumerator object */
+	udev_enumerate_unref(enumerate);
+
+	Enumeration_t enumeration;
+	for(map<int, vector<string> >::iterator bus = pathsByBus.begin(); bus != pathsByBus.end(); ++bus) {
+		enumeration.paths.push_back(vector<string>());
+		enumeration.paths.back().swap(bus->second);
+	}
+	enumeration.results.resize(enumeration.paths.size());
+
+	int threads = GetPartitionThreads(enumeration.paths.size());
+	enumeration.contexts.push_back(context);
+	for(int i = 1; i < threads; i++) {
+		enumeration.contexts.push_back(udev_new());
+	}
+
+	RunPartitions(enumeration.paths.size(), threads, EnumerateBus, &enumeration);
+
+	// `EnumerateBus` skips the buses of a thread without a context
+	bool isComplete = true;
+	for(int i = 1; i < threads; i++) {
+		if(enumeration.contexts[i] != NULL) {
+			udev_unref(enumeration.contexts[i]);
+		}
+		else {
+			isComplete = false;
+		}
+	}
+
+	// Children can be enumerated before their parent, attach them at the end
+	map<string, DeviceItem_t*> itemsByDevNode;
+	for(vector<EnumeratedBus_t>::iterator bus = enumeration.results.begin(); bus != enumeration.results.end(); ++bus) {
+		for(list<KeyedDeviceItem_t>::iterator it = bus->items.begin(); it != bus->items.end(); ++it) {
+			itemsByDevNode[it->first] = it->second;
+		}
+		items->splice(items->end(), bus->items);
+	}
+	for(vector<EnumeratedBus_t>::iterator bus = enumeration.results.begin(); bus != enumeration.results.end(); ++bus) {
+		for(list<ChildDevNode_t>::iterator it = bus->childDevNodes.begin(); it != bus->childDevNodes.end(); ++it) {
+			map<string, DeviceItem_t*>::iterator parent = itemsByDevNode.find(it->first);
+			if(parent != itemsByDevNode.end()) {
+				parent->second->deviceParams.childDevNodes.push_back(it->second);
+			}
+		}
+	}
+
+	return isComplete;
 }
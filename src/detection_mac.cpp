@@ -47,6 +47,8 @@ static uv_cond_t notifyDeviceHandled;
 static bool deviceHandled = true;
 
 static bool isRunning = false;
+// IOKit only reports a device once it is matched, `ready` follows `add` right away
+static bool isReadyTracking = false;
 
 /**********************************
  * Local Helper Functions protoypes
@@ -92,7 +94,7 @@ static void DeviceRemoved(void *refCon, io_service_t service, natural_t messageT
 			delete deviceItem;
 		}
 		else {
-			item = new ListResultItem_t();
+			item = AcquireListResultItem();
 		}
 
 		WaitForDeviceHandled();
@@ -271,6 +273,20 @@ static void DeviceAdded(void *refCon, io_iterator_t iterator) {
 		}
 		deviceItem->deviceParams.productId = productId;
 
+		// Interface classes would need the interfaces opened, only the device descriptor is reported
+		UInt8 deviceClass;
+		UInt8 deviceSubClass;
+		UInt8 deviceProtocol;
+		if((*deviceListItem->deviceInterface)->GetDeviceClass(deviceListItem->deviceInterface, &deviceClass) == KERN_SUCCESS) {
+			deviceItem->deviceParams.deviceClass = deviceClass;
+		}
+		if((*deviceListItem->deviceInterface)->GetDeviceSubClass(deviceListItem->deviceInterface, &deviceSubClass) == KERN_SUCCESS) {
+			deviceItem->deviceParams.deviceSubClass = deviceSubClass;
+		}
+		if((*deviceListItem->deviceInterface)->GetDeviceProtocol(deviceListItem->deviceInterface, &deviceProtocol) == KERN_SUCCESS) {
+			deviceItem->deviceParams.deviceProtocol = deviceProtocol;
+		}
+
 
 		// Extract path name as unique key
 		io_string_t pathName;
@@ -357,6 +373,20 @@ void Stop() {
 	}
 }
 
+/*
+ * IOKit keeps delivering to our run loop, `detection.cpp` holds the
+ * notifications back until `Resume`.
+ */
+void Pause() {
+}
+
+void Resume() {
+}
+
+void SetReadyTracking(bool enabled, int settleTimeoutMs) {
+	isReadyTracking = enabled;
+}
+
 void InitDetection() {
 	kern_return_t kr;
 
@@ -403,7 +433,7 @@ void InitDetection() {
 void EIO_Find(uv_work_t* req) {
 	ListBaton* data = static_cast<ListBaton*>(req->data);
 
-	CreateFilteredList(&data->results, data->vid, data->pid);
+	CreateFilteredList(&data->results, data->vid, data->pid, data->fields, data->classMatch);
 }
 
 static void WaitForDeviceHandled() {
@@ -463,6 +493,9 @@ static void cbAsync(uv_async_t *handle) {
 
 	if(isAdded) {
 		NotifyAdded(currentItem);
+		if(isReadyTracking) {
+			NotifyReady(currentItem);
+		}
 	}
 	else {
 		NotifyRemoved(currentItem);
@@ -470,7 +503,7 @@ static void cbAsync(uv_async_t *handle) {
 
 	// Delete Item in case of removal
 	if(isAdded == false) {
-		delete currentItem;
+		ReleaseListResultItem(currentItem);
 	}
 
 	SignalDeviceHandled();
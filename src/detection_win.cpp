@@ -70,6 +70,8 @@ uv_signal_t int_signal;
 ListResultItem_t* currentDevice;
 bool isAdded;
 bool isRunning = false;
+// The arrival is only broadcast once the device is installed, `ready` follows `add` right away
+bool isReadyTracking = false;
 
 HINSTANCE hinstLib;
 
@@ -129,6 +131,9 @@ void cbAfter(uv_work_t* req) {
 
 	if(isAdded) {
 		NotifyAdded(currentDevice);
+		if(isReadyTracking) {
+			NotifyReady(currentDevice);
+		}
 	}
 	else {
 		NotifyRemoved(currentDevice);
@@ -136,7 +141,7 @@ void cbAfter(uv_work_t* req) {
 
 	// Delete Item in case of removal
 	if(!isAdded) {
-		delete currentDevice;
+		ReleaseListResultItem(currentDevice);
 	}
 
 	SetEvent(deviceChangedSentEvent);
@@ -222,6 +227,20 @@ void Stop() {
 	SetEvent(deviceChangedRegisteredEvent);
 }
 
+/*
+ * The listener thread keeps the device list current, `detection.cpp`
+ * holds the notifications back until `Resume`.
+ */
+void Pause() {
+}
+
+void Resume() {
+}
+
+void SetReadyTracking(bool enabled, int settleTimeoutMs) {
+	isReadyTracking = enabled;
+}
+
 void InitDetection() {
 	LoadFunctions();
 
@@ -246,7 +265,7 @@ void EIO_Find(uv_work_t* req) {
 
 	ListBaton* data = static_cast<ListBaton*>(req->data);
 
-	CreateFilteredList(&data->results, data->vid, data->pid);
+	CreateFilteredList(&data->results, data->vid, data->pid, data->fields, data->classMatch);
 }
 
 
@@ -532,7 +551,7 @@ void UpdateDevice(PDEV_BROADCAST_DEVICEINTERFACE pDevInf, WPARAM wParam, DeviceS
 					}
 
 					if (item == NULL) {
-						item = new ListResultItem_t();
+						item = AcquireListResultItem();
 						ExtractDeviceInfo(hDevInfo, pspDevInfoData, buf, MAX_PATH, item);
 					}
 					currentDevice = item;
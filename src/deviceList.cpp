@@ -1,75 +1,985 @@
 #include <map>
+#include <set>
+#include <algorithm>
 #include <string.h>
 #include <stdio.h>
+#include <uv.h>
 
 #include "deviceList.h"
+#include "deviceStore.h"
+#include "objectPool.h"
 
 
 using namespace std;
 
-map<string, DeviceItem_t*> deviceMap;
+DeviceStore deviceStore;
+// Child device node (tty, hidraw, ...) -> key of the device it belongs to
+map<string, string> childDevNodeMap;
 
-void AddItemToList(char* key, DeviceItem_t * item) {
+/*
+ * Hub/port topology keyed by port path ("usb1" for a root hub, "1-4" for
+ * port 4 of bus 1, "1-4.2" for port 2 of the hub behind it, ...).
+ * Ports without a known device are kept as placeholders as long as
+ * something is plugged in below them.
+ */
+typedef struct {
+	DeviceItem_t* item;
+	set<string> children;
+} TopologyNode_t;
+
+map<string, TopologyNode_t> topologyMap;
+
+/*
+ * Devices by `bDeviceClass` and by the class of each of their interfaces,
+ * kept in key order so class filtered results come out in a stable order.
+ */
+typedef map<string, DeviceItem_t*> DeviceBucket_t;
+map<int, DeviceBucket_t> deviceClassIndex;
+map<int, DeviceBucket_t> interfaceClassIndex;
+
+// Devices by serial number, sorted so a prefix is one contiguous range
+map<string, DeviceBucket_t> serialIndex;
+
+// Topology digests of everything, per vendor and per vendor/product
+static TopologyDigest_t topologyDigest;
+map<int, TopologyDigest_t> vendorDigests;
+map<pair<int, int>, TopologyDigest_t> productDigests;
+
+// Set while the list was loaded from a snapshot and is not validated yet
+static bool isProvisional = false;
+// Keys touched since, the validation knows less about those than the list
+static set<string> provisionalChanges;
+
+/*
+ * One-shot waiters, bucketed by "vid:pid:serial" with 0/"" as wildcards,
+ * so an added device only has to look at the 8 buckets it could match.
+ */
+map<string, set<int> > waiterBuckets;
+map<int, string> waiterBucketById;
+static WaiterResolvedCallback_t waiterResolvedCallback = NULL;
+
+// The list is written from the monitor thread and read from the threadpool (`find`)
+static uv_once_t deviceListOnce = UV_ONCE_INIT;
+static uv_mutex_t deviceListMutex;
+
+static void InitDeviceListMutex() {
+	uv_mutex_init(&deviceListMutex);
+}
+
+static void LockDeviceList() {
+	uv_once(&deviceListOnce, InitDeviceListMutex);
+	uv_mutex_lock(&deviceListMutex);
+}
+
+static void UnlockDeviceList() {
+	uv_mutex_unlock(&deviceListMutex);
+}
+
+static string GetParentPortPath(const string& portPath) {
+	size_t separator = portPath.rfind('.');
+	if(separator != string::npos) {
+		return portPath.substr(0, separator);
+	}
+
+	// Ports of a root hub hang off "usb<bus>"
+	separator = portPath.find('-');
+	if(separator != string::npos) {
+		return "usb" + portPath.substr(0, separator);
+	}
+
+	return "";
+}
+
+static void AddToTopology(DeviceItem_t* item) {
+	string portPath = item->deviceParams.portPath;
+	if(portPath.empty()) {
+		return;
+	}
+
+	topologyMap[portPath].item = item;
+
+	// Link the chain up to the root, stop as soon as we hit a known port
+	string parentPortPath = GetParentPortPath(portPath);
+	while(!parentPortPath.empty()) {
+		bool isKnown = topologyMap.find(parentPortPath) != topologyMap.end();
+		topologyMap[parentPortPath].children.insert(portPath);
+		if(isKnown) {
+			break;
+		}
+
+		portPath = parentPortPath;
+		parentPortPath = GetParentPortPath(portPath);
+	}
+}
+
+static void RemoveFromTopology(DeviceItem_t* item) {
+	string portPath = item->deviceParams.portPath;
+	map<string, TopologyNode_t>::iterator node = topologyMap.find(portPath);
+	if(portPath.empty() || node == topologyMap.end() || node->second.item != item) {
+		return;
+	}
+
+	node->second.item = NULL;
+
+	// Prune placeholders which have nothing left below them
+	while(node != topologyMap.end() && node->second.item == NULL && node->second.children.empty()) {
+		topologyMap.erase(node);
+
+		string parentPortPath = GetParentPortPath(portPath);
+		node = topologyMap.find(parentPortPath);
+		if(node != topologyMap.end()) {
+			node->second.children.erase(portPath);
+		}
+		portPath = parentPortPath;
+	}
+}
+
+static void AddToClassIndex(DeviceItem_t* item) {
+	ListResultItem_t* params = &item->deviceParams;
+	deviceClassIndex[params->deviceClass][item->GetKey()] = item;
+	for(vector<UsbInterfaceClass_t>::iterator it = params->interfaces.begin(); it != params->interfaces.end(); ++it) {
+		interfaceClassIndex[it->interfaceClass][item->GetKey()] = item;
+	}
+}
+
+static void RemoveFromClassBucket(map<int, DeviceBucket_t>* index, int classCode, DeviceItem_t* item) {
+	map<int, DeviceBucket_t>::iterator bucket = index->find(classCode);
+	if(bucket == index->end()) {
+		return;
+	}
+
+	DeviceBucket_t::iterator entry = bucket->second.find(item->GetKey());
+	if(entry != bucket->second.end() && entry->second == item) {
+		bucket->second.erase(entry);
+	}
+	if(bucket->second.empty()) {
+		index->erase(bucket);
+	}
+}
+
+static void RemoveFromClassIndex(DeviceItem_t* item) {
+	ListResultItem_t* params = &item->deviceParams;
+	RemoveFromClassBucket(&deviceClassIndex, params->deviceClass, item);
+	for(vector<UsbInterfaceClass_t>::iterator it = params->interfaces.begin(); it != params->interfaces.end(); ++it) {
+		RemoveFromClassBucket(&interfaceClassIndex, it->interfaceClass, item);
+	}
+}
+
+static void AddToSerialIndex(DeviceItem_t* item) {
+	if(!item->deviceParams.serialNumber.empty()) {
+		serialIndex[item->deviceParams.serialNumber][item->GetKey()] = item;
+	}
+}
+
+static void RemoveFromSerialIndex(DeviceItem_t* item) {
+	map<string, DeviceBucket_t>::iterator bucket = serialIndex.find(item->deviceParams.serialNumber);
+	if(bucket == serialIndex.end()) {
+		return;
+	}
+
+	DeviceBucket_t::iterator entry = bucket->second.find(item->GetKey());
+	if(entry != bucket->second.end() && entry->second == item) {
+		bucket->second.erase(entry);
+	}
+	if(bucket->second.empty()) {
+		serialIndex.erase(bucket);
+	}
+}
+
+static void HashBytes(uint64_t* hash, const void* data, size_t length) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for(size_t i = 0; i < length; i++) {
+		*hash ^= bytes[i];
+		*hash *= 1099511628211ULL;
+	}
+}
+
+static void HashInt(uint64_t* hash, int32_t value) {
+	HashBytes(hash, &value, sizeof(value));
+}
+
+// Length prefixed, so "ab" + "c" and "a" + "bc" differ
+static void HashString(uint64_t* hash, const string& value) {
+	HashInt(hash, (int32_t) value.size());
+	HashBytes(hash, value.data(), value.size());
+}
+
+// splitmix64 finalizer, spreads the FNV state over all bits before summing
+static uint64_t MixHash(uint64_t hash) {
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+	return hash ^ (hash >> 31);
+}
+
+/*
+ * Only what describes the device and where it is plugged in. Keys, device
+ * addresses and child nodes depend on enumeration order and would differ
+ * between two hosts with the same setup.
+ */
+static void HashDevice(DeviceItem_t* item) {
+	ListResultItem_t* params = &item->deviceParams;
+	// FNV-1a with two different offset bases
+	uint64_t lanes[2] = { 14695981039346656037ULL, 0x6c62272e07bb0142ULL };
+	for(int lane = 0; lane < 2; lane++) {
+		uint64_t* hash = &lanes[lane];
+		HashInt(hash, params->vendorId);
+		HashInt(hash, params->productId);
+		HashString(hash, params->deviceName);
+		HashString(hash, params->manufacturer);
+		HashString(hash, params->serialNumber);
+		HashString(hash, params->portPath);
+		HashInt(hash, params->deviceClass);
+		HashInt(hash, params->deviceSubClass);
+		HashInt(hash, params->deviceProtocol);
+		for(vector<UsbInterfaceClass_t>::iterator it = params->interfaces.begin(); it != params->interfaces.end(); ++it) {
+			HashInt(hash, it->interfaceClass);
+			HashInt(hash, it->interfaceSubClass);
+			HashInt(hash, it->interfaceProtocol);
+		}
+		item->topologyHash[lane] = MixHash(*hash);
+	}
+}
+
+static void AddToDigest(TopologyDigest_t* digest, DeviceItem_t* item) {
+	digest->hash[0] += item->topologyHash[0];
+	digest->hash[1] += item->topologyHash[1];
+	digest->count++;
+}
+
+static void RemoveFromDigest(TopologyDigest_t* digest, DeviceItem_t* item) {
+	digest->hash[0] -= item->topologyHash[0];
+	digest->hash[1] -= item->topologyHash[1];
+	digest->count--;
+}
+
+static void AddToDigests(DeviceItem_t* item) {
+	HashDevice(item);
+	AddToDigest(&topologyDigest, item);
+	AddToDigest(&vendorDigests[item->deviceParams.vendorId], item);
+	AddToDigest(&productDigests[make_pair(item->deviceParams.vendorId, item->deviceParams.productId)], item);
+}
+
+static void RemoveFromDigests(DeviceItem_t* item) {
+	RemoveFromDigest(&topologyDigest, item);
+
+	map<int, TopologyDigest_t>::iterator vendor = vendorDigests.find(item->deviceParams.vendorId);
+	if(vendor != vendorDigests.end()) {
+		RemoveFromDigest(&vendor->second, item);
+		if(vendor->second.count == 0) {
+			vendorDigests.erase(vendor);
+		}
+	}
+
+	map<pair<int, int>, TopologyDigest_t>::iterator product = productDigests.find(make_pair(item->deviceParams.vendorId, item->deviceParams.productId));
+	if(product != productDigests.end()) {
+		RemoveFromDigest(&product->second, item);
+		if(product->second.count == 0) {
+			productDigests.erase(product);
+		}
+	}
+}
+
+static string GetWaiterBucket(int vid, int pid, const string& serialNumber) {
+	char ids[32];
+	snprintf(ids, sizeof(ids), "%x:%x:", vid, pid);
+
+	return ids + serialNumber;
+}
+
+static bool MatchesDevice(const DeviceMatch_t& match, ListResultItem_t* item) {
+	return (
+		(match.vid == 0 || match.vid == item->vendorId) &&
+		(match.pid == 0 || match.pid == item->productId) &&
+		(match.serialNumber.empty() || match.serialNumber == item->serialNumber)
+	);
+}
+
+static void ResolveWaiters(ListResultItem_t* item) {
+	if(waiterBuckets.empty()) {
+		return;
+	}
+
+	for(int i = 0; i < 8; i++) {
+		string bucket = GetWaiterBucket(
+			(i & 1) ? item->vendorId : 0,
+			(i & 2) ? item->productId : 0,
+			(i & 4) ? item->serialNumber : string()
+		);
+
+		map<string, set<int> >::iterator it = waiterBuckets.find(bucket);
+		if(it == waiterBuckets.end()) {
+			continue;
+		}
+
+		for(set<int>::iterator id = it->second.begin(); id != it->second.end(); ++id) {
+			waiterBucketById.erase(*id);
+			if(waiterResolvedCallback != NULL) {
+				waiterResolvedCallback(*id, CopyElement(item));
+			}
+		}
+		waiterBuckets.erase(it);
+	}
+}
+
+static void MarkChangedLocked(const char* key) {
+	if(isProvisional) {
+		provisionalChanges.insert(key);
+	}
+}
+
+static void AddItemLocked(char* key, DeviceItem_t* item) {
 	item->SetKey(key);
-	deviceMap.insert(pair<string, DeviceItem_t*>(item->GetKey(), item));
+	deviceStore.Insert(item);
+	MarkChangedLocked(key);
+
+	// Items can come in with their children already attached (enumeration, snapshot)
+	vector<string>& children = item->deviceParams.childDevNodes;
+	for (vector<string>::iterator it = children.begin(); it != children.end(); ++it) {
+		childDevNodeMap[*it] = item->GetKey();
+	}
+	AddToTopology(item);
+	AddToClassIndex(item);
+	AddToSerialIndex(item);
+	AddToDigests(item);
+	ResolveWaiters(&item->deviceParams);
 }
 
-void RemoveItemFromList(DeviceItem_t* item) {
-	deviceMap.erase(item->GetKey());
+static void RemoveItemLocked(DeviceItem_t* item) {
+	// Otherwise the digests would lose a device they never had
+	if(!deviceStore.Remove(item)) {
+		return;
+	}
+	MarkChangedLocked(item->GetKey());
+
+	vector<string>& children = item->deviceParams.childDevNodes;
+	for (vector<string>::iterator it = children.begin(); it != children.end(); ++it) {
+		childDevNodeMap.erase(*it);
+	}
+	RemoveFromTopology(item);
+	RemoveFromClassIndex(item);
+	RemoveFromSerialIndex(item);
+	RemoveFromDigests(item);
 }
 
-DeviceItem_t* GetItemFromList(char* key) {
-	map<string, DeviceItem_t*>::iterator it;
+void AddItemToList(char* key, DeviceItem_t * item) {
+	LockDeviceList();
+	AddItemLocked(key, item);
+	UnlockDeviceList();
+}
 
-	it = deviceMap.find(key);
-	if(it == deviceMap.end()) {
-		return NULL;
+ListResultItem_t* AddItemToListAndCopy(char* key, DeviceItem_t* item) {
+	LockDeviceList();
+	// E.g. a reconcile which saw the device before its uevent did
+	DeviceItem_t* stale = deviceStore.Find(key);
+	if(stale != NULL) {
+		RemoveItemLocked(stale);
+		delete stale;
 	}
-	else {
-		return it->second;
+
+	AddItemLocked(key, item);
+	ListResultItem_t* copy = CopyElement(&item->deviceParams);
+	UnlockDeviceList();
+
+	return copy;
+}
+
+void AddItemsToList(list<KeyedDeviceItem_t>* items) {
+	LockDeviceList();
+	for (list<KeyedDeviceItem_t>::iterator it = items->begin(); it != items->end(); ++it) {
+		AddItemLocked((char *)it->first.c_str(), it->second);
 	}
+	UnlockDeviceList();
+
+	items->clear();
+}
+
+void RemoveItemFromList(DeviceItem_t* item) {
+	LockDeviceList();
+	RemoveItemLocked(item);
+	UnlockDeviceList();
+}
+
+DeviceItem_t* GetItemFromList(char* key) {
+	LockDeviceList();
+	DeviceItem_t* item = deviceStore.Find(key);
+	UnlockDeviceList();
+
+	return item;
 }
 
 bool IsItemAlreadyStored(char* key) {
-	map<string, DeviceItem_t*>::iterator it;
+	return GetItemFromList(key) != NULL;
+}
 
-	it = deviceMap.find(key);
-	if(it == deviceMap.end()) {
-		return false;
+ListResultItem_t* CopyItemFromList(char* key) {
+	LockDeviceList();
+	DeviceItem_t* item = deviceStore.Find(key);
+	ListResultItem_t* copy = item != NULL ? CopyElement(&item->deviceParams) : NULL;
+	UnlockDeviceList();
+
+	return copy;
+}
+
+ListResultItem_t* TakeItemFromList(char* key) {
+	ListResultItem_t* copy = NULL;
+
+	LockDeviceList();
+	DeviceItem_t* item = deviceStore.Find(key);
+	if(item != NULL) {
+		copy = CopyElement(&item->deviceParams);
+		RemoveItemLocked(item);
+		delete item;
 	}
-	else {
-		return true;
+	UnlockDeviceList();
+
+	return copy;
+}
+
+/*
+ * Device records and the copies handed to JS are recycled, so steady-state
+ * `find` calls and events don't have to go through malloc for them.
+ */
+#define RESULT_ITEM_POOL_SIZE 1024
+#define DEVICE_ITEM_POOL_SIZE 1024
+
+static ObjectPool<ListResultItem_t>& GetResultItemPool() {
+	static ObjectPool<ListResultItem_t> pool(RESULT_ITEM_POOL_SIZE);
+	return pool;
+}
+
+static BlockPool<sizeof(DeviceItem_t)>& GetDeviceItemPool() {
+	static BlockPool<sizeof(DeviceItem_t)> pool(DEVICE_ITEM_POOL_SIZE);
+	return pool;
+}
+
+void* DeviceItem_t::operator new(size_t size) {
+	return GetDeviceItemPool().Allocate();
+}
+
+void DeviceItem_t::operator delete(void* block) {
+	GetDeviceItemPool().Free(block);
+}
+
+ListResultItem_t* AcquireListResultItem() {
+	return GetResultItemPool().Acquire();
+}
+
+void ReleaseListResultItem(ListResultItem_t* item) {
+	if(item == NULL) {
+		return;
 	}
 
-	return true;
+	// `clear` keeps the capacity for the next user
+	item->locationId = 0;
+	item->vendorId = 0;
+	item->productId = 0;
+	item->deviceAddress = 0;
+	item->deviceName.clear();
+	item->manufacturer.clear();
+	item->serialNumber.clear();
+	item->portPath.clear();
+	item->childDevNodes.clear();
+	item->properties.clear();
+	item->deviceClass = 0;
+	item->deviceSubClass = 0;
+	item->deviceProtocol = 0;
+	item->interfaces.clear();
+
+	GetResultItemPool().Release(item);
 }
 
-ListResultItem_t* CopyElement(ListResultItem_t* item) {
-    ListResultItem_t* dst = new ListResultItem_t();
+void CopyElementInto(ListResultItem_t* dst, ListResultItem_t* item, int fields) {
     dst->locationId     =   item->locationId;
     dst->vendorId       =   item->vendorId;
     dst->productId      =   item->productId;
-    dst->deviceName     =   item->deviceName;
-    dst->manufacturer   =   item->manufacturer;
-    dst->serialNumber   =   item->serialNumber;
     dst->deviceAddress  =   item->deviceAddress;
+    dst->deviceClass    =   item->deviceClass;
+    dst->deviceSubClass =   item->deviceSubClass;
+    dst->deviceProtocol =   item->deviceProtocol;
+
+    // Only the strings are worth skipping, `dst` may hold an older device
+    if(fields & DeviceField_DeviceName) {
+        dst->deviceName     =   item->deviceName;
+    }
+    else {
+        dst->deviceName.clear();
+    }
+    if(fields & DeviceField_Manufacturer) {
+        dst->manufacturer   =   item->manufacturer;
+    }
+    else {
+        dst->manufacturer.clear();
+    }
+    if(fields & DeviceField_SerialNumber) {
+        dst->serialNumber   =   item->serialNumber;
+    }
+    else {
+        dst->serialNumber.clear();
+    }
+    if(fields & DeviceField_PortPath) {
+        dst->portPath       =   item->portPath;
+    }
+    else {
+        dst->portPath.clear();
+    }
+    if(fields & DeviceField_ChildDevNodes) {
+        dst->childDevNodes  =   item->childDevNodes;
+    }
+    else {
+        dst->childDevNodes.clear();
+    }
+    if(fields & DeviceField_Properties) {
+        dst->properties     =   item->properties;
+    }
+    else {
+        dst->properties.clear();
+    }
+    if(fields & DeviceField_Interfaces) {
+        dst->interfaces     =   item->interfaces;
+    }
+    else {
+        dst->interfaces.clear();
+    }
+}
+
+ListResultItem_t* CopyElement(ListResultItem_t* item, int fields) {
+    ListResultItem_t* dst = AcquireListResultItem();
+    CopyElementInto(dst, item, fields);
 
     return dst;
 }
 
-void CreateFilteredList(list<ListResultItem_t*> *filteredList, int vid, int pid) {
-	map<string, DeviceItem_t*>::iterator it;
+void ClearResults(DeviceResults_t* results) {
+	results->count = 0;
+}
 
-	for (it = deviceMap.begin(); it != deviceMap.end(); ++it) {
-    	DeviceItem_t* item = it->second;
+ListResultItem_t* AppendResult(DeviceResults_t* results) {
+	if(results->count == results->items.size()) {
+		results->items.resize(results->count + 1);
+	}
 
-        if (
-        	((	vid != 0 && pid != 0) && (vid == item->deviceParams.vendorId && pid == item->deviceParams.productId))
-        	|| 	((vid != 0 && pid == 0) && vid == item->deviceParams.vendorId)
-        	||	(vid == 0 && pid == 0)
-    	) {
-        	(*filteredList).push_back(CopyElement(&item->deviceParams));
-        }
+	return &results->items[results->count++];
+}
 
-    }
+// Room for every device, the buffer only grows while the list does
+static void ReserveResultsLocked(DeviceResults_t* results) {
+	if(results->items.capacity() < deviceStore.Size()) {
+		results->items.reserve(deviceStore.Size());
+	}
+}
+
+static bool MatchesClassValue(int match, int value) {
+	return match == USB_CLASS_ANY || match == value;
+}
+
+bool MatchesClass(const UsbClassMatch_t& match, ListResultItem_t* item) {
+	if(
+		!MatchesClassValue(match.deviceClass, item->deviceClass) ||
+		!MatchesClassValue(match.deviceSubClass, item->deviceSubClass) ||
+		!MatchesClassValue(match.deviceProtocol, item->deviceProtocol)
+	) {
+		return false;
+	}
+
+	if(match.interfaceClass == USB_CLASS_ANY && match.interfaceSubClass == USB_CLASS_ANY && match.interfaceProtocol == USB_CLASS_ANY) {
+		return true;
+	}
+
+	for(vector<UsbInterfaceClass_t>::iterator it = item->interfaces.begin(); it != item->interfaces.end(); ++it) {
+		if(
+			MatchesClassValue(match.interfaceClass, it->interfaceClass) &&
+			MatchesClassValue(match.interfaceSubClass, it->interfaceSubClass) &&
+			MatchesClassValue(match.interfaceProtocol, it->interfaceProtocol)
+		) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool MatchesIds(int vid, int pid, int vendorId, int productId) {
+	return (
+		((vid != 0 && pid != 0) && (vid == vendorId && pid == productId))
+		|| ((vid != 0 && pid == 0) && vid == vendorId)
+		|| (vid == 0 && pid == 0)
+	);
+}
+
+static const DeviceBucket_t emptyClassBucket;
+
+static const DeviceBucket_t* GetClassBucketLocked(const map<int, DeviceBucket_t>& index, int classCode) {
+	map<int, DeviceBucket_t>::const_iterator it = index.find(classCode);
+	return it != index.end() ? &it->second : &emptyClassBucket;
+}
+
+/*
+ * The smallest set of devices which can match `classMatch`, NULL for the
+ * whole list when it doesn't ask for a class (or no bucket is smaller).
+ */
+static const DeviceBucket_t* GetCandidatesLocked(const UsbClassMatch_t& classMatch) {
+	const DeviceBucket_t* candidates = NULL;
+	if(classMatch.deviceClass != USB_CLASS_ANY) {
+		candidates = GetClassBucketLocked(deviceClassIndex, classMatch.deviceClass);
+	}
+	if(classMatch.interfaceClass != USB_CLASS_ANY) {
+		const DeviceBucket_t* byInterface = GetClassBucketLocked(interfaceClassIndex, classMatch.interfaceClass);
+		if(byInterface->size() < (candidates != NULL ? candidates->size() : deviceStore.Size())) {
+			candidates = byInterface;
+		}
+	}
+
+	return candidates;
+}
+
+void CreateFilteredList(DeviceResults_t* filteredList, int vid, int pid, int fields, const UsbClassMatch_t& classMatch) {
+	LockDeviceList();
+	const DeviceBucket_t* candidates = GetCandidatesLocked(classMatch);
+	size_t candidateCount = candidates != NULL ? candidates->size() : deviceStore.Size();
+	if(filteredList->items.capacity() < candidateCount) {
+		filteredList->items.reserve(candidateCount);
+	}
+
+	if (candidates == NULL) {
+		// The ids are in the store's records, only matches are looked at beyond them
+		for (size_t i = 0; i < deviceStore.Size(); i++) {
+			const DeviceRecord_t& record = deviceStore.RecordAt(i);
+			if (!MatchesIds(vid, pid, record.vendorId, record.productId)) {
+				continue;
+			}
+
+			ListResultItem_t* item = &deviceStore.At(i)->deviceParams;
+			if (MatchesClass(classMatch, item)) {
+				CopyElementInto(AppendResult(filteredList), item, fields);
+			}
+		}
+	}
+	else {
+		for (DeviceBucket_t::const_iterator it = candidates->begin(); it != candidates->end(); ++it) {
+			ListResultItem_t* item = &it->second->deviceParams;
+			if (MatchesIds(vid, pid, item->vendorId, item->productId) && MatchesClass(classMatch, item)) {
+				CopyElementInto(AppendResult(filteredList), item, fields);
+			}
+		}
+	}
+	UnlockDeviceList();
+}
+
+void CreateMultiFilteredList(DeviceResults_t* results, vector<uint32_t>* resultQueries, const vector<DeviceIdQuery_t>& queries, int fields) {
+	LockDeviceList();
+	// Only the ids of every device are looked at for every query, and a
+	// handful of queries fit in the cache next to the records
+	for (size_t i = 0; i < deviceStore.Size(); i++) {
+		const DeviceRecord_t& record = deviceStore.RecordAt(i);
+		for (size_t query = 0; query < queries.size(); query++) {
+			if (MatchesIds(queries[query].vid, queries[query].pid, record.vendorId, record.productId)) {
+				CopyElementInto(AppendResult(results), &deviceStore.At(i)->deviceParams, fields);
+				resultQueries->push_back((uint32_t) query);
+			}
+		}
+	}
+	UnlockDeviceList();
+}
+
+/*
+ * Exact: one lookup. Prefix: the serial numbers sharing it are adjacent in
+ * `serialIndex`, so only the matches are visited after the first lookup.
+ */
+void CreateSerialList(DeviceResults_t* serialList, const char* serialNumber, bool isPrefix, int fields) {
+	string query = serialNumber;
+
+	LockDeviceList();
+	map<string, DeviceBucket_t>::iterator it = isPrefix ? serialIndex.lower_bound(query) : serialIndex.find(query);
+	for(; it != serialIndex.end(); ++it) {
+		if(it->first.compare(0, query.size(), query) != 0) {
+			break;
+		}
+
+		for(DeviceBucket_t::iterator entry = it->second.begin(); entry != it->second.end(); ++entry) {
+			CopyElementInto(AppendResult(serialList), &entry->second->deviceParams, fields);
+		}
+		if(!isPrefix) {
+			break;
+		}
+	}
+	UnlockDeviceList();
+}
+
+static void CollectSubtree(DeviceResults_t* subtreeList, const TopologyNode_t& node) {
+	if(node.item != NULL) {
+		CopyElementInto(AppendResult(subtreeList), &node.item->deviceParams);
+	}
+
+	for(set<string>::const_iterator child = node.children.begin(); child != node.children.end(); ++child) {
+		map<string, TopologyNode_t>::iterator it = topologyMap.find(*child);
+		if(it != topologyMap.end()) {
+			CollectSubtree(subtreeList, it->second);
+		}
+	}
+}
+
+void CreateSubtreeList(DeviceResults_t* subtreeList, const char* portPath) {
+	LockDeviceList();
+	map<string, TopologyNode_t>::iterator it = topologyMap.find(portPath);
+	if(it != topologyMap.end()) {
+		ReserveResultsLocked(subtreeList);
+		CollectSubtree(subtreeList, it->second);
+	}
+	UnlockDeviceList();
+}
+
+void CreateParentList(DeviceResults_t* parentList, const char* portPath) {
+	LockDeviceList();
+	// Placeholder ports do not count, report the closest known hub
+	string parentPortPath = GetParentPortPath(portPath);
+	while(!parentPortPath.empty()) {
+		map<string, TopologyNode_t>::iterator it = topologyMap.find(parentPortPath);
+		if(it != topologyMap.end() && it->second.item != NULL) {
+			CopyElementInto(AppendResult(parentList), &it->second.item->deviceParams);
+			break;
+		}
+
+		parentPortPath = GetParentPortPath(parentPortPath);
+	}
+	UnlockDeviceList();
+}
+
+void CreateItemSnapshot(list<KeyedDeviceItem_t>* items) {
+	LockDeviceList();
+	for (size_t i = 0; i < deviceStore.Size(); i++) {
+		DeviceItem_t* stored = deviceStore.At(i);
+		DeviceItem_t* item = new DeviceItem_t();
+		item->deviceParams = stored->deviceParams;
+		item->deviceState = stored->deviceState;
+		item->attributes = stored->attributes;
+		items->push_back(KeyedDeviceItem_t(stored->GetKey(), item));
+	}
+	UnlockDeviceList();
+}
+
+static void ReconcileListLocked(list<KeyedDeviceItem_t>* freshItems, const set<string>& freshKeys, const set<string>& keepKeys, list<ListResultItem_t*>* addedList, list<ListResultItem_t*>* removedList, list<string>* addedKeys = NULL, list<string>* removedKeys = NULL) {
+	// Backwards, removing moves the last device into the gap
+	for (size_t i = deviceStore.Size(); i-- > 0;) {
+		DeviceItem_t* item = deviceStore.At(i);
+
+		if (freshKeys.find(item->GetKey()) == freshKeys.end() && keepKeys.find(item->GetKey()) == keepKeys.end()) {
+			removedList->push_back(CopyElement(&item->deviceParams));
+			if (removedKeys != NULL) {
+				removedKeys->push_back(item->GetKey());
+			}
+			RemoveItemLocked(item);
+			delete item;
+		}
+	}
+
+	for (list<KeyedDeviceItem_t>::iterator fresh = freshItems->begin(); fresh != freshItems->end(); ++fresh) {
+		if (keepKeys.find(fresh->first) != keepKeys.end()) {
+			delete fresh->second;
+			continue;
+		}
+
+		DeviceItem_t* existing = deviceStore.Find(fresh->first.c_str());
+		if (existing != NULL) {
+			RemoveItemLocked(existing);
+			delete existing;
+		}
+		else {
+			addedList->push_back(CopyElement(&fresh->second->deviceParams));
+			if (addedKeys != NULL) {
+				addedKeys->push_back(fresh->first);
+			}
+		}
+
+		AddItemLocked((char *)fresh->first.c_str(), fresh->second);
+	}
+}
+
+static void GetFreshKeys(list<KeyedDeviceItem_t>* freshItems, set<string>* freshKeys) {
+	for (list<KeyedDeviceItem_t>::iterator it = freshItems->begin(); it != freshItems->end(); ++it) {
+		freshKeys->insert(it->first);
+	}
+}
+
+/*
+ * Swaps the list for a freshly enumerated one in a single step and reports
+ * the differences. Takes ownership of the items in `freshItems`.
+ */
+void ReconcileList(list<KeyedDeviceItem_t>* freshItems, list<ListResultItem_t*>* addedList, list<ListResultItem_t*>* removedList, list<string>* addedKeys, list<string>* removedKeys) {
+	set<string> freshKeys;
+	GetFreshKeys(freshItems, &freshKeys);
+
+	LockDeviceList();
+	ReconcileListLocked(freshItems, freshKeys, set<string>(), addedList, removedList, addedKeys, removedKeys);
+	UnlockDeviceList();
+
+	freshItems->clear();
+}
+
+/*
+ * `ReconcileList` for the enumeration which started when the list went
+ * provisional. Devices touched since then are left alone, the monitor
+ * already knows better than `freshItems`. That is decided under the same
+ * lock the monitor changes the list with, so nothing slips in between.
+ * The list is final afterwards.
+ */
+void ValidateList(list<KeyedDeviceItem_t>* freshItems, list<ListResultItem_t*>* addedList, list<ListResultItem_t*>* removedList) {
+	set<string> freshKeys;
+	GetFreshKeys(freshItems, &freshKeys);
+	set<string> keepKeys;
+
+	LockDeviceList();
+	isProvisional = false;
+	keepKeys.swap(provisionalChanges);
+	ReconcileListLocked(freshItems, freshKeys, keepKeys, addedList, removedList);
+	UnlockDeviceList();
+
+	freshItems->clear();
+}
+
+/*
+ * Either returns a copy of a device matching right now, or registers the
+ * waiter. Both happen under the list lock, so a device cannot slip in
+ * between the check and the registration.
+ */
+ListResultItem_t* FindOrAddWaiter(int id, const DeviceMatch_t& match) {
+	ListResultItem_t* found = NULL;
+
+	LockDeviceList();
+	for(size_t i = 0; i < deviceStore.Size(); i++) {
+		// Ruled out by the ids without touching the device
+		const DeviceRecord_t& record = deviceStore.RecordAt(i);
+		if((match.vid != 0 && match.vid != record.vendorId) || (match.pid != 0 && match.pid != record.productId)) {
+			continue;
+		}
+
+		if(MatchesDevice(match, &deviceStore.At(i)->deviceParams)) {
+			found = CopyElement(&deviceStore.At(i)->deviceParams);
+			break;
+		}
+	}
+
+	if(found == NULL) {
+		string bucket = GetWaiterBucket(match.vid, match.pid, match.serialNumber);
+		waiterBuckets[bucket].insert(id);
+		waiterBucketById[id] = bucket;
+	}
+	UnlockDeviceList();
+
+	return found;
+}
+
+// Returns false when the waiter was already resolved
+bool RemoveWaiter(int id) {
+	bool removed = false;
+
+	LockDeviceList();
+	map<int, string>::iterator it = waiterBucketById.find(id);
+	if(it != waiterBucketById.end()) {
+		map<string, set<int> >::iterator bucket = waiterBuckets.find(it->second);
+		if(bucket != waiterBuckets.end()) {
+			bucket->second.erase(id);
+			if(bucket->second.empty()) {
+				waiterBuckets.erase(bucket);
+			}
+		}
+		waiterBucketById.erase(it);
+		removed = true;
+	}
+	UnlockDeviceList();
+
+	return removed;
+}
+
+void SetWaiterResolvedCallback(WaiterResolvedCallback_t callback) {
+	LockDeviceList();
+	waiterResolvedCallback = callback;
+	UnlockDeviceList();
+}
+
+void SetListProvisional(bool provisional) {
+	LockDeviceList();
+	isProvisional = provisional;
+	provisionalChanges.clear();
+	UnlockDeviceList();
+}
+
+bool IsListProvisional() {
+	LockDeviceList();
+	bool provisional = isProvisional;
+	UnlockDeviceList();
+
+	return provisional;
+}
+
+// Same vid/pid semantics as `CreateFilteredList`, a pid without a vid matches nothing
+void GetTopologyDigest(int vid, int pid, TopologyDigest_t* digest) {
+	*digest = TopologyDigest_t();
+
+	LockDeviceList();
+	if(vid == 0 && pid == 0) {
+		*digest = topologyDigest;
+	}
+	else if(vid != 0 && pid == 0) {
+		map<int, TopologyDigest_t>::iterator it = vendorDigests.find(vid);
+		if(it != vendorDigests.end()) {
+			*digest = it->second;
+		}
+	}
+	else if(vid != 0) {
+		map<pair<int, int>, TopologyDigest_t>::iterator it = productDigests.find(make_pair(vid, pid));
+		if(it != productDigests.end()) {
+			*digest = it->second;
+		}
+	}
+	UnlockDeviceList();
+}
+
+bool GetItemAttributes(const char* portPath, DeviceAttributes_t* attributes) {
+	bool found = false;
+
+	LockDeviceList();
+	map<string, TopologyNode_t>::iterator it = topologyMap.find(portPath);
+	if(it != topologyMap.end() && it->second.item != NULL) {
+		*attributes = it->second.item->attributes;
+		found = true;
+	}
+	UnlockDeviceList();
+
+	return found;
+}
+
+void UpdateItemAttributes(char* key, const DeviceAttributes_t& attributes) {
+	LockDeviceList();
+	DeviceItem_t* item = deviceStore.Find(key);
+	if(item != NULL) {
+		item->attributes = attributes;
+		MarkChangedLocked(key);
+	}
+	UnlockDeviceList();
+}
+
+void AddChildDevNode(char* parentKey, const char* devNode) {
+	LockDeviceList();
+	DeviceItem_t* parent = deviceStore.Find(parentKey);
+	if(parent != NULL && childDevNodeMap.find(devNode) == childDevNodeMap.end()) {
+		parent->deviceParams.childDevNodes.push_back(devNode);
+		childDevNodeMap.insert(pair<string, string>(devNode, parentKey));
+		MarkChangedLocked(parentKey);
+	}
+	UnlockDeviceList();
+}
+
+void RemoveChildDevNode(const char* devNode) {
+	LockDeviceList();
+	map<string, string>::iterator child = childDevNodeMap.find(devNode);
+	if(child != childDevNodeMap.end()) {
+		DeviceItem_t* parent = deviceStore.Find(child->second.c_str());
+		if(parent != NULL) {
+			vector<string>& children = parent->deviceParams.childDevNodes;
+			children.erase(remove(children.begin(), children.end(), child->first), children.end());
+			MarkChangedLocked(parent->GetKey());
+		}
+		childDevNodeMap.erase(child);
+	}
+	UnlockDeviceList();
 }
@@ -1,10 +1,26 @@
 #ifndef _DEVICE_LIST_H
 #define _DEVICE_LIST_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <string>
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
 
+// Extra udev properties, see `propertyTable.h`
+typedef std::map<std::string, std::string> DeviceProperties_t;
+
+// Class/subclass/protocol triplet of one interface descriptor
 typedef struct {
+	int interfaceClass;
+	int interfaceSubClass;
+	int interfaceProtocol;
+} UsbInterfaceClass_t;
+
+typedef struct _ListResultItem_t {
 	public:
 		int locationId;
 		int vendorId;
@@ -13,19 +29,66 @@ typedef struct {
 		std::string manufacturer;
 		std::string serialNumber;
 		int deviceAddress;
+		std::string portPath;
+		std::vector<std::string> childDevNodes;
+		DeviceProperties_t properties;
+		// From the device descriptor, 0 means "see the interfaces"
+		int deviceClass;
+		int deviceSubClass;
+		int deviceProtocol;
+		std::vector<UsbInterfaceClass_t> interfaces;
+
+		_ListResultItem_t() : locationId(0), vendorId(0), productId(0), deviceAddress(0), deviceClass(0), deviceSubClass(0), deviceProtocol(0) {
+		}
 } ListResultItem_t;
 
+// Fields of `ListResultItem_t`, used to only copy/convert what was asked for
+typedef enum _DeviceField_t {
+	DeviceField_LocationId = 1 << 0,
+	DeviceField_VendorId = 1 << 1,
+	DeviceField_ProductId = 1 << 2,
+	DeviceField_DeviceName = 1 << 3,
+	DeviceField_Manufacturer = 1 << 4,
+	DeviceField_SerialNumber = 1 << 5,
+	DeviceField_DeviceAddress = 1 << 6,
+	DeviceField_PortPath = 1 << 7,
+	DeviceField_ChildDevNodes = 1 << 8,
+	DeviceField_Properties = 1 << 9,
+	DeviceField_DeviceClass = 1 << 10,
+	DeviceField_DeviceSubClass = 1 << 11,
+	DeviceField_DeviceProtocol = 1 << 12,
+	DeviceField_Interfaces = 1 << 13,
+	DeviceField_All = (1 << 14) - 1,
+} DeviceField_t;
+
 typedef enum  _DeviceState_t {
 	DeviceState_Connect,
 	DeviceState_Disconnect,
 } DeviceState_t;
 
+typedef std::map<std::string, std::string> DeviceAttributes_t;
+
+// Device nodes and most Windows instance ids fit, longer keys go to the heap
+#define DEVICE_KEY_INLINE_LENGTH 64
+
 typedef struct _DeviceItem_t {
 	ListResultItem_t deviceParams;
 	DeviceState_t deviceState;
+	// Snapshot of the device's sysfs attributes (Linux only)
+	DeviceAttributes_t attributes;
+	// Contribution to the topology digest, set when it is added to the list
+	uint64_t topologyHash[2];
 
 	private:
 		char* key;
+		char inlineKey[DEVICE_KEY_INLINE_LENGTH];
+
+		void FreeKey() {
+			if(this->key != NULL && this->key != this->inlineKey) {
+				delete[] this->key;
+			}
+			this->key = NULL;
+		}
 
 
 	public:
@@ -34,17 +97,22 @@ typedef struct _DeviceItem_t {
 		}
 
 		~_DeviceItem_t() {
-			if(this->key != NULL) {
-				delete this->key;
-			}
+			FreeKey();
 		}
 
+		// Recycled through a block pool, see deviceList.cpp
+		static void* operator new(size_t size);
+		static void operator delete(void* block);
+
 		void SetKey(char* key) {
-			if(this->key != NULL) {
-				delete this->key;
+			if(key == this->key) {
+				return;
 			}
-			this->key = new char[strlen(key) + 1];
-			memcpy(this->key, key, strlen(key) + 1);
+			FreeKey();
+
+			size_t length = strlen(key) + 1;
+			this->key = length <= sizeof(this->inlineKey) ? this->inlineKey : new char[length];
+			memcpy(this->key, key, length);
 		}
 
 		char* GetKey() {
@@ -52,12 +120,124 @@ typedef struct _DeviceItem_t {
 		}
 } DeviceItem_t;
 
+typedef std::pair<std::string, DeviceItem_t*> KeyedDeviceItem_t;
+
+/*
+ * Contiguous result buffer for `find` and friends. The first `count` items
+ * are valid. Clearing keeps the items and the capacity of their strings,
+ * so refilling it with similar results doesn't allocate.
+ */
+typedef struct _DeviceResults_t {
+	std::vector<ListResultItem_t> items;
+	size_t count;
+
+	_DeviceResults_t() : count(0) {
+	}
+} DeviceResults_t;
+
+// One `find` of a `findMany`, same vid/pid semantics
+typedef struct {
+	int vid;
+	int pid;
+} DeviceIdQuery_t;
+
+// 0 and "" match anything
+typedef struct {
+	int vid;
+	int pid;
+	std::string serialNumber;
+} DeviceMatch_t;
+
+// Class codes are 0-255, 0 is a real class so "any" needs its own value
+#define USB_CLASS_ANY -1
+
+/*
+ * Device descriptor and interface class filter. The interface part matches
+ * when any single interface matches all of its set fields.
+ */
+typedef struct _UsbClassMatch_t {
+	int deviceClass;
+	int deviceSubClass;
+	int deviceProtocol;
+	int interfaceClass;
+	int interfaceSubClass;
+	int interfaceProtocol;
+
+	_UsbClassMatch_t() :
+		deviceClass(USB_CLASS_ANY), deviceSubClass(USB_CLASS_ANY), deviceProtocol(USB_CLASS_ANY),
+		interfaceClass(USB_CLASS_ANY), interfaceSubClass(USB_CLASS_ANY), interfaceProtocol(USB_CLASS_ANY) {
+	}
+} UsbClassMatch_t;
+
+/*
+ * Order independent 128-bit digest over a set of devices: the sum of the
+ * per-device hashes, so adding and removing a device is O(1) and two
+ * identical devices don't cancel each other out.
+ */
+typedef struct _TopologyDigest_t {
+	uint64_t hash[2];
+	size_t count;
+
+	_TopologyDigest_t() : count(0) {
+		hash[0] = 0;
+		hash[1] = 0;
+	}
+} TopologyDigest_t;
+
+// Called with the list locked, from whichever thread added the device
+typedef void (*WaiterResolvedCallback_t)(int id, ListResultItem_t* item);
+
 
 void AddItemToList(char* key, DeviceItem_t * item);
+// Replaces whatever is stored under `key` and returns a copy of `item`, all under one lock
+ListResultItem_t* AddItemToListAndCopy(char* key, DeviceItem_t* item);
+// Adds all of them under one lock, `items` is left empty
+void AddItemsToList(std::list<KeyedDeviceItem_t>* items);
 void RemoveItemFromList(DeviceItem_t* item);
 bool IsItemAlreadyStored(char* identifier);
 DeviceItem_t* GetItemFromList(char* key);
-ListResultItem_t* CopyElement(ListResultItem_t* item);
-void CreateFilteredList(std::list<ListResultItem_t*>* filteredList, int vid, int pid);
+/*
+ * The stored item may be gone as soon as the lock is released, these copy
+ * it while they hold it. NULL if nothing is stored under `key`.
+ */
+ListResultItem_t* CopyItemFromList(char* key);
+// Removes the item as well
+ListResultItem_t* TakeItemFromList(char* key);
+// Copies come from a pool, hand them back with `ReleaseListResultItem`
+ListResultItem_t* CopyElement(ListResultItem_t* item, int fields = DeviceField_All);
+void CopyElementInto(ListResultItem_t* dst, ListResultItem_t* item, int fields = DeviceField_All);
+ListResultItem_t* AcquireListResultItem();
+void ReleaseListResultItem(ListResultItem_t* item);
+void ClearResults(DeviceResults_t* results);
+ListResultItem_t* AppendResult(DeviceResults_t* results);
+// Class filters are answered from an index, only the candidates are looked at
+void CreateFilteredList(DeviceResults_t* filteredList, int vid, int pid, int fields = DeviceField_All, const UsbClassMatch_t& classMatch = UsbClassMatch_t());
+bool MatchesClass(const UsbClassMatch_t& match, ListResultItem_t* item);
+/*
+ * All the queries in one pass, `resultQueries` gets the index of the query
+ * each result matched. A device matching several queries is copied once
+ * for each of them.
+ */
+void CreateMultiFilteredList(DeviceResults_t* results, std::vector<uint32_t>* resultQueries, const std::vector<DeviceIdQuery_t>& queries, int fields = DeviceField_All);
+// Devices without a serial number are never found
+void CreateSerialList(DeviceResults_t* serialList, const char* serialNumber, bool isPrefix, int fields = DeviceField_All);
+void CreateSubtreeList(DeviceResults_t* subtreeList, const char* portPath);
+void CreateParentList(DeviceResults_t* parentList, const char* portPath);
+void CreateItemSnapshot(std::list<KeyedDeviceItem_t>* items);
+// `addedKeys`/`removedKeys`, if given, get the keys in the same order as the items
+void ReconcileList(std::list<KeyedDeviceItem_t>* freshItems, std::list<ListResultItem_t*>* addedList, std::list<ListResultItem_t*>* removedList, std::list<std::string>* addedKeys = NULL, std::list<std::string>* removedKeys = NULL);
+void ValidateList(std::list<KeyedDeviceItem_t>* freshItems, std::list<ListResultItem_t*>* addedList, std::list<ListResultItem_t*>* removedList);
+ListResultItem_t* FindOrAddWaiter(int id, const DeviceMatch_t& match);
+bool RemoveWaiter(int id);
+void SetWaiterResolvedCallback(WaiterResolvedCallback_t callback);
+// While provisional, the keys of changed devices are recorded for `ValidateList`
+void SetListProvisional(bool provisional);
+bool IsListProvisional();
+// `vid`/`pid` 0 match anything, like `find`
+void GetTopologyDigest(int vid, int pid, TopologyDigest_t* digest);
+bool GetItemAttributes(const char* portPath, DeviceAttributes_t* attributes);
+void UpdateItemAttributes(char* key, const DeviceAttributes_t& attributes);
+void AddChildDevNode(char* parentKey, const char* devNode);
+void RemoveChildDevNode(const char* devNode);
 
 #endif
@@ -0,0 +1,121 @@
+#include <string.h>
+
+#include "deviceStore.h"
+
+using namespace std;
+
+// Power of two, grown to keep at least half of the slots empty
+#define DEVICE_STORE_INITIAL_SLOTS 16
+
+// FNV-1a and the splitmix64 finalizer, the low bits pick the slot
+static uint64_t HashKey(const char* key) {
+	uint64_t hash = 14695981039346656037ULL;
+	for(const unsigned char* c = (const unsigned char*) key; *c != '\0'; c++) {
+		hash ^= *c;
+		hash *= 1099511628211ULL;
+	}
+
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+	return hash ^ (hash >> 31);
+}
+
+DeviceStore::DeviceStore() : slots(DEVICE_STORE_INITIAL_SLOTS, 0), mask(DEVICE_STORE_INITIAL_SLOTS - 1) {
+}
+
+// The slot of `key`, or `slots.size()` if it is not stored
+size_t DeviceStore::FindSlot(const char* key, uint64_t keyHash) const {
+	for(size_t slot = keyHash & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+		size_t index = slots[slot] - 1;
+		if(records[index].keyHash == keyHash && strcmp(items[index]->GetKey(), key) == 0) {
+			return slot;
+		}
+	}
+
+	return slots.size();
+}
+
+size_t DeviceStore::FindSlotOfIndex(size_t index) const {
+	size_t slot = records[index].keyHash & mask;
+	while(slots[slot] != index + 1) {
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+void DeviceStore::Grow() {
+	slots.assign(slots.size() * 2, 0);
+	mask = slots.size() - 1;
+
+	for(size_t index = 0; index < records.size(); index++) {
+		size_t slot = records[index].keyHash & mask;
+		while(slots[slot] != 0) {
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = (uint32_t) index + 1;
+	}
+}
+
+DeviceItem_t* DeviceStore::Find(const char* key) const {
+	size_t slot = FindSlot(key, HashKey(key));
+	return slot < slots.size() ? items[slots[slot] - 1] : NULL;
+}
+
+bool DeviceStore::Insert(DeviceItem_t* item) {
+	uint64_t keyHash = HashKey(item->GetKey());
+	if(FindSlot(item->GetKey(), keyHash) < slots.size()) {
+		return false;
+	}
+
+	if((items.size() + 1) * 2 > slots.size()) {
+		Grow();
+	}
+
+	DeviceRecord_t record;
+	record.keyHash = keyHash;
+	record.vendorId = item->deviceParams.vendorId;
+	record.productId = item->deviceParams.productId;
+	records.push_back(record);
+	items.push_back(item);
+
+	size_t slot = keyHash & mask;
+	while(slots[slot] != 0) {
+		slot = (slot + 1) & mask;
+	}
+	slots[slot] = (uint32_t) items.size();
+
+	return true;
+}
+
+bool DeviceStore::Remove(DeviceItem_t* item) {
+	size_t slot = FindSlot(item->GetKey(), HashKey(item->GetKey()));
+	if(slot == slots.size() || items[slots[slot] - 1] != item) {
+		return false;
+	}
+	size_t index = slots[slot] - 1;
+
+	// Backward shift: pull later entries of the probe chain into the gap,
+	// unless that would move them in front of their home slot
+	size_t gap = slot;
+	for(size_t next = (gap + 1) & mask; slots[next] != 0; next = (next + 1) & mask) {
+		size_t home = records[slots[next] - 1].keyHash & mask;
+		if(((next - home) & mask) >= ((next - gap) & mask)) {
+			slots[gap] = slots[next];
+			gap = next;
+		}
+	}
+	slots[gap] = 0;
+
+	// Keep the arrays dense, the last device takes the removed one's place
+	size_t last = items.size() - 1;
+	if(index != last) {
+		slots[FindSlotOfIndex(last)] = (uint32_t) index + 1;
+		records[index] = records[last];
+		items[index] = items[last];
+	}
+	records.pop_back();
+	items.pop_back();
+
+	return true;
+}
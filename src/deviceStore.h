@@ -0,0 +1,66 @@
+#ifndef _DEVICE_STORE_H
+#define _DEVICE_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "deviceList.h"
+
+/*
+ * The primary store of the device list, a flat hash table keyed by the
+ * key the item carries itself (see `DeviceItem_t::SetKey`), so the key is
+ * only stored once, inline for anything up to `DEVICE_KEY_INLINE_LENGTH`.
+ *
+ * The devices sit in dense arrays, the table only maps open-addressed
+ * (linear probing) slots to their index. The hot part of every device,
+ * its key hash and ids, is a contiguous 16 byte record: lookups compare
+ * hashes before touching a key, and scans by vendor/product only touch
+ * the items which match. Removing moves the last device into the gap and
+ * shifts the probe chain back, so there are no tombstones and the arrays
+ * stay dense.
+ *
+ * Iteration is by index and not in key order. Not locked, that is up to
+ * the device list.
+ */
+typedef struct _DeviceRecord_t {
+	uint64_t keyHash;
+	int vendorId;
+	int productId;
+} DeviceRecord_t;
+
+class DeviceStore {
+	public:
+		DeviceStore();
+
+		size_t Size() const {
+			return items.size();
+		}
+
+		DeviceItem_t* At(size_t index) const {
+			return items[index];
+		}
+
+		const DeviceRecord_t& RecordAt(size_t index) const {
+			return records[index];
+		}
+
+		DeviceItem_t* Find(const char* key) const;
+		// False if something is already stored under the item's key
+		bool Insert(DeviceItem_t* item);
+		// Only this very item, not another one stored under its key
+		bool Remove(DeviceItem_t* item);
+
+	private:
+		// Slots hold the index + 1, 0 is empty
+		std::vector<uint32_t> slots;
+		size_t mask;
+		std::vector<DeviceRecord_t> records;
+		std::vector<DeviceItem_t*> items;
+
+		size_t FindSlot(const char* key, uint64_t keyHash) const;
+		size_t FindSlotOfIndex(size_t index) const;
+		void Grow();
+};
+
+#endif
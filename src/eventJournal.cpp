@@ -0,0 +1,42 @@
+#include <chrono>
+#include <vector>
+
+#include "eventJournal.h"
+
+using namespace std;
+
+static vector<JournalEntry_t> journal;
+static uint64_t lastSeq = 0;
+
+static double GetWallClockMs() {
+	return (double) chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void RecordJournalEvent(ListResultItem_t* item, int action) {
+	if (journal.empty()) {
+		journal.resize(EVENT_JOURNAL_SIZE);
+	}
+
+	lastSeq++;
+	JournalEntry_t* entry = &journal[lastSeq % EVENT_JOURNAL_SIZE];
+	entry->seq = lastSeq;
+	entry->timestamp = GetWallClockMs();
+	entry->action = action;
+	CopyElementInto(&entry->item, item);
+}
+
+uint64_t GetJournalOldestSeq() {
+	return lastSeq > EVENT_JOURNAL_SIZE ? lastSeq - EVENT_JOURNAL_SIZE + 1 : 1;
+}
+
+uint64_t GetJournalLastSeq() {
+	return lastSeq;
+}
+
+JournalEntry_t* GetJournalEntry(uint64_t seq) {
+	if (seq == 0 || seq > lastSeq || seq < GetJournalOldestSeq()) {
+		return NULL;
+	}
+
+	return &journal[seq % EVENT_JOURNAL_SIZE];
+}
@@ -0,0 +1,36 @@
+#ifndef _EVENT_JOURNAL_H
+#define _EVENT_JOURNAL_H
+
+#include <stdint.h>
+
+#include "deviceList.h"
+
+/*
+ * The last `EVENT_JOURNAL_SIZE` adds and removes, for `getHistory`. A fixed
+ * ring of preallocated entries, recording copies into a slot which keeps
+ * the string buffers of the device it overwrites.
+ *
+ * Only touched from the main thread (every event passes through `Notify`
+ * there), so neither recording nor reading takes a lock.
+ */
+#define EVENT_JOURNAL_SIZE 256
+
+typedef struct _JournalEntry_t {
+	// Starts at 1, 0 means "before the first event"
+	uint64_t seq;
+	// Milliseconds since the epoch, like `Date.now()`
+	double timestamp;
+	// A `MonitorAction_t`
+	int action;
+	ListResultItem_t item;
+} JournalEntry_t;
+
+void RecordJournalEvent(ListResultItem_t* item, int action);
+// Sequence number of the oldest entry still in the ring
+uint64_t GetJournalOldestSeq();
+// Sequence number of the newest entry, 0 while nothing was recorded
+uint64_t GetJournalLastSeq();
+// NULL once `seq` was overwritten (or not recorded yet)
+JournalEntry_t* GetJournalEntry(uint64_t seq);
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _OBJECT_POOL_H
+#define _OBJECT_POOL_H
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+#include <uv.h>
+
+/*
+ * Free list of constructed objects. Released objects are kept as they are,
+ * so the capacity of their strings and containers is reused by the next
+ * `Acquire`; resetting the contents is up to the caller.
+ *
+ * Only `maxFree` objects are kept, the rest is deleted.
+ */
+template <typename T>
+class ObjectPool {
+	public:
+		explicit ObjectPool(size_t maxFree) : maxFree(maxFree) {
+			uv_mutex_init(&mutex);
+			freeObjects.reserve(maxFree);
+		}
+
+		T* Acquire() {
+			T* object = NULL;
+			uv_mutex_lock(&mutex);
+			if (!freeObjects.empty()) {
+				object = freeObjects.back();
+				freeObjects.pop_back();
+			}
+			uv_mutex_unlock(&mutex);
+
+			return object != NULL ? object : new T();
+		}
+
+		void Release(T* object) {
+			if (object == NULL) {
+				return;
+			}
+
+			uv_mutex_lock(&mutex);
+			bool isKept = freeObjects.size() < maxFree;
+			if (isKept) {
+				freeObjects.push_back(object);
+			}
+			uv_mutex_unlock(&mutex);
+
+			if (!isKept) {
+				delete object;
+			}
+		}
+
+	private:
+		size_t maxFree;
+		uv_mutex_t mutex;
+		std::vector<T*> freeObjects;
+};
+
+/*
+ * Fixed-size blocks for class specific `operator new`/`operator delete`,
+ * for objects which are created and deleted all over the place.
+ */
+template <size_t BlockSize>
+class BlockPool {
+	public:
+		explicit BlockPool(size_t maxFree) : maxFree(maxFree) {
+			uv_mutex_init(&mutex);
+			freeBlocks.reserve(maxFree);
+		}
+
+		void* Allocate() {
+			void* block = NULL;
+			uv_mutex_lock(&mutex);
+			if (!freeBlocks.empty()) {
+				block = freeBlocks.back();
+				freeBlocks.pop_back();
+			}
+			uv_mutex_unlock(&mutex);
+
+			return block != NULL ? block : ::operator new(BlockSize);
+		}
+
+		void Free(void* block) {
+			if (block == NULL) {
+				return;
+			}
+
+			uv_mutex_lock(&mutex);
+			bool isKept = freeBlocks.size() < maxFree;
+			if (isKept) {
+				freeBlocks.push_back(block);
+			}
+			uv_mutex_unlock(&mutex);
+
+			if (!isKept) {
+				::operator delete(block);
+			}
+		}
+
+	private:
+		size_t maxFree;
+		uv_mutex_t mutex;
+		std::vector<void*> freeBlocks;
+};
+
+#endif
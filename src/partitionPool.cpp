@@ -0,0 +1,85 @@
+#include <uv.h>
+
+#include "partitionPool.h"
+
+typedef struct {
+	size_t partitionCount;
+	size_t nextPartition;
+	uv_mutex_t mutex;
+	PartitionWork_t work;
+	void* arg;
+} PartitionPool_t;
+
+typedef struct {
+	PartitionPool_t* pool;
+	int thread;
+} PartitionWorker_t;
+
+static void RunWorker(void* data) {
+	PartitionWorker_t* worker = static_cast<PartitionWorker_t*>(data);
+	PartitionPool_t* pool = worker->pool;
+
+	while (true) {
+		uv_mutex_lock(&pool->mutex);
+		size_t partition = pool->nextPartition++;
+		uv_mutex_unlock(&pool->mutex);
+
+		if (partition >= pool->partitionCount) {
+			return;
+		}
+		pool->work(partition, worker->thread, pool->arg);
+	}
+}
+
+int GetPartitionThreads(size_t partitionCount) {
+	uv_cpu_info_t* cpus;
+	int cpuCount = 1;
+	if (uv_cpu_info(&cpus, &cpuCount) == 0) {
+		uv_free_cpu_info(cpus, cpuCount);
+	}
+
+	int threads = cpuCount < PARTITION_POOL_MAX_THREADS ? cpuCount : PARTITION_POOL_MAX_THREADS;
+	if ((size_t) threads > partitionCount) {
+		threads = (int) partitionCount;
+	}
+
+	return threads > 0 ? threads : 1;
+}
+
+void RunPartitions(size_t partitionCount, int threads, PartitionWork_t work, void* arg) {
+	if (threads > PARTITION_POOL_MAX_THREADS) {
+		threads = PARTITION_POOL_MAX_THREADS;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+
+	PartitionPool_t pool;
+	pool.partitionCount = partitionCount;
+	pool.nextPartition = 0;
+	pool.work = work;
+	pool.arg = arg;
+	uv_mutex_init(&pool.mutex);
+
+	PartitionWorker_t workers[PARTITION_POOL_MAX_THREADS];
+	uv_thread_t handles[PARTITION_POOL_MAX_THREADS];
+	bool isStarted[PARTITION_POOL_MAX_THREADS];
+	for (int i = 0; i < threads; i++) {
+		workers[i].pool = &pool;
+		workers[i].thread = i;
+		isStarted[i] = false;
+	}
+
+	// Thread 0 is us, if a thread can't be started the others pick up its share
+	for (int i = 1; i < threads; i++) {
+		isStarted[i] = uv_thread_create(&handles[i], RunWorker, &workers[i]) == 0;
+	}
+	RunWorker(&workers[0]);
+
+	for (int i = 1; i < threads; i++) {
+		if (isStarted[i]) {
+			uv_thread_join(&handles[i]);
+		}
+	}
+	uv_mutex_destroy(&pool.mutex);
+}
@@ -0,0 +1,20 @@
+#ifndef _PARTITION_POOL_H
+#define _PARTITION_POOL_H
+
+#include <stddef.h>
+
+/*
+ * Small fork/join pool for enumeration work that splits into independent
+ * partitions (e.g. one per USB bus). Every partition runs exactly once on
+ * one of `threads` threads, the calling thread included; `thread` is the
+ * index of the thread running it, for per-thread state like udev contexts.
+ */
+#define PARTITION_POOL_MAX_THREADS 8
+
+typedef void (*PartitionWork_t)(size_t partition, int thread, void* arg);
+
+// How many threads are worth it for `partitionCount` partitions on this machine
+int GetPartitionThreads(size_t partitionCount);
+void RunPartitions(size_t partitionCount, int threads, PartitionWork_t work, void* arg);
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+#include <uv.h>
+
+#include "pipelineTrace.h"
+
+using namespace std;
+
+typedef struct _TraceSpan_t {
+	const char* name;
+	const char* detail;
+	uint64_t start;
+	uint64_t end;
+} TraceSpan_t;
+
+/*
+ * Owned by one thread, which resets it when it first records in a new
+ * session. Never freed, a reader may still look at it after its thread
+ * is gone.
+ */
+typedef struct _TraceBuffer_t {
+	int tid;
+	atomic<const char*> name;
+	// Session the spans belong to, stored after `count` was reset
+	atomic<uint32_t> generation;
+	atomic<uint32_t> count;
+	atomic<uint32_t> dropped;
+	TraceSpan_t spans[PIPELINE_TRACE_CAPACITY];
+} TraceBuffer_t;
+
+static atomic<bool> isTracing(false);
+static atomic<uint32_t> traceGeneration(0);
+
+static thread_local TraceBuffer_t* threadBuffer = NULL;
+// Until the thread records its first span, most never do
+static thread_local const char* threadName = NULL;
+
+// Only for registering buffers and listing them
+static uv_once_t buffersOnce = UV_ONCE_INIT;
+static uv_mutex_t buffersMutex;
+static vector<TraceBuffer_t*> buffers;
+
+static void InitBuffers() {
+	uv_mutex_init(&buffersMutex);
+}
+
+static TraceBuffer_t* GetThreadBuffer() {
+	if(threadBuffer != NULL) {
+		return threadBuffer;
+	}
+
+	TraceBuffer_t* buffer = new TraceBuffer_t();
+	buffer->name.store(threadName);
+	buffer->generation.store(0);
+	buffer->count.store(0);
+	buffer->dropped.store(0);
+
+	uv_once(&buffersOnce, InitBuffers);
+	uv_mutex_lock(&buffersMutex);
+	buffers.push_back(buffer);
+	buffer->tid = (int) buffers.size();
+	uv_mutex_unlock(&buffersMutex);
+
+	threadBuffer = buffer;
+	return buffer;
+}
+
+void StartPipelineTrace() {
+	// Buffers of the previous session reset themselves on their next span
+	traceGeneration.fetch_add(1, memory_order_release);
+	isTracing.store(true, memory_order_release);
+}
+
+bool IsPipelineTracing() {
+	return isTracing.load(memory_order_relaxed);
+}
+
+void NameTraceThread(const char* name) {
+	threadName = name;
+	if(threadBuffer != NULL) {
+		threadBuffer->name.store(name, memory_order_release);
+	}
+}
+
+uint64_t TraceBegin() {
+	if(!isTracing.load(memory_order_relaxed)) {
+		return 0;
+	}
+
+	return uv_hrtime();
+}
+
+void TraceEnd(const char* name, uint64_t start, const char* detail) {
+	if(start == 0 || !isTracing.load(memory_order_relaxed)) {
+		return;
+	}
+
+	uint64_t end = uv_hrtime();
+	TraceBuffer_t* buffer = GetThreadBuffer();
+
+	uint32_t generation = traceGeneration.load(memory_order_acquire);
+	if(buffer->generation.load(memory_order_relaxed) != generation) {
+		buffer->count.store(0, memory_order_relaxed);
+		buffer->dropped.store(0, memory_order_relaxed);
+		buffer->generation.store(generation, memory_order_release);
+	}
+
+	uint32_t count = buffer->count.load(memory_order_relaxed);
+	if(count >= PIPELINE_TRACE_CAPACITY) {
+		buffer->dropped.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+
+	TraceSpan_t* span = &buffer->spans[count];
+	span->name = name;
+	span->detail = detail;
+	span->start = start;
+	span->end = end;
+	buffer->count.store(count + 1, memory_order_release);
+}
+
+static void AppendEvent(string* out, const char* event) {
+	if(out->size() > 0 && (*out)[out->size() - 1] == '}') {
+		out->push_back(',');
+	}
+	out->append(event);
+}
+
+string StopPipelineTrace(int pid) {
+	isTracing.store(false, memory_order_release);
+	uint32_t generation = traceGeneration.load(memory_order_acquire);
+
+	uv_once(&buffersOnce, InitBuffers);
+	uv_mutex_lock(&buffersMutex);
+	vector<TraceBuffer_t*> listed(buffers);
+	uv_mutex_unlock(&buffersMutex);
+
+	string out = "{\"traceEvents\":[";
+	uint32_t dropped = 0;
+	char event[512];
+	for(vector<TraceBuffer_t*>::iterator it = listed.begin(); it != listed.end(); ++it) {
+		TraceBuffer_t* buffer = *it;
+		// Nothing recorded in this session
+		if(buffer->generation.load(memory_order_acquire) != generation) {
+			continue;
+		}
+
+		const char* name = buffer->name.load(memory_order_acquire);
+		snprintf(event, sizeof(event),
+			"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			pid, buffer->tid, name != NULL ? name : PIPELINE_TRACE_CATEGORY " worker"
+		);
+		AppendEvent(&out, event);
+
+		// Spans up to the count are complete, whatever is written after it is not ours
+		uint32_t count = buffer->count.load(memory_order_acquire);
+		for(uint32_t i = 0; i < count; i++) {
+			TraceSpan_t* span = &buffer->spans[i];
+			int length = snprintf(event, sizeof(event),
+				"{\"name\":\"%s\",\"cat\":\"" PIPELINE_TRACE_CATEGORY "\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+				span->name, pid, buffer->tid, span->start / 1000.0, (span->end - span->start) / 1000.0
+			);
+			if(span->detail != NULL) {
+				snprintf(event + length, sizeof(event) - length, ",\"args\":{\"detail\":\"%s\"}}", span->detail);
+			}
+			else {
+				snprintf(event + length, sizeof(event) - length, "}");
+			}
+			AppendEvent(&out, event);
+		}
+		dropped += buffer->dropped.load(memory_order_relaxed);
+	}
+
+	snprintf(event, sizeof(event), "],\"displayTimeUnit\":\"ms\",\"droppedSpans\":%u}", dropped);
+	out.append(event);
+	return out;
+}
@@ -0,0 +1,40 @@
+#ifndef _PIPELINE_TRACE_H
+#define _PIPELINE_TRACE_H
+
+#include <stdint.h>
+#include <string>
+
+/*
+ * Spans of the detection pipeline (uevent receive, property reads, the
+ * hand-over to the main thread, the JS handlers, ...) for `startTracing`/
+ * `stopTracing`, exported as Chrome trace-event JSON.
+ *
+ * Every thread records into its own fixed buffer, only it writes there
+ * and publishes each span with a release store of the count, so recording
+ * takes no lock. A full buffer drops the spans (and counts them) instead
+ * of wrapping. Timestamps are `uv_hrtime` in microseconds, the clock of
+ * Node's own trace events, so both files line up in Perfetto.
+ *
+ * While not tracing, `TraceBegin` is one relaxed atomic load.
+ */
+#define PIPELINE_TRACE_CATEGORY "usb-detection"
+// Spans per thread and tracing session
+#define PIPELINE_TRACE_CAPACITY 16384
+
+void StartPipelineTrace();
+// Stops recording and returns what was recorded as a JSON object
+std::string StopPipelineTrace(int pid);
+bool IsPipelineTracing();
+
+// Shown as the name of the calling thread's track, allocates nothing
+void NameTraceThread(const char* name);
+// The start of a span, 0 while not tracing
+uint64_t TraceBegin();
+/*
+ * Records a span from `start` (a `TraceBegin` value, possibly from another
+ * thread) until now on the calling thread. `name` and `detail` must be
+ * static strings, `detail` is optional.
+ */
+void TraceEnd(const char* name, uint64_t start, const char* detail = NULL);
+
+#endif
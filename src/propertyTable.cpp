@@ -0,0 +1,170 @@
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "propertyTable.h"
+
+using namespace std;
+
+/*
+ * Hash and displace: every name is hashed once, the hash picks a bucket
+ * and the bucket's displacement picks the slot. The displacements are
+ * searched at compile time so that no two names share a slot.
+ */
+#define PROPERTY_TABLE_MIN_SIZE 8
+#define PROPERTY_TABLE_MAX_DISPLACEMENT 65536
+// Names per bucket, on average
+#define PROPERTY_TABLE_BUCKET_LOAD 4
+
+typedef struct {
+	uint64_t hash;
+	int slot;
+	string name;
+} PropertyEntry_t;
+
+// Written once from `InitDetection`, only read afterwards
+static vector<PropertyEntry_t> table;
+static vector<uint32_t> displacements;
+static uint64_t tableMask = 0;
+
+static uint64_t HashName(const char* name) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char* c = name; *c != '\0'; c++) {
+		hash ^= (uint8_t) *c;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static uint64_t Mix(uint64_t hash, uint64_t seed) {
+	// splitmix64 finalizer, FNV-1a alone spreads the low bits poorly
+	hash ^= seed * 0x9e3779b97f4a7c15ULL;
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+
+	return hash ^ (hash >> 31);
+}
+
+static bool CompareBucketSize(const vector<size_t>& a, const vector<size_t>& b) {
+	return a.size() > b.size();
+}
+
+bool CompilePropertyTable(const vector<string>& names) {
+	vector<string> uniqueNames;
+	vector<int> slots;
+	vector<uint64_t> hashes;
+	for (size_t i = 0; i < names.size(); i++) {
+		if (names[i].empty() || find(uniqueNames.begin(), uniqueNames.end(), names[i]) != uniqueNames.end()) {
+			continue;
+		}
+		uniqueNames.push_back(names[i]);
+		slots.push_back((int) i);
+		hashes.push_back(HashName(names[i].c_str()));
+	}
+
+	uint64_t size = PROPERTY_TABLE_MIN_SIZE;
+	while (size < uniqueNames.size() * 2) {
+		size <<= 1;
+	}
+	size_t bucketCount = uniqueNames.size() / PROPERTY_TABLE_BUCKET_LOAD + 1;
+
+	vector<vector<size_t> > buckets(bucketCount);
+	vector<size_t> bucketIndex(uniqueNames.size());
+	for (size_t i = 0; i < uniqueNames.size(); i++) {
+		bucketIndex[i] = Mix(hashes[i], 0) % bucketCount;
+		buckets[bucketIndex[i]].push_back(i);
+	}
+
+	// Place the crowded buckets first, while most slots are still free
+	vector<vector<size_t> > sorted(buckets);
+	stable_sort(sorted.begin(), sorted.end(), CompareBucketSize);
+
+	vector<PropertyEntry_t> candidate(size);
+	for (uint64_t i = 0; i < size; i++) {
+		candidate[i].slot = PROPERTY_SLOT_NONE;
+	}
+	vector<uint32_t> candidateDisplacements(bucketCount, 0);
+
+	for (size_t b = 0; b < sorted.size() && !sorted[b].empty(); b++) {
+		const vector<size_t>& bucket = sorted[b];
+		bool isPlaced = false;
+
+		for (uint32_t displacement = 1; displacement < PROPERTY_TABLE_MAX_DISPLACEMENT && !isPlaced; displacement++) {
+			vector<uint64_t> targets;
+			for (size_t k = 0; k < bucket.size(); k++) {
+				uint64_t target = Mix(hashes[bucket[k]], displacement) & (size - 1);
+				if (candidate[target].slot != PROPERTY_SLOT_NONE || find(targets.begin(), targets.end(), target) != targets.end()) {
+					break;
+				}
+				targets.push_back(target);
+			}
+			if (targets.size() != bucket.size()) {
+				continue;
+			}
+
+			for (size_t k = 0; k < bucket.size(); k++) {
+				PropertyEntry_t* entry = &candidate[targets[k]];
+				entry->hash = hashes[bucket[k]];
+				entry->slot = slots[bucket[k]];
+				entry->name = uniqueNames[bucket[k]];
+			}
+			candidateDisplacements[bucketIndex[bucket[0]]] = displacement;
+			isPlaced = true;
+		}
+
+		if (!isPlaced) {
+			return false;
+		}
+	}
+
+	table.swap(candidate);
+	displacements.swap(candidateDisplacements);
+	tableMask = size - 1;
+
+	return true;
+}
+
+int LookupProperty(const char* name) {
+	if (table.empty()) {
+		return PROPERTY_SLOT_NONE;
+	}
+
+	uint64_t hash = HashName(name);
+	uint32_t displacement = displacements[Mix(hash, 0) % displacements.size()];
+	const PropertyEntry_t& entry = table[Mix(hash, displacement) & tableMask];
+	if (entry.slot == PROPERTY_SLOT_NONE || entry.hash != hash || entry.name != name) {
+		return PROPERTY_SLOT_NONE;
+	}
+
+	return entry.slot;
+}
+
+void ParsePropertyList(const char* value, vector<string>* names) {
+	if (value == NULL) {
+		return;
+	}
+
+	const char* start = value;
+	while (true) {
+		const char* end = strchr(start, ',');
+		size_t length = end != NULL ? (size_t) (end - start) : strlen(start);
+
+		// Allow `A, B`
+		while (length > 0 && *start == ' ') {
+			start++;
+			length--;
+		}
+		while (length > 0 && start[length - 1] == ' ') {
+			length--;
+		}
+		if (length > 0) {
+			names->push_back(string(start, length));
+		}
+
+		if (end == NULL) {
+			break;
+		}
+		start = end + 1;
+	}
+}
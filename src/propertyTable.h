@@ -0,0 +1,23 @@
+#ifndef _PROPERTY_TABLE_H
+#define _PROPERTY_TABLE_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Perfect-hash table for classifying udev property names. The names are
+ * compiled once, so each property of a device costs one hash and at most
+ * one string compare, however many names are configured.
+ */
+#define PROPERTIES_ENV "USB_DETECTION_PROPERTIES"
+
+#define PROPERTY_SLOT_NONE -1
+
+// `names[i]` is looked up as slot `i`, duplicates keep their first slot
+bool CompilePropertyTable(const std::vector<std::string>& names);
+int LookupProperty(const char* name);
+
+// Splits a comma separated list as given in `PROPERTIES_ENV`
+void ParsePropertyList(const char* value, std::vector<std::string>* names);
+
+#endif
@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+
+#include "serializer.h"
+
+using namespace std;
+
+/*
+ * Same keys as the JS device objects (see `deviceFields` in detection.cpp),
+ * indexed by the bit of the field in `DeviceField_t`.
+ */
+static const char* fieldNames[] = {
+	"locationId",
+	"vendorId",
+	"productId",
+	"deviceName",
+	"manufacturer",
+	"serialNumber",
+	"deviceAddress",
+	"portPath",
+	"childDevNodes",
+	"properties",
+	"deviceClass",
+	"deviceSubClass",
+	"deviceProtocol",
+	"interfaces",
+};
+
+#define FIELD_NAME_COUNT (sizeof(fieldNames) / sizeof(fieldNames[0]))
+
+/*
+ * Writes into `out`, or only counts the bytes when `out` is NULL so the
+ * same code sizes the buffer first.
+ */
+class ByteWriter {
+	public:
+		explicit ByteWriter(char* out) : out(out), offset(0) {}
+
+		void Bytes(const void* data, size_t length) {
+			if (out != NULL) {
+				memcpy(out + offset, data, length);
+			}
+			offset += length;
+		}
+
+		void Byte(uint8_t value) {
+			Bytes(&value, 1);
+		}
+
+		void Text(const char* text) {
+			Bytes(text, strlen(text));
+		}
+
+		void Varint(uint32_t value) {
+			while (value >= 0x80) {
+				Byte((uint8_t) (value | 0x80));
+				value >>= 7;
+			}
+			Byte((uint8_t) value);
+		}
+
+		size_t Size() {
+			return offset;
+		}
+
+	private:
+		char* out;
+		size_t offset;
+};
+
+/**********************************
+ * NDJSON
+ **********************************/
+static void JsonString(ByteWriter* writer, const string& value) {
+	writer->Byte('"');
+	size_t start = 0;
+	for (size_t i = 0; i < value.size(); i++) {
+		unsigned char c = value[i];
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+
+		writer->Bytes(value.data() + start, i - start);
+		start = i + 1;
+		if (c == '"' || c == '\\') {
+			writer->Byte('\\');
+			writer->Byte(c);
+		}
+		else {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			writer->Text(escaped);
+		}
+	}
+	writer->Bytes(value.data() + start, value.size() - start);
+	writer->Byte('"');
+}
+
+static void JsonNumber(ByteWriter* writer, int value) {
+	char number[16];
+	snprintf(number, sizeof(number), "%d", value);
+	writer->Text(number);
+}
+
+static void JsonField(ByteWriter* writer, ListResultItem_t* item, int field) {
+	switch (field) {
+		case DeviceField_LocationId: JsonNumber(writer, item->locationId); break;
+		case DeviceField_VendorId: JsonNumber(writer, item->vendorId); break;
+		case DeviceField_ProductId: JsonNumber(writer, item->productId); break;
+		case DeviceField_DeviceName: JsonString(writer, item->deviceName); break;
+		case DeviceField_Manufacturer: JsonString(writer, item->manufacturer); break;
+		case DeviceField_SerialNumber: JsonString(writer, item->serialNumber); break;
+		case DeviceField_DeviceAddress: JsonNumber(writer, item->deviceAddress); break;
+		case DeviceField_PortPath: JsonString(writer, item->portPath); break;
+		case DeviceField_ChildDevNodes:
+			writer->Byte('[');
+			for (size_t i = 0; i < item->childDevNodes.size(); i++) {
+				if (i > 0) {
+					writer->Byte(',');
+				}
+				JsonString(writer, item->childDevNodes[i]);
+			}
+			writer->Byte(']');
+			break;
+		case DeviceField_Properties:
+			writer->Byte('{');
+			for (DeviceProperties_t::iterator it = item->properties.begin(); it != item->properties.end(); ++it) {
+				if (it != item->properties.begin()) {
+					writer->Byte(',');
+				}
+				JsonString(writer, it->first);
+				writer->Byte(':');
+				JsonString(writer, it->second);
+			}
+			writer->Byte('}');
+			break;
+		case DeviceField_DeviceClass: JsonNumber(writer, item->deviceClass); break;
+		case DeviceField_DeviceSubClass: JsonNumber(writer, item->deviceSubClass); break;
+		case DeviceField_DeviceProtocol: JsonNumber(writer, item->deviceProtocol); break;
+		case DeviceField_Interfaces:
+			writer->Byte('[');
+			for (size_t i = 0; i < item->interfaces.size(); i++) {
+				if (i > 0) {
+					writer->Byte(',');
+				}
+				writer->Text("{\"interfaceClass\":");
+				JsonNumber(writer, item->interfaces[i].interfaceClass);
+				writer->Text(",\"interfaceSubClass\":");
+				JsonNumber(writer, item->interfaces[i].interfaceSubClass);
+				writer->Text(",\"interfaceProtocol\":");
+				JsonNumber(writer, item->interfaces[i].interfaceProtocol);
+				writer->Byte('}');
+			}
+			writer->Byte(']');
+			break;
+	}
+}
+
+static void WriteNdjson(ByteWriter* writer, DeviceResults_t* results, int fields) {
+	for (size_t i = 0; i < results->count; i++) {
+		bool isFirst = true;
+		writer->Byte('{');
+		for (size_t bit = 0; bit < FIELD_NAME_COUNT; bit++) {
+			int field = 1 << bit;
+			if ((fields & field) == 0) {
+				continue;
+			}
+
+			if (!isFirst) {
+				writer->Byte(',');
+			}
+			isFirst = false;
+			writer->Byte('"');
+			writer->Text(fieldNames[bit]);
+			writer->Text("\":");
+			JsonField(writer, &results->items[i], field);
+		}
+		writer->Text("}\n");
+	}
+}
+
+/**********************************
+ * Binary
+ **********************************/
+static void BinaryString(ByteWriter* writer, const string& value) {
+	writer->Varint(value.size());
+	writer->Bytes(value.data(), value.size());
+}
+
+static void BinaryField(ByteWriter* writer, ListResultItem_t* item, int field) {
+	switch (field) {
+		case DeviceField_LocationId: writer->Varint(item->locationId); break;
+		case DeviceField_VendorId: writer->Varint(item->vendorId); break;
+		case DeviceField_ProductId: writer->Varint(item->productId); break;
+		case DeviceField_DeviceName: BinaryString(writer, item->deviceName); break;
+		case DeviceField_Manufacturer: BinaryString(writer, item->manufacturer); break;
+		case DeviceField_SerialNumber: BinaryString(writer, item->serialNumber); break;
+		case DeviceField_DeviceAddress: writer->Varint(item->deviceAddress); break;
+		case DeviceField_PortPath: BinaryString(writer, item->portPath); break;
+		case DeviceField_ChildDevNodes:
+			writer->Varint(item->childDevNodes.size());
+			for (size_t i = 0; i < item->childDevNodes.size(); i++) {
+				BinaryString(writer, item->childDevNodes[i]);
+			}
+			break;
+		case DeviceField_Properties:
+			writer->Varint(item->properties.size());
+			for (DeviceProperties_t::iterator it = item->properties.begin(); it != item->properties.end(); ++it) {
+				BinaryString(writer, it->first);
+				BinaryString(writer, it->second);
+			}
+			break;
+		case DeviceField_DeviceClass: writer->Varint(item->deviceClass); break;
+		case DeviceField_DeviceSubClass: writer->Varint(item->deviceSubClass); break;
+		case DeviceField_DeviceProtocol: writer->Varint(item->deviceProtocol); break;
+		case DeviceField_Interfaces:
+			writer->Varint(item->interfaces.size());
+			for (size_t i = 0; i < item->interfaces.size(); i++) {
+				writer->Byte((uint8_t) item->interfaces[i].interfaceClass);
+				writer->Byte((uint8_t) item->interfaces[i].interfaceSubClass);
+				writer->Byte((uint8_t) item->interfaces[i].interfaceProtocol);
+			}
+			break;
+	}
+}
+
+static void WriteBinary(ByteWriter* writer, DeviceResults_t* results, int fields, bool provisional) {
+	writer->Bytes(SERIALIZE_BINARY_MAGIC, SERIALIZE_BINARY_MAGIC_LENGTH);
+	writer->Byte(SERIALIZE_BINARY_VERSION);
+	writer->Byte(provisional ? SERIALIZE_FLAG_PROVISIONAL : 0);
+	writer->Varint(fields);
+	writer->Varint(results->count);
+
+	for (size_t i = 0; i < results->count; i++) {
+		for (size_t bit = 0; bit < FIELD_NAME_COUNT; bit++) {
+			int field = 1 << bit;
+			if (fields & field) {
+				BinaryField(writer, &results->items[i], field);
+			}
+		}
+	}
+}
+
+static void WriteDevices(ByteWriter* writer, DeviceResults_t* results, int fields, SerializeFormat_t format, bool provisional) {
+	if (format == SerializeFormat_Binary) {
+		WriteBinary(writer, results, fields, provisional);
+	}
+	else {
+		WriteNdjson(writer, results, fields);
+	}
+}
+
+char* SerializeDevices(DeviceResults_t* results, int fields, SerializeFormat_t format, bool provisional, size_t* length) {
+	ByteWriter counter(NULL);
+	WriteDevices(&counter, results, fields, format, provisional);
+
+	*length = counter.Size();
+	// Never 0 bytes, malloc(0) may return NULL
+	char* buffer = (char*) malloc(*length > 0 ? *length : 1);
+	if (buffer == NULL) {
+		*length = 0;
+		return NULL;
+	}
+
+	ByteWriter writer(buffer);
+	WriteDevices(&writer, results, fields, format, provisional);
+
+	return buffer;
+}
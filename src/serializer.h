@@ -0,0 +1,36 @@
+#ifndef _SERIALIZER_H
+#define _SERIALIZER_H
+
+#include <stddef.h>
+
+#include "deviceList.h"
+
+/*
+ * Devices straight to bytes, for `serialize` which hands the result to JS
+ * as a Buffer without building any JS objects.
+ *
+ * NDJSON: one JSON object per device and line, with the same keys as the
+ * device objects.
+ *
+ * Binary, decoded by `decode.js`:
+ *   header: "USBL", uint8 version, uint8 flags, varint field mask, varint count
+ *   records: the fields of the mask in `DeviceField_t` order, numbers as
+ *     unsigned 32-bit varints, strings as varint length + UTF-8, lists as
+ *     varint count + items, interfaces as 3 bytes each
+ */
+#define SERIALIZE_BINARY_MAGIC "USBL"
+#define SERIALIZE_BINARY_MAGIC_LENGTH 4
+#define SERIALIZE_BINARY_VERSION 1
+
+// Header flags
+#define SERIALIZE_FLAG_PROVISIONAL 0x01
+
+typedef enum _SerializeFormat_t {
+	SerializeFormat_Ndjson,
+	SerializeFormat_Binary,
+} SerializeFormat_t;
+
+// The first `results->count` devices, returns a malloc'ed buffer of `*length` bytes
+char* SerializeDevices(DeviceResults_t* results, int fields, SerializeFormat_t format, bool provisional, size_t* length);
+
+#endif
@@ -0,0 +1,481 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <string>
+
+#include "sharedRegistry.h"
+
+using namespace std;
+
+#define SHARED_MAGIC 0x55534244 // "USBD"
+#define SHARED_VERSION 4
+
+#define SHARED_MAX_DEVICES 256
+#define SHARED_RING_SIZE 256
+
+#define SHARED_KEY_LENGTH 64
+#define SHARED_STRING_LENGTH 128
+#define SHARED_PORT_PATH_LENGTH 32
+#define SHARED_CHILD_DEV_NODES_LENGTH 256
+#define SHARED_PROPERTIES_LENGTH 512
+#define SHARED_MAX_INTERFACES 32
+
+// Publishing takes microseconds, a list which stays odd this long never gets done
+#define SHARED_LOAD_RETRIES 10000
+
+/*
+ * Everything in the segment is plain fixed-size data, longer strings are
+ * truncated. Child nodes are stored newline separated, properties as
+ * `NAME=value` lines, interface classes as class/subclass/protocol bytes.
+ */
+typedef struct {
+	char key[SHARED_KEY_LENGTH];
+	int32_t locationId;
+	int32_t vendorId;
+	int32_t productId;
+	int32_t deviceAddress;
+	char deviceName[SHARED_STRING_LENGTH];
+	char manufacturer[SHARED_STRING_LENGTH];
+	char serialNumber[SHARED_STRING_LENGTH];
+	char portPath[SHARED_PORT_PATH_LENGTH];
+	char childDevNodes[SHARED_CHILD_DEV_NODES_LENGTH];
+	char properties[SHARED_PROPERTIES_LENGTH];
+	uint8_t deviceClass;
+	uint8_t deviceSubClass;
+	uint8_t deviceProtocol;
+	uint8_t interfaceCount;
+	uint8_t interfaces[SHARED_MAX_INTERFACES][3];
+} SharedDevice_t;
+
+typedef struct {
+	// Written last, a reader compares it before and after copying the slot
+	uint64_t seq;
+	uint32_t isAdded;
+	SharedDevice_t device;
+} SharedSlot_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	int32_t producerPid;
+	// Bumped with every event, what the consumers futex-wait on
+	uint32_t futexWord;
+	uint64_t eventSeq;
+	// Seqlock over `listEventSeq`, `deviceCount` and `devices`, odd while being written
+	uint64_t listSeq;
+	// The last event the list contains, it is published less often than the events
+	uint64_t listEventSeq;
+	// Of the producer's list, only up to `SHARED_MAX_DEVICES` of them fit into `devices`
+	uint32_t deviceCount;
+	SharedDevice_t devices[SHARED_MAX_DEVICES];
+	SharedSlot_t ring[SHARED_RING_SIZE];
+} SharedSegment_t;
+
+static int segmentFd = -1;
+static SharedSegment_t* segment = NULL;
+static bool isWritable = false;
+static bool isProducer = false;
+
+static void CopyString(char* dst, const string& src, size_t size) {
+	size_t length = src.size() < size - 1 ? src.size() : size - 1;
+	memcpy(dst, src.data(), length);
+	dst[length] = '\0';
+}
+
+static string ReadString(const char* src, size_t size) {
+	return string(src, strnlen(src, size));
+}
+
+static void ToSharedDevice(SharedDevice_t* dst, const char* key, ListResultItem_t* item) {
+	memset(dst, 0, sizeof(SharedDevice_t));
+	CopyString(dst->key, key, sizeof(dst->key));
+	dst->locationId = item->locationId;
+	dst->vendorId = item->vendorId;
+	dst->productId = item->productId;
+	dst->deviceAddress = item->deviceAddress;
+	CopyString(dst->deviceName, item->deviceName, sizeof(dst->deviceName));
+	CopyString(dst->manufacturer, item->manufacturer, sizeof(dst->manufacturer));
+	CopyString(dst->serialNumber, item->serialNumber, sizeof(dst->serialNumber));
+	CopyString(dst->portPath, item->portPath, sizeof(dst->portPath));
+
+	string childDevNodes;
+	for (vector<string>::iterator it = item->childDevNodes.begin(); it != item->childDevNodes.end(); ++it) {
+		if (childDevNodes.size() + it->size() + 1 >= sizeof(dst->childDevNodes)) {
+			break;
+		}
+		childDevNodes += *it + "\n";
+	}
+	CopyString(dst->childDevNodes, childDevNodes, sizeof(dst->childDevNodes));
+
+	string properties;
+	for (DeviceProperties_t::iterator it = item->properties.begin(); it != item->properties.end(); ++it) {
+		string line = it->first + "=" + it->second + "\n";
+		// udev values are single line, but better not split a record on them
+		if (line.find('\n') != line.size() - 1 || properties.size() + line.size() >= sizeof(dst->properties)) {
+			continue;
+		}
+		properties += line;
+	}
+	CopyString(dst->properties, properties, sizeof(dst->properties));
+
+	dst->deviceClass = item->deviceClass;
+	dst->deviceSubClass = item->deviceSubClass;
+	dst->deviceProtocol = item->deviceProtocol;
+	for (size_t i = 0; i < item->interfaces.size() && i < SHARED_MAX_INTERFACES; i++) {
+		dst->interfaces[i][0] = item->interfaces[i].interfaceClass;
+		dst->interfaces[i][1] = item->interfaces[i].interfaceSubClass;
+		dst->interfaces[i][2] = item->interfaces[i].interfaceProtocol;
+		dst->interfaceCount++;
+	}
+}
+
+static void FromSharedDevice(ListResultItem_t* dst, string* key, const SharedDevice_t* src) {
+	*key = ReadString(src->key, sizeof(src->key));
+	dst->locationId = src->locationId;
+	dst->vendorId = src->vendorId;
+	dst->productId = src->productId;
+	dst->deviceAddress = src->deviceAddress;
+	dst->deviceName = ReadString(src->deviceName, sizeof(src->deviceName));
+	dst->manufacturer = ReadString(src->manufacturer, sizeof(src->manufacturer));
+	dst->serialNumber = ReadString(src->serialNumber, sizeof(src->serialNumber));
+	dst->portPath = ReadString(src->portPath, sizeof(src->portPath));
+
+	string childDevNodes = ReadString(src->childDevNodes, sizeof(src->childDevNodes));
+	size_t start = 0;
+	size_t end;
+	while ((end = childDevNodes.find('\n', start)) != string::npos) {
+		dst->childDevNodes.push_back(childDevNodes.substr(start, end - start));
+		start = end + 1;
+	}
+
+	string properties = ReadString(src->properties, sizeof(src->properties));
+	start = 0;
+	while ((end = properties.find('\n', start)) != string::npos) {
+		string line = properties.substr(start, end - start);
+		size_t separator = line.find('=');
+		if (separator != string::npos) {
+			dst->properties[line.substr(0, separator)] = line.substr(separator + 1);
+		}
+		start = end + 1;
+	}
+
+	dst->deviceClass = src->deviceClass;
+	dst->deviceSubClass = src->deviceSubClass;
+	dst->deviceProtocol = src->deviceProtocol;
+	for (int i = 0; i < src->interfaceCount && i < SHARED_MAX_INTERFACES; i++) {
+		UsbInterfaceClass_t descriptor;
+		descriptor.interfaceClass = src->interfaces[i][0];
+		descriptor.interfaceSubClass = src->interfaces[i][1];
+		descriptor.interfaceProtocol = src->interfaces[i][2];
+		dst->interfaces.push_back(descriptor);
+	}
+}
+
+static bool Map(bool writable) {
+	if (segment != NULL) {
+		munmap(segment, sizeof(SharedSegment_t));
+	}
+
+	void* mapped = mmap(NULL, sizeof(SharedSegment_t), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, segmentFd, 0);
+	if (mapped == MAP_FAILED) {
+		segment = NULL;
+		return false;
+	}
+
+	segment = (SharedSegment_t*) mapped;
+	isWritable = writable;
+	return true;
+}
+
+static bool IsSegmentValid() {
+	return __atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) == SHARED_MAGIC && segment->version == SHARED_VERSION;
+}
+
+/*
+ * Whoever can write the segment can become the producer and feed devices
+ * to every process, so it is the owner's only unless configured otherwise.
+ */
+static mode_t GetSegmentMode() {
+	const char* value = getenv(SHARED_REGISTRY_MODE_ENV);
+	if (value == NULL || *value == '\0') {
+		return SHARED_REGISTRY_MODE_DEFAULT;
+	}
+
+	char* end;
+	long mode = strtol(value, &end, 8);
+	if (*end != '\0' || mode < 0 || mode > 0777) {
+		return SHARED_REGISTRY_MODE_DEFAULT;
+	}
+
+	return (mode_t) mode;
+}
+
+bool SharedRegistryOpen(const char* name) {
+	string path = string("/usb-detection-") + name;
+	mode_t mode = GetSegmentMode();
+
+	segmentFd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, mode);
+	if (segmentFd >= 0) {
+		// Exactly the configured mode, not what the umask leaves of it
+		fchmod(segmentFd, mode);
+	}
+	else if (errno == EEXIST) {
+		segmentFd = shm_open(path.c_str(), O_RDWR, 0);
+	}
+	if (segmentFd < 0) {
+		return false;
+	}
+
+	// Someone else created it with wider access than ours, don't trust what is in it.
+	// Whoever comes first sizes it, the size never changes afterwards
+	struct stat info;
+	if (
+		fstat(segmentFd, &info) != 0 ||
+		(info.st_mode & 0777 & ~mode) != 0 ||
+		((size_t) info.st_size < sizeof(SharedSegment_t) && ftruncate(segmentFd, sizeof(SharedSegment_t)) != 0)
+	) {
+		SharedRegistryClose();
+		return false;
+	}
+
+	if (!Map(false)) {
+		SharedRegistryClose();
+		return false;
+	}
+
+	return true;
+}
+
+void SharedRegistryClose() {
+	SharedRegistryResign();
+
+	if (segment != NULL) {
+		munmap(segment, sizeof(SharedSegment_t));
+		segment = NULL;
+	}
+	if (segmentFd >= 0) {
+		close(segmentFd);
+		segmentFd = -1;
+	}
+}
+
+bool SharedRegistryHasProducer() {
+	if (segment == NULL || isProducer) {
+		return false;
+	}
+
+	// The producer holds an exclusive lock, so a shared one only works without it
+	if (flock(segmentFd, LOCK_SH | LOCK_NB) == 0) {
+		flock(segmentFd, LOCK_UN);
+		return false;
+	}
+
+	return IsSegmentValid();
+}
+
+bool SharedRegistryIsProducer() {
+	return isProducer;
+}
+
+bool SharedRegistryTryBecomeProducer() {
+	if (segment == NULL) {
+		return false;
+	}
+	if (isProducer) {
+		return true;
+	}
+
+	if (flock(segmentFd, LOCK_EX | LOCK_NB) != 0) {
+		return false;
+	}
+
+	if (!Map(true)) {
+		flock(segmentFd, LOCK_UN);
+		return false;
+	}
+
+	// Keep the event sequence going so consumers see a continuous stream
+	if (!IsSegmentValid()) {
+		memset(segment, 0, sizeof(SharedSegment_t));
+		segment->version = SHARED_VERSION;
+		__atomic_store_n(&segment->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+	}
+	segment->producerPid = getpid();
+	isProducer = true;
+
+	// The previous producer died while publishing, the list it left is torn
+	// and stays odd until somebody publishes over it
+	if (segment->listSeq & 1) {
+		SharedRegistryPublishList();
+	}
+
+	return true;
+}
+
+void SharedRegistryResign() {
+	if (!isProducer) {
+		return;
+	}
+
+	isProducer = false;
+	flock(segmentFd, LOCK_UN);
+	Map(false);
+}
+
+bool SharedRegistryLoadList(list<KeyedDeviceItem_t>* items, uint64_t* eventSeq) {
+	*eventSeq = 0;
+	if (segment == NULL || !IsSegmentValid()) {
+		return true;
+	}
+
+	static SharedDevice_t devices[SHARED_MAX_DEVICES];
+	uint32_t count;
+	uint64_t before;
+	uint64_t after;
+	int retries = 0;
+	do {
+		if (retries++ == SHARED_LOAD_RETRIES) {
+			return false;
+		}
+
+		before = __atomic_load_n(&segment->listSeq, __ATOMIC_ACQUIRE);
+		if (before & 1) {
+			sched_yield();
+			continue;
+		}
+
+		*eventSeq = segment->listEventSeq;
+		count = segment->deviceCount;
+		if (count <= SHARED_MAX_DEVICES) {
+			memcpy(devices, segment->devices, count * sizeof(SharedDevice_t));
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&segment->listSeq, __ATOMIC_RELAXED);
+	} while ((before & 1) || before != after);
+
+	if (count > SHARED_MAX_DEVICES) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		DeviceItem_t* item = new DeviceItem_t();
+		string key;
+		FromSharedDevice(&item->deviceParams, &key, &devices[i]);
+		item->deviceState = DeviceState_Connect;
+		items->push_back(KeyedDeviceItem_t(key, item));
+	}
+
+	return true;
+}
+
+SharedWaitResult_t SharedRegistryWaitForEvents(uint64_t* lastSeq, list<SharedEvent_t>* events, int timeoutMs) {
+	if (segment == NULL || !IsSegmentValid()) {
+		usleep(timeoutMs * 1000);
+		return SharedWait_Timeout;
+	}
+
+	uint32_t futexWord = __atomic_load_n(&segment->futexWord, __ATOMIC_ACQUIRE);
+	uint64_t eventSeq = __atomic_load_n(&segment->eventSeq, __ATOMIC_ACQUIRE);
+	if (eventSeq == *lastSeq) {
+		struct timespec timeout;
+		timeout.tv_sec = timeoutMs / 1000;
+		timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+		// Not FUTEX_PRIVATE_FLAG, the waiters live in other processes
+		syscall(SYS_futex, &segment->futexWord, FUTEX_WAIT, futexWord, &timeout, NULL, 0);
+
+		eventSeq = __atomic_load_n(&segment->eventSeq, __ATOMIC_ACQUIRE);
+		if (eventSeq == *lastSeq) {
+			return SharedWait_Timeout;
+		}
+	}
+
+	// A new producer started the sequence over, or we fell too far behind
+	if (eventSeq < *lastSeq || eventSeq - *lastSeq > SHARED_RING_SIZE) {
+		*lastSeq = eventSeq;
+		return SharedWait_Overrun;
+	}
+
+	for (uint64_t seq = *lastSeq + 1; seq <= eventSeq; seq++) {
+		SharedSlot_t* slot = &segment->ring[seq % SHARED_RING_SIZE];
+
+		SharedEvent_t event;
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq) {
+			*lastSeq = eventSeq;
+			return SharedWait_Overrun;
+		}
+		event.seq = seq;
+		event.isAdded = slot->isAdded != 0;
+		FromSharedDevice(&event.item, &event.key, &slot->device);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+			*lastSeq = eventSeq;
+			return SharedWait_Overrun;
+		}
+
+		events->push_back(event);
+	}
+
+	*lastSeq = eventSeq;
+	return SharedWait_Events;
+}
+
+void SharedRegistryPublishList() {
+	if (!isProducer || !isWritable) {
+		return;
+	}
+
+	list<KeyedDeviceItem_t> items;
+	CreateItemSnapshot(&items);
+
+	// Odd if a producer died half way, we finish its publish then
+	uint64_t listSeq = segment->listSeq & ~(uint64_t) 1;
+	__atomic_store_n(&segment->listSeq, listSeq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	uint32_t count = 0;
+	for (list<KeyedDeviceItem_t>::iterator it = items.begin(); it != items.end(); ++it) {
+		if (count < SHARED_MAX_DEVICES) {
+			ToSharedDevice(&segment->devices[count], it->first.c_str(), &it->second->deviceParams);
+		}
+		count++;
+		delete it->second;
+	}
+	// Even if they did not all fit, so consumers know the list is incomplete
+	segment->deviceCount = count;
+	// Only the monitor thread publishes, so the list has every event so far
+	segment->listEventSeq = segment->eventSeq;
+
+	__atomic_store_n(&segment->listSeq, listSeq + 2, __ATOMIC_RELEASE);
+}
+
+void SharedRegistryPublishEvent(const char* key, ListResultItem_t* item, bool isAdded) {
+	if (!isProducer || !isWritable) {
+		return;
+	}
+
+	uint64_t seq = segment->eventSeq + 1;
+	SharedSlot_t* slot = &segment->ring[seq % SHARED_RING_SIZE];
+
+	// Invalidate the slot first so a lagging reader can tell it was reused
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->isAdded = isAdded ? 1 : 0;
+	ToSharedDevice(&slot->device, key, item);
+	__atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&segment->eventSeq, seq, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&segment->futexWord, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &segment->futexWord, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
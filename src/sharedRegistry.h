@@ -0,0 +1,55 @@
+#ifndef _SHARED_REGISTRY_H
+#define _SHARED_REGISTRY_H
+
+#include <list>
+#include <stdint.h>
+
+#include "deviceList.h"
+
+/*
+ * Opt-in device list shared by every process on the host (Linux only).
+ *
+ * One process, the producer, holds an exclusive lock on the segment while
+ * it is monitoring. It publishes its device list and every add/remove into
+ * a POSIX shared-memory segment, the other processes only map it and wait
+ * on a futex for new events. The lock is released by the kernel when the
+ * producer dies, so the next waiting process takes over.
+ */
+#define SHARED_REGISTRY_ENV "USB_DETECTION_SHARED"
+// Octal permissions of the segment, e.g. 0660 to share it with a group
+#define SHARED_REGISTRY_MODE_ENV "USB_DETECTION_SHARED_MODE"
+#define SHARED_REGISTRY_MODE_DEFAULT 0600
+
+typedef struct {
+	uint64_t seq;
+	bool isAdded;
+	std::string key;
+	ListResultItem_t item;
+} SharedEvent_t;
+
+typedef enum _SharedWaitResult_t {
+	SharedWait_Events,
+	SharedWait_Timeout,
+	// The ring wrapped before we could read it, the list has to be reloaded
+	SharedWait_Overrun,
+} SharedWaitResult_t;
+
+bool SharedRegistryOpen(const char* name);
+void SharedRegistryClose();
+bool SharedRegistryHasProducer();
+bool SharedRegistryIsProducer();
+bool SharedRegistryTryBecomeProducer();
+void SharedRegistryResign();
+
+/*
+ * `eventSeq` gets the last event the list contains. False, and nothing
+ * loaded, if the producer has more devices than fit into the segment or
+ * the list never stops being written.
+ */
+bool SharedRegistryLoadList(std::list<KeyedDeviceItem_t>* items, uint64_t* eventSeq);
+SharedWaitResult_t SharedRegistryWaitForEvents(uint64_t* lastSeq, std::list<SharedEvent_t>* events, int timeoutMs);
+
+void SharedRegistryPublishList();
+void SharedRegistryPublishEvent(const char* key, ListResultItem_t* item, bool isAdded);
+
+#endif
@@ -0,0 +1,336 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <uv.h>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+#include "snapshot.h"
+
+using namespace std;
+
+#define SNAPSHOT_MAGIC "USBDSNAP"
+#define SNAPSHOT_MAGIC_LENGTH 8
+#define SNAPSHOT_VERSION 3
+
+typedef struct {
+	char magic[SNAPSHOT_MAGIC_LENGTH];
+	uint32_t version;
+	uint32_t count;
+	uint64_t payloadSize;
+	uint64_t checksum;
+} SnapshotHeader_t;
+
+// Writes from the monitor thread and the main thread must not interleave
+static uv_once_t snapshotOnce = UV_ONCE_INIT;
+static uv_mutex_t snapshotMutex;
+
+static void InitSnapshotMutex() {
+	uv_mutex_init(&snapshotMutex);
+}
+
+static uint64_t Fnv1a(const char* data, size_t length) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char) data[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/*
+ * Serializes into `out`, or only counts the bytes when `out` is NULL so
+ * the same code sizes the file before it is mapped.
+ */
+class SnapshotWriter {
+	public:
+		explicit SnapshotWriter(char* out) : out(out), offset(0) {}
+
+		void Bytes(const void* data, size_t length) {
+			if (out != NULL) {
+				memcpy(out + offset, data, length);
+			}
+			offset += length;
+		}
+
+		void Int(int32_t value) {
+			Bytes(&value, sizeof(value));
+		}
+
+		void String(const string& value) {
+			uint32_t length = value.size();
+			Bytes(&length, sizeof(length));
+			Bytes(value.data(), length);
+		}
+
+		size_t Size() {
+			return offset;
+		}
+
+	private:
+		char* out;
+		size_t offset;
+};
+
+class SnapshotReader {
+	public:
+		SnapshotReader(const char* data, size_t length) : data(data), length(length), offset(0), failed(false) {}
+
+		bool Bytes(void* out, size_t count) {
+			if (failed || length - offset < count) {
+				failed = true;
+				return false;
+			}
+			memcpy(out, data + offset, count);
+			offset += count;
+			return true;
+		}
+
+		int32_t Int() {
+			int32_t value = 0;
+			Bytes(&value, sizeof(value));
+			return value;
+		}
+
+		string String() {
+			uint32_t size = 0;
+			if (!Bytes(&size, sizeof(size)) || length - offset < size) {
+				failed = true;
+				return string();
+			}
+			string value(data + offset, size);
+			offset += size;
+			return value;
+		}
+
+		bool Failed() {
+			return failed;
+		}
+
+	private:
+		const char* data;
+		size_t length;
+		size_t offset;
+		bool failed;
+};
+
+static void WriteRecord(SnapshotWriter* writer, const KeyedDeviceItem_t& keyed) {
+	ListResultItem_t* params = &keyed.second->deviceParams;
+
+	writer->String(keyed.first);
+	writer->Int(params->locationId);
+	writer->Int(params->vendorId);
+	writer->Int(params->productId);
+	writer->Int(params->deviceAddress);
+	writer->String(params->deviceName);
+	writer->String(params->manufacturer);
+	writer->String(params->serialNumber);
+	writer->String(params->portPath);
+
+	writer->Int(params->childDevNodes.size());
+	for (vector<string>::const_iterator it = params->childDevNodes.begin(); it != params->childDevNodes.end(); ++it) {
+		writer->String(*it);
+	}
+
+	writer->Int(params->properties.size());
+	for (DeviceProperties_t::const_iterator it = params->properties.begin(); it != params->properties.end(); ++it) {
+		writer->String(it->first);
+		writer->String(it->second);
+	}
+
+	writer->Int(params->deviceClass);
+	writer->Int(params->deviceSubClass);
+	writer->Int(params->deviceProtocol);
+	writer->Int(params->interfaces.size());
+	for (vector<UsbInterfaceClass_t>::const_iterator it = params->interfaces.begin(); it != params->interfaces.end(); ++it) {
+		writer->Int(it->interfaceClass);
+		writer->Int(it->interfaceSubClass);
+		writer->Int(it->interfaceProtocol);
+	}
+
+	writer->Int(keyed.second->attributes.size());
+	for (DeviceAttributes_t::const_iterator it = keyed.second->attributes.begin(); it != keyed.second->attributes.end(); ++it) {
+		writer->String(it->first);
+		writer->String(it->second);
+	}
+}
+
+static DeviceItem_t* ReadRecord(SnapshotReader* reader, string* key) {
+	DeviceItem_t* item = new DeviceItem_t();
+	ListResultItem_t* params = &item->deviceParams;
+
+	*key = reader->String();
+	params->locationId = reader->Int();
+	params->vendorId = reader->Int();
+	params->productId = reader->Int();
+	params->deviceAddress = reader->Int();
+	params->deviceName = reader->String();
+	params->manufacturer = reader->String();
+	params->serialNumber = reader->String();
+	params->portPath = reader->String();
+
+	int32_t childCount = reader->Int();
+	for (int32_t i = 0; i < childCount && !reader->Failed(); i++) {
+		params->childDevNodes.push_back(reader->String());
+	}
+
+	int32_t propertyCount = reader->Int();
+	for (int32_t i = 0; i < propertyCount && !reader->Failed(); i++) {
+		string name = reader->String();
+		params->properties[name] = reader->String();
+	}
+
+	params->deviceClass = reader->Int();
+	params->deviceSubClass = reader->Int();
+	params->deviceProtocol = reader->Int();
+	int32_t interfaceCount = reader->Int();
+	for (int32_t i = 0; i < interfaceCount && !reader->Failed(); i++) {
+		UsbInterfaceClass_t descriptor;
+		descriptor.interfaceClass = reader->Int();
+		descriptor.interfaceSubClass = reader->Int();
+		descriptor.interfaceProtocol = reader->Int();
+		params->interfaces.push_back(descriptor);
+	}
+
+	int32_t attributeCount = reader->Int();
+	for (int32_t i = 0; i < attributeCount && !reader->Failed(); i++) {
+		string name = reader->String();
+		item->attributes[name] = reader->String();
+	}
+
+	item->deviceState = DeviceState_Connect;
+
+	return item;
+}
+
+#ifdef _WIN32
+
+bool LoadSnapshot(const char* path, list<KeyedDeviceItem_t>* items) {
+	return false;
+}
+
+bool WriteSnapshot(const char* path) {
+	return false;
+}
+
+#else
+
+bool LoadSnapshot(const char* path, list<KeyedDeviceItem_t>* items) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(SnapshotHeader_t)) {
+		close(fd);
+		return false;
+	}
+
+	size_t size = info.st_size;
+	void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+
+	const char* data = (const char*) mapped;
+	SnapshotHeader_t header;
+	memcpy(&header, data, sizeof(header));
+
+	const char* payload = data + sizeof(header);
+	bool valid = (
+		memcmp(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH) == 0 &&
+		header.version == SNAPSHOT_VERSION &&
+		header.payloadSize == size - sizeof(header) &&
+		header.checksum == Fnv1a(payload, header.payloadSize)
+	);
+
+	list<KeyedDeviceItem_t> loaded;
+	if (valid) {
+		SnapshotReader reader(payload, header.payloadSize);
+		for (uint32_t i = 0; i < header.count && !reader.Failed(); i++) {
+			string key;
+			DeviceItem_t* item = ReadRecord(&reader, &key);
+			loaded.push_back(KeyedDeviceItem_t(key, item));
+		}
+		valid = !reader.Failed();
+	}
+	munmap(mapped, size);
+
+	if (!valid) {
+		for (list<KeyedDeviceItem_t>::iterator it = loaded.begin(); it != loaded.end(); ++it) {
+			delete it->second;
+		}
+		return false;
+	}
+
+	items->splice(items->end(), loaded);
+	return true;
+}
+
+bool WriteSnapshot(const char* path) {
+	// Copy under the same lock as the rename, or a slower writer could
+	// rename an older list over a newer one
+	uv_once(&snapshotOnce, InitSnapshotMutex);
+	uv_mutex_lock(&snapshotMutex);
+
+	list<KeyedDeviceItem_t> items;
+	CreateItemSnapshot(&items);
+
+	SnapshotWriter sizer(NULL);
+	for (list<KeyedDeviceItem_t>::iterator it = items.begin(); it != items.end(); ++it) {
+		WriteRecord(&sizer, *it);
+	}
+	size_t size = sizeof(SnapshotHeader_t) + sizer.Size();
+
+	// Write next to the target and rename, readers never see a partial file
+	string temporaryPath = string(path) + ".tmp";
+	bool success = false;
+	int fd = open(temporaryPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0 && ftruncate(fd, size) == 0) {
+		void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mapped != MAP_FAILED) {
+			char* data = (char*) mapped;
+			SnapshotWriter writer(data + sizeof(SnapshotHeader_t));
+			for (list<KeyedDeviceItem_t>::iterator it = items.begin(); it != items.end(); ++it) {
+				WriteRecord(&writer, *it);
+			}
+
+			SnapshotHeader_t header;
+			memcpy(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH);
+			header.version = SNAPSHOT_VERSION;
+			header.count = items.size();
+			header.payloadSize = writer.Size();
+			header.checksum = Fnv1a(data + sizeof(header), header.payloadSize);
+			memcpy(data, &header, sizeof(header));
+
+			munmap(mapped, size);
+			// On disk before it replaces the old one, a crash must not leave an empty file behind
+			success = fsync(fd) == 0 && rename(temporaryPath.c_str(), path) == 0;
+		}
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (!success) {
+		unlink(temporaryPath.c_str());
+	}
+
+	uv_mutex_unlock(&snapshotMutex);
+
+	for (list<KeyedDeviceItem_t>::iterator it = items.begin(); it != items.end(); ++it) {
+		delete it->second;
+	}
+
+	return success;
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <list>
+
+#include "deviceList.h"
+
+/*
+ * Binary snapshot of the device list, used to answer `find` right away
+ * after a restart while the real enumeration runs in the background.
+ *
+ * Layout (little endian, as written by the host):
+ *   header: "USBDSNAP", uint32 version, uint32 count, uint64 payload size, uint64 FNV-1a of the payload
+ *   payload: `count` records, see `WriteRecord` in snapshot.cpp
+ */
+#define SNAPSHOT_ENV "USB_DETECTION_SNAPSHOT"
+
+bool LoadSnapshot(const char* path, std::list<KeyedDeviceItem_t>* items);
+bool WriteSnapshot(const char* path);
+
+#endif
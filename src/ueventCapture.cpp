@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "ueventCapture.h"
+
+using namespace std;
+
+#define CAPTURE_MAGIC "USBDCAPT"
+#define CAPTURE_MAGIC_LENGTH 8
+#define CAPTURE_VERSION 1
+
+// Capture. Only opened once per process, and the mutex and the condition
+// are never destroyed: the monitor thread may still be capturing while
+// `CloseCapture` runs at exit
+static bool isCaptureOpened = false;
+static FILE* captureFile = NULL;
+static uv_thread_t writerThread;
+static uv_mutex_t captureMutex;
+static uv_cond_t captureReady;
+// Encoded records the writer has not taken yet
+static string pendingRecords;
+static bool isCaptureClosing = false;
+static uint64_t lastCaptureNs = 0;
+
+// Replay, the whole capture is read up front
+static vector<char> replayData;
+static size_t replayOffset = 0;
+
+
+/**********************************
+ * Encoding
+ **********************************/
+static void AppendVarint(string* out, uint64_t value) {
+	while(value >= 0x80) {
+		out->push_back((char) (value | 0x80));
+		value >>= 7;
+	}
+	out->push_back((char) value);
+}
+
+static void AppendString(string* out, const string& value) {
+	AppendVarint(out, value.size());
+	out->append(value);
+}
+
+static void AppendValues(string* out, const UeventValues_t& values) {
+	AppendVarint(out, values.size());
+	for(UeventValues_t::const_iterator it = values.begin(); it != values.end(); ++it) {
+		AppendString(out, it->first);
+		AppendString(out, it->second);
+	}
+}
+
+static bool ReadVarint(uint64_t* value) {
+	*value = 0;
+	for(int shift = 0; shift < 64; shift += 7) {
+		if(replayOffset >= replayData.size()) {
+			return false;
+		}
+
+		uint8_t byte = (uint8_t) replayData[replayOffset++];
+		*value |= (uint64_t) (byte & 0x7f) << shift;
+		if((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool ReadByte(int* value) {
+	if(replayOffset >= replayData.size()) {
+		return false;
+	}
+
+	*value = (uint8_t) replayData[replayOffset++];
+	return true;
+}
+
+static bool ReadString(string* value) {
+	uint64_t length;
+	if(!ReadVarint(&length) || length > replayData.size() - replayOffset) {
+		return false;
+	}
+
+	value->assign(&replayData[0] + replayOffset, length);
+	replayOffset += length;
+	return true;
+}
+
+static bool ReadValues(UeventValues_t* values) {
+	uint64_t count;
+	if(!ReadVarint(&count)) {
+		return false;
+	}
+
+	values->clear();
+	for(uint64_t i = 0; i < count; i++) {
+		values->push_back(make_pair(string(), string()));
+		if(!ReadString(&values->back().first) || !ReadString(&values->back().second)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/**********************************
+ * Capture
+ **********************************/
+static void cbWriter(void* arg) {
+	string writing;
+
+	uv_mutex_lock(&captureMutex);
+	while(true) {
+		while(pendingRecords.empty() && !isCaptureClosing) {
+			uv_cond_wait(&captureReady, &captureMutex);
+		}
+		if(pendingRecords.empty()) {
+			break;
+		}
+
+		writing.swap(pendingRecords);
+		uv_mutex_unlock(&captureMutex);
+
+		fwrite(writing.data(), 1, writing.size(), captureFile);
+		// A crashing process should still leave everything up to the crash
+		fflush(captureFile);
+		writing.clear();
+
+		uv_mutex_lock(&captureMutex);
+	}
+	uv_mutex_unlock(&captureMutex);
+}
+
+bool OpenCapture(const char* path) {
+	if(isCaptureOpened) {
+		return captureFile != NULL;
+	}
+
+	captureFile = fopen(path, "wb");
+	if(captureFile == NULL) {
+		return false;
+	}
+
+	uint8_t version = CAPTURE_VERSION;
+	fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LENGTH, captureFile);
+	fwrite(&version, 1, 1, captureFile);
+	fflush(captureFile);
+
+	uv_mutex_init(&captureMutex);
+	uv_cond_init(&captureReady);
+	isCaptureClosing = false;
+	lastCaptureNs = uv_hrtime();
+	uv_thread_create(&writerThread, cbWriter, NULL);
+	isCaptureOpened = true;
+
+	// The writer flushes after every batch, this only catches the last one
+	atexit(CloseCapture);
+	return true;
+}
+
+void CaptureUevent(CapturedUevent_t* event) {
+	if(!isCaptureOpened) {
+		return;
+	}
+
+	uint64_t now = uv_hrtime();
+	event->delayUs = (now - lastCaptureNs) / 1000;
+	// Carry the remainder, so long captures don't drift
+	lastCaptureNs = now - (now - lastCaptureNs) % 1000;
+
+	string record;
+	AppendVarint(&record, event->delayUs);
+	record.push_back((char) event->action);
+	record.push_back((char) event->flags);
+	AppendString(&record, event->devNode);
+	AppendString(&record, event->sysName);
+	AppendString(&record, event->parentDevNode);
+	AppendValues(&record, event->properties);
+	AppendValues(&record, event->sysattrs);
+
+	// Dropped once closing, the writer may already be gone
+	uv_mutex_lock(&captureMutex);
+	if(!isCaptureClosing) {
+		pendingRecords.append(record);
+		uv_cond_signal(&captureReady);
+	}
+	uv_mutex_unlock(&captureMutex);
+}
+
+void CloseCapture() {
+	if(!isCaptureOpened) {
+		return;
+	}
+
+	uv_mutex_lock(&captureMutex);
+	bool wasClosing = isCaptureClosing;
+	isCaptureClosing = true;
+	uv_cond_signal(&captureReady);
+	uv_mutex_unlock(&captureMutex);
+	if(wasClosing) {
+		return;
+	}
+
+	// Nobody else touches the file once the writer is done
+	uv_thread_join(&writerThread);
+	fclose(captureFile);
+	captureFile = NULL;
+}
+
+
+/**********************************
+ * Replay
+ **********************************/
+bool OpenReplay(const char* path) {
+	FILE* file = fopen(path, "rb");
+	if(file == NULL) {
+		return false;
+	}
+
+	replayData.clear();
+	char buffer[64 * 1024];
+	size_t length;
+	while((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		replayData.insert(replayData.end(), buffer, buffer + length);
+	}
+	fclose(file);
+
+	if(
+		replayData.size() < CAPTURE_MAGIC_LENGTH + 1 ||
+		memcmp(&replayData[0], CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH) != 0 ||
+		replayData[CAPTURE_MAGIC_LENGTH] != CAPTURE_VERSION
+	) {
+		replayData.clear();
+		return false;
+	}
+
+	replayOffset = CAPTURE_MAGIC_LENGTH + 1;
+	return true;
+}
+
+bool ReadReplayUevent(CapturedUevent_t* event) {
+	return (
+		ReadVarint(&event->delayUs) &&
+		ReadByte(&event->action) &&
+		ReadByte(&event->flags) &&
+		ReadString(&event->devNode) &&
+		ReadString(&event->sysName) &&
+		ReadString(&event->parentDevNode) &&
+		ReadValues(&event->properties) &&
+		ReadValues(&event->sysattrs)
+	);
+}
+
+void CloseReplay() {
+	vector<char>().swap(replayData);
+	replayOffset = 0;
+}
+
+const char* GetUeventValue(const UeventValues_t& values, const char* name) {
+	for(UeventValues_t::const_iterator it = values.begin(); it != values.end(); ++it) {
+		if(it->first == name) {
+			return it->second.c_str();
+		}
+	}
+
+	return NULL;
+}
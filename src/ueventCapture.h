@@ -0,0 +1,76 @@
+#ifndef _UEVENT_CAPTURE_H
+#define _UEVENT_CAPTURE_H
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Recording and replay of the uevents the monitor thread handles (Linux
+ * only), to reproduce plug storms without the hardware.
+ *
+ * `USB_DETECTION_CAPTURE=<file>` records every uevent into `<file>`, which
+ * is truncated first, one capture per process run. The monitor thread only
+ * encodes the record, a background thread writes it.
+ *
+ * `USB_DETECTION_REPLAY=<file>` feeds a capture through the same add and
+ * remove handling instead of the udev monitor, at the recorded pace, or
+ * as fast as possible with `USB_DETECTION_REPLAY_PACE=fast`.
+ *
+ * Layout:
+ *   header: "USBDCAPT", uint8 version
+ *   records: varint microseconds since the previous record, uint8 action,
+ *     uint8 flags, then devnode, sysname and parent devnode as strings,
+ *     varint count + name/value strings for the properties and the same
+ *     for the sysattrs
+ * Varints are LEB128, strings a varint length + the bytes.
+ */
+#define CAPTURE_ENV "USB_DETECTION_CAPTURE"
+#define REPLAY_ENV "USB_DETECTION_REPLAY"
+#define REPLAY_PACE_ENV "USB_DETECTION_REPLAY_PACE"
+
+typedef enum _UeventAction_t {
+	UeventAction_Add,
+	UeventAction_Remove,
+	UeventAction_Change,
+	// Interfaces only, while `ready` events are tracked
+	UeventAction_Bind,
+	UeventAction_Unbind,
+} UeventAction_t;
+
+// Record flags
+#define UEVENT_FLAG_CHILD 0x01
+#define UEVENT_FLAG_INTERFACE 0x02
+
+typedef std::vector<std::pair<std::string, std::string> > UeventValues_t;
+
+typedef struct _CapturedUevent_t {
+	// Since the previous record
+	uint64_t delayUs;
+	int action;
+	int flags;
+	std::string devNode;
+	std::string sysName;
+	// Child (tty, hidraw, ...) and interface events only
+	std::string parentDevNode;
+	UeventValues_t properties;
+	// Device adds and changes only, removed devices have none left
+	UeventValues_t sysattrs;
+} CapturedUevent_t;
+
+// NULL if there is no such value
+const char* GetUeventValue(const UeventValues_t& values, const char* name);
+
+bool OpenCapture(const char* path);
+// Monitor thread, only encodes and queues the record
+void CaptureUevent(CapturedUevent_t* event);
+// At exit, safe while the monitor thread still captures, its records are dropped from here on
+void CloseCapture();
+
+bool OpenReplay(const char* path);
+// False at the end of the capture (or at a truncated record)
+bool ReadReplayUevent(CapturedUevent_t* event);
+void CloseReplay();
+
+#endif
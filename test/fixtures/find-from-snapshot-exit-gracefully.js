@@ -0,0 +1,12 @@
+// Needs to be set before the addon is loaded
+process.env.USB_DETECTION_SNAPSHOT = process.argv[2];
+
+var usbDetect = require('../../');
+
+usbDetect.find()
+	.then(function(devices) {
+		process.stdout.write(JSON.stringify({
+			count: devices.length,
+			provisional: !!devices.provisional
+		}));
+	});
@@ -0,0 +1,13 @@
+var usbDetect = require('../../');
+
+usbDetect.startMonitoring();
+usbDetect.pauseMonitoring();
+
+setTimeout(function() {
+	usbDetect.resumeMonitoring();
+
+	// Left paused on purpose, a paused monitor should not keep us alive
+	setTimeout(function() {
+		usbDetect.pauseMonitoring();
+	}, 100);
+}, 100);
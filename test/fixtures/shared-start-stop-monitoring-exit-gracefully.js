@@ -0,0 +1,11 @@
+// Needs to be set before the addon is loaded
+process.env.USB_DETECTION_SHARED = 'usb-detection-test';
+
+var usbDetect = require('../../');
+
+usbDetect.startMonitoring();
+
+usbDetect.find()
+	.then(function() {
+		usbDetect.stopMonitoring();
+	});
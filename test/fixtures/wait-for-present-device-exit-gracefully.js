@@ -0,0 +1,15 @@
+var usbDetect = require('../../');
+
+// No `startMonitoring` and no timeout, only the answer keeps us alive
+usbDetect.find()
+	.then(function(devices) {
+		if(devices.length === 0) {
+			process.stdout.write('none');
+			return;
+		}
+
+		return usbDetect.waitFor({ vendorId: devices[0].vendorId })
+			.then(function() {
+				process.stdout.write('resolved');
+			});
+	});
@@ -1,3 +1,5 @@
+var os = require('os');
+var fs = require('fs');
 var path = require('path');
 
 var chai = require('chai');
@@ -20,7 +22,14 @@ var DEVICE_OBJECT_FIXTURE = {
 	deviceName: 'Teensy USB Serial (COM3)',
 	manufacturer: 'PJRC.COM, LLC.',
 	serialNumber: '',
-	deviceAddress: 11
+	deviceAddress: 11,
+	portPath: '',
+	childDevNodes: [],
+	properties: {},
+	deviceClass: 0,
+	deviceSubClass: 0,
+	deviceProtocol: 0,
+	interfaces: []
 };
 
 function once(eventName) {
@@ -90,6 +99,59 @@ describe('usb-detection', function() {
 			});
 
 
+			it('should only return the requested fields', async function() {
+				const devices = await usbDetect.find({ fields: ['vendorId', 'productId'] });
+				expect(devices.length).to.be.greaterThan(0);
+				devices.forEach(function(device) {
+					expect(device).to.have.all.keys('vendorId', 'productId');
+				});
+			});
+
+			it('should reject unknown fields', function(done) {
+				usbDetect.find({ fields: ['color'] })
+					.then(function() {
+						done.fail('Expected the promise to be rejected');
+					})
+					.catch(function(err) {
+						expect(err).to.be.an.instanceof(TypeError);
+						done();
+					});
+			});
+
+			it('should only return devices of the requested class', async function() {
+				const devices = await usbDetect.find();
+				const byClass = await usbDetect.find({ deviceClass: devices[0].deviceClass });
+				expect(byClass.length).to.be.greaterThan(0);
+				byClass.forEach(function(device) {
+					expect(device.deviceClass).to.equal(devices[0].deviceClass);
+				});
+
+				const withInterface = devices.filter(function(device) {
+					return device.interfaces.length > 0;
+				})[0];
+				if(withInterface) {
+					const interfaceClass = withInterface.interfaces[0].interfaceClass;
+					const byInterface = await usbDetect.find({ interfaceClass: interfaceClass });
+					expect(byInterface.length).to.be.greaterThan(0);
+					byInterface.forEach(function(device) {
+						expect(device.interfaces.map(function(descriptor) {
+							return descriptor.interfaceClass;
+						})).to.include(interfaceClass);
+					});
+				}
+			});
+
+			it('should reject class options out of range', function(done) {
+				usbDetect.find({ interfaceClass: 256 })
+					.then(function() {
+						done.fail('Expected the promise to be rejected');
+					})
+					.catch(function(err) {
+						expect(err).to.be.an.instanceof(TypeError);
+						done();
+					});
+			});
+
 			it('should return a promise', function(done) {
 				usbDetect.find()
 					.then(function(devices) {
@@ -98,6 +160,290 @@ describe('usb-detection', function() {
 					.then(done)
 					.catch(done.fail);
 			});
+
+			it('should share one scan between identical concurrent calls', async function() {
+				const results = await Promise.all([usbDetect.find(), usbDetect.find(), usbDetect.find({ fields: ['vendorId'] })]);
+				testArrayOfDevicesShape(results[0]);
+				expect(results[1]).to.not.equal(results[0]);
+				expect(results[1]).to.deep.equal(results[0]);
+				// Each caller owns its devices, changing one doesn't show up in the other result
+				results[0][0].vendorId = -1;
+				expect(results[1][0].vendorId).to.not.equal(-1);
+				expect(results[2]).to.not.equal(results[0]);
+				expect(results[2].length).to.equal(results[0].length);
+			});
+		});
+
+		describe('`.findMany`', function() {
+			it('should group the results by query like separate finds', async function() {
+				const devices = await usbDetect.find();
+				const device = devices[0];
+				const groups = await usbDetect.findMany([
+					{ vendorId: device.vendorId, productId: device.productId },
+					{ vendorId: device.vendorId },
+					{ vendorId: 0xfffe, productId: 0xfffe }
+				]);
+
+				expect(groups.length).to.equal(3);
+				expect(groups[0].length).to.equal((await usbDetect.find(device.vendorId, device.productId)).length);
+				expect(groups[1].length).to.equal((await usbDetect.find(device.vendorId)).length);
+				expect(groups[2].length).to.equal(0);
+				groups[0].forEach(function(found) {
+					testDeviceShape(found);
+				});
+			});
+
+			it('should only put the requested fields on the devices', async function() {
+				const groups = await usbDetect.findMany([{}], { fields: ['vendorId'] });
+				groups[0].forEach(function(device) {
+					expect(Object.keys(device)).to.deep.equal(['vendorId']);
+				});
+			});
+
+			it('should reject queries which are not objects', function() {
+				return usbDetect.findMany([1234])
+					.then(function() {
+						throw new Error('Expected the promise to be rejected');
+					}, function(err) {
+						expect(err).to.be.an.instanceof(TypeError);
+					});
+			});
+		});
+
+		describe('`.findUnder`/`.parentOf`/`.getAttributes`', function() {
+			it('should find a device under its own port path', async function() {
+				const devices = await usbDetect.find();
+				const device = devices.find(function(candidate) {
+					return candidate.portPath.length > 0;
+				});
+				if(!device) {
+					// Topology is only tracked on Linux
+					return;
+				}
+
+				const subtree = await usbDetect.findUnder(device.portPath);
+				expect(subtree[0].portPath).to.equal(device.portPath);
+			});
+
+			it('should return the cached attributes of a device', async function() {
+				const devices = await usbDetect.find({ fields: ['portPath'] });
+				const device = devices.find(function(candidate) {
+					return candidate.portPath.length > 0;
+				});
+				if(!device) {
+					return;
+				}
+
+				const attributes = usbDetect.getAttributes(device);
+				expect(attributes).to.be.an('object');
+				expect(attributes.idVendor).to.be.a('string');
+			});
+
+			it('should resolve `undefined` when there is no parent', async function() {
+				const parent = await usbDetect.parentOf('usb999');
+				expect(parent).to.equal(undefined);
+			});
+		});
+
+		describe('`.findBySerial`/`.findBySerialPrefix`', function() {
+			it('should find devices by serial number and prefix', async function() {
+				const devices = await usbDetect.find();
+				const withSerial = devices.filter(function(device) {
+					return device.serialNumber.length > 0;
+				})[0];
+				if(!withSerial) {
+					return;
+				}
+
+				const exact = await usbDetect.findBySerial(withSerial.serialNumber);
+				expect(exact.length).to.be.greaterThan(0);
+				exact.forEach(function(device) {
+					expect(device.serialNumber).to.equal(withSerial.serialNumber);
+				});
+
+				const prefix = withSerial.serialNumber.slice(0, 2);
+				const byPrefix = await usbDetect.findBySerialPrefix(prefix);
+				expect(byPrefix.length).to.equal(devices.filter(function(device) {
+					return device.serialNumber.length > 0 && device.serialNumber.startsWith(prefix);
+				}).length);
+			});
+
+			it('should resolve an empty list for an unknown serial number', async function() {
+				const devices = await usbDetect.findBySerial('usb-detection-no-such-serial');
+				expect(devices.length).to.equal(0);
+			});
+		});
+
+		describe('`.topologyHash`', function() {
+			it('should return the same digest until the devices change', function() {
+				var hash = usbDetect.topologyHash();
+				expect(hash).to.match(/^[0-9a-f]{32}$/);
+				expect(usbDetect.topologyHash()).to.equal(hash);
+			});
+
+			it('should return the empty digest for a vendor without devices', function() {
+				expect(usbDetect.topologyHash({ vendorId: 0xfffe })).to.equal('0'.repeat(32));
+			});
+		});
+
+		describe('`.serialize`', function() {
+			it('should write one JSON line per device', async function() {
+				const devices = await usbDetect.find();
+				const buffer = await usbDetect.serialize({ format: 'ndjson' });
+				const lines = buffer.toString('utf8').split('\n').filter(function(line) {
+					return line.length > 0;
+				});
+				expect(lines.length).to.equal(devices.length);
+				lines.forEach(function(line) {
+					testDeviceShape(JSON.parse(line));
+				});
+			});
+
+			it('should round-trip the binary format through `decode`', async function() {
+				const devices = await usbDetect.find();
+				const buffer = await usbDetect.serialize({ format: 'binary' });
+				expect(usbDetect.decode(buffer)).to.deep.equal(devices);
+			});
+
+			it('should only write the requested fields of the filtered devices', async function() {
+				const buffer = await usbDetect.serialize({ format: 'binary', filter: { vendorId: 0xfffe }, fields: ['vendorId'] });
+				expect(usbDetect.decode(buffer).length).to.equal(0);
+			});
+
+			it('should reject an unknown format', async function() {
+				try {
+					await usbDetect.serialize({ format: 'xml' });
+				} catch(err) {
+					expect(err).to.be.an.instanceof(TypeError);
+					return;
+				}
+				throw new Error('Expected `serialize` to reject');
+			});
+		});
+
+		describe('`.waitFor`', function() {
+			it('should resolve with a device that is already plugged in', async function() {
+				const devices = await usbDetect.find();
+				const device = await usbDetect.waitFor({ vendorId: devices[0].vendorId, productId: devices[0].productId }, 1000);
+				testDeviceShape(device);
+				expect(device.vendorId).to.equal(devices[0].vendorId);
+			});
+
+			it('should reject when nothing matches before the timeout', function(done) {
+				usbDetect.waitFor({ vendorId: 0xfffe, productId: 0xfffe }, 50)
+					.then(function() {
+						done.fail('Expected the promise to be rejected');
+					})
+					.catch(function(err) {
+						expect(err).to.be.an.instanceof(Error);
+						done();
+					});
+			});
+		});
+
+		describe('`.getHistory`', function() {
+			it('should return the journaled events with the last sequence number', function() {
+				const history = usbDetect.getHistory();
+				expect(history.lastSeq).to.be.a('number');
+				history.forEach(function(event) {
+					expect(event.seq).to.be.at.most(history.lastSeq);
+					expect(event.timestamp).to.be.at.most(Date.now());
+					expect(event.action).to.be.oneOf(['add', 'remove']);
+					testDeviceShape(event.device);
+				});
+			});
+
+			it('should return nothing after the last sequence number', function() {
+				const lastSeq = usbDetect.getHistory().lastSeq;
+				expect(usbDetect.getHistory({ sinceSeq: lastSeq }).length).to.equal(0);
+			});
+
+			it('should throw on an invalid `sinceSeq`', function() {
+				expect(function() {
+					usbDetect.getHistory({ sinceSeq: 'latest' });
+				}).to.throw(TypeError);
+			});
+		});
+
+		describe('`.startTracing`/`.stopTracing`', function() {
+			it('should return Chrome trace-event JSON', function() {
+				usbDetect.startTracing();
+				return usbDetect.find()
+					.then(function() {
+						const trace = JSON.parse(usbDetect.stopTracing());
+						expect(trace.traceEvents).to.be.an('array');
+						expect(trace.droppedSpans).to.be.a('number');
+						trace.traceEvents.forEach(function(event) {
+							expect(event.pid).to.equal(process.pid);
+							expect(event.ph).to.be.oneOf(['X', 'M']);
+						});
+					});
+			});
+		});
+
+		describe('`.createMonitor`', function() {
+			it('should return a monitor that can be closed more than once', function() {
+				var monitor = usbDetect.createMonitor({ actions: ['add'] });
+				expect(monitor.on).to.be.a('function');
+				monitor.close();
+				monitor.close();
+			});
+
+			it('should throw on unknown actions', function() {
+				expect(function() {
+					usbDetect.createMonitor({ actions: ['unplug'] });
+				}).to.throw(TypeError);
+			});
+
+			it('should accept `ready` as an action', function() {
+				var monitor = usbDetect.createMonitor({ actions: ['add', 'ready'] });
+				monitor.close();
+			});
+
+			it('should only call matching monitors', function(done) {
+				console.log(chalk.black.bgCyan('Add/Insert or Remove a USB device'));
+				var removeOnly = usbDetect.createMonitor({ actions: ['remove'] });
+				var everything = usbDetect.createMonitor();
+
+				var sawAdd = false;
+				removeOnly.on('add', function() {
+					sawAdd = true;
+				});
+				everything.on('change', function(device) {
+					testDeviceShape(device);
+					removeOnly.close();
+					everything.close();
+					expect(sawAdd).to.equal(false);
+					done();
+				});
+			}, MANUAL_INTERACTION_TIMEOUT);
+		});
+
+		describe('`.enableReadyEvents`', function() {
+			it('should throw on a negative settle timeout', function() {
+				expect(function() {
+					usbDetect.enableReadyEvents({ settleTimeout: -1 });
+				}).to.throw(TypeError);
+			});
+
+			it('should follow an add with ready', function(done) {
+				console.log(chalk.black.bgCyan('Add/Insert a USB device'));
+				usbDetect.enableReadyEvents({ settleTimeout: 5000 });
+
+				var added;
+				once('add')
+					.then(function(device) {
+						added = device;
+						return once('ready');
+					})
+					.then(function(device) {
+						testDeviceShape(device);
+						expect(device.vendorId).to.equal(added.vendorId);
+						expect(device.productId).to.equal(added.productId);
+					})
+					.then(done)
+					.catch(done.fail);
+			}, MANUAL_INTERACTION_TIMEOUT);
 		});
 
 		describe('Events `.on`', function() {
@@ -158,6 +504,55 @@ describe('usb-detection', function() {
 				});
 		});
 
+		it('after `startMonitoring`, `pauseMonitoring` and `resumeMonitoring`, left paused', (done) => {
+			commandRunner(`node ${path.join(__dirname, './fixtures/pause-resume-monitoring-exit-gracefully.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('when starting from a snapshot', (done) => {
+			const snapshotPath = path.join(os.tmpdir(), `usb-detection-test-${process.pid}.snapshot`);
+			const command = `node ${path.join(__dirname, './fixtures/find-from-snapshot-exit-gracefully.js')} ${snapshotPath}`;
+
+			// The first run writes the snapshot, the second one starts from it
+			commandRunner(command)
+				.then((coldResult) => {
+					return commandRunner(command)
+						.then((warmResult) => {
+							expect(JSON.parse(warmResult.stdout).count).to.equal(JSON.parse(coldResult.stdout).count);
+						});
+				})
+				.then(() => {
+					fs.unlinkSync(snapshotPath);
+				})
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err || resultInfo);
+				});
+		});
+
+		it('after `waitFor` resolved from a device already present, without monitoring', (done) => {
+			commandRunner(`node ${path.join(__dirname, './fixtures/wait-for-present-device-exit-gracefully.js')}`)
+				.then((resultInfo) => {
+					// Without devices there is nothing to wait for, it still has to exit
+					expect(resultInfo.stdout).to.be.oneOf(['resolved', 'none']);
+				})
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err || resultInfo);
+				});
+		});
+
+		it('after `startMonitoring` then `stopMonitoring` in shared mode', (done) => {
+			commandRunner(`node ${path.join(__dirname, './fixtures/shared-start-stop-monitoring-exit-gracefully.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
 		it('when SIGINT (Ctrl + c) after `startMonitoring`', (done) => {
 			const executor = new ChildExecutor();
 